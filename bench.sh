@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Times the parser on sketches/json.gzl and tests/grammars/lookahead.gzl,
+# once for each way that run_parser() in runtime/parse.c can go from one
+# state to the next: computed goto (utilities/gzlbench) and the portable
+# switch (utilities/gzlbench-switch), and once more with the grammar
+# JIT-compiled.  "make bench" builds both and runs this.
+
+DIR=/tmp/gazelle-bench
+rm -rf $DIR
+mkdir -p $DIR
+
+# The same input as stats.sh.
+LINE='"glossary":{"title":"example glossary","GlossDiv":{"title":"S","GlossList":{"GlossEntry":{"ID":"SGML","SortAs":"SGML","GlossTerm":"Standard Generalized Markup Language","Acronym":"SGML","Abbrev":"ISO 8879:1986","GlossDef":{"para":"A meta-markup language, used to create markup languages such as DocBook.","GlossSeeAlso":["GML","XML"]},"GlossSee":"markup"}}}},'
+echo $LINE > $DIR/jsonfile
+perl -e 'chop($str = <STDIN>); print "{" . $str x 100000 . "\"foo\":1}"' < $DIR/jsonfile > $DIR/json.in
+
+# Statements that take GLAs to tell apart, many times over.
+perl -e 'local $/; $str = <STDIN>; print $str x 20000' \
+    < tests/grammars/lookahead.in > $DIR/lookahead.in
+
+for GRAMMAR in sketches/json tests/grammars/lookahead ; do
+  NAME=`basename $GRAMMAR`
+  ./gzlc -o $DIR/$NAME.gzc $GRAMMAR.gzl || exit 1
+  echo "$NAME threaded: `./utilities/gzlbench $DIR/$NAME.gzc $DIR/$NAME.in 2>&1`"
+  echo "$NAME switch:   `./utilities/gzlbench-switch $DIR/$NAME.gzc $DIR/$NAME.in 2>&1`"
+  echo "$NAME jit:      `./utilities/gzlbench --jit $DIR/$NAME.gzc $DIR/$NAME.in 2>&1`"
+done
@@ -129,13 +129,12 @@ function parse_prim(chars)
   else
     local char, escaped = parse_char(chars)
     int_set = IntSet:new()
-    if char == "." and not escaped then
+    if char == string.byte(".") and not escaped then
       int_set:add(Range:new(0, math.huge))
     else
-      int_set:add(Range:new(char:byte(), char:byte()))
+      int_set:add(Range:new(char, char))
     end
-    char = fa.IntFA:new{symbol=int_set}
-    return char
+    return nfa_construct.char_class(int_set)
   end
 end
 
@@ -149,21 +148,24 @@ function parse_char_class(chars)
 
   while true do
     local char, escaped = parse_char(chars)
-    if char == "]" and not escaped then
+    if char == string.byte("]") and not escaped then
       break
     end
     if chars:lookahead(1) == "-" and chars:lookahead(2) ~= "]" then
       chars:get()
       local high_char = parse_char(chars)
-      int_set:add(Range:new(char:byte(), high_char:byte()))
+      int_set:add(Range:new(char, high_char))
     else
-      int_set:add(Range:new(char:byte(), char:byte()))
+      int_set:add(Range:new(char, char))
     end
   end
 
-  return fa.IntFA:new{symbol=int_set}
+  return nfa_construct.char_class(int_set)
 end
 
+-- Returns the code point of the next character and whether it was escaped.
+-- Characters are usually single bytes, but a UTF-8 sequence in the regex
+-- text or a \x{...} escape gives a Unicode code point.
 function parse_char(chars)
   local char = chars:get()
   local escaped = false
@@ -175,10 +177,56 @@ function parse_char(chars)
     elseif char == "f" then char = "\f"
     elseif char == "r" then char = "\r"
     elseif char == "s" then char = " "
+    elseif char == "x" and chars:lookahead(1) == "{" then
+      return parse_code_point(chars), true
     else escaped = true
     end
+  elseif char:byte() >= 0xC0 then
+    return parse_utf8_char(chars, char:byte()), false
+  end
+  return char:byte(), escaped
+end
+
+-- Parses the "{1F600}" part of a \x{1F600} escape.
+function parse_code_point(chars)
+  chars:get()  -- the opening brace
+  local hex = ""
+  while chars:lookahead(1) ~= "}" do
+    hex = hex .. chars:get()
+  end
+  chars:get()  -- the closing brace
+
+  local code_point = tonumber(hex, 16)
+  if not code_point or code_point > nfa_construct.MAX_CODE_POINT then
+    error("Invalid code point in regex: \\x{" .. hex .. "}")
+  end
+  return code_point
+end
+
+-- Decodes a UTF-8 sequence in the regex text, given its already-consumed
+-- lead byte.  A lead byte that isn't followed by the right number of
+-- continuation bytes is taken as a Latin-1 character.
+function parse_utf8_char(chars, lead_byte)
+  local num_continuation_bytes, code_point
+  if lead_byte >= 0xF0 then
+    num_continuation_bytes, code_point = 3, lead_byte % 0x08
+  elseif lead_byte >= 0xE0 then
+    num_continuation_bytes, code_point = 2, lead_byte % 0x10
+  else
+    num_continuation_bytes, code_point = 1, lead_byte % 0x20
+  end
+
+  for i=1,num_continuation_bytes do
+    local byte = chars:lookahead(i):byte()
+    if byte == nil or byte < 0x80 or byte >= 0xC0 then
+      return lead_byte
+    end
+  end
+
+  for i=1,num_continuation_bytes do
+    code_point = code_point * 0x40 + (chars:get():byte() - 0x80)
   end
-  return char, escaped
+  return code_point
 end
 
 function parse_number(chars)
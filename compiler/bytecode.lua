@@ -26,6 +26,9 @@ BC_INTFA_STATE = 0
 BC_INTFA_FINAL_STATE = 1
 BC_INTFA_TRANSITION = 2
 BC_INTFA_TRANSITION_RANGE = 3
+BC_INTFA_KEYWORD_TABLE = 4
+BC_INTFA_KEYWORD = 5
+BC_INTFA_SKIP = 6
 
 BC_STRING = 0
 
@@ -153,6 +156,27 @@ function emit_intfa(intfa, strings, bc_file, abbrevs)
     end
   end
 
+  -- emit the terminals to skip, sorted for deterministic output
+  local skip_terms = intfa.skip_terms and intfa.skip_terms:to_array() or {}
+  table.sort(skip_terms)
+  for term in each(skip_terms) do
+    bc_file:write_abbreviated_record(abbrevs.bc_intfa_skip, strings:offset_of(term))
+  end
+
+  -- emit the keyword table, if any
+  if intfa.keywords then
+    print_verbose(string.format("  %d keywords in a table of %d", #intfa.keywords, intfa.keywords.size))
+    bc_file:write_abbreviated_record(abbrevs.bc_intfa_keyword_table,
+                                     intfa.keywords.multiplier, intfa.keywords.size)
+    for keyword in each(intfa.keywords) do
+      local name, text, identifier, slot = unpack(keyword)
+      bc_file:write_abbreviated_record(abbrevs.bc_intfa_keyword, slot,
+                                       strings:offset_of(text),
+                                       strings:offset_of(name),
+                                       strings:offset_of(identifier))
+    end
+  end
+
   bc_file:end_subblock(BC_INTFA)
 end
 
@@ -304,6 +328,22 @@ function define_abbrevs(bc_file)
                                       bc.VBROp:new(8),
                                       bc.VBROp:new(6))
 
+  abbrevs.bc_intfa_keyword_table = bc_file:define_abbreviation(8,
+                                      bc.LiteralOp:new(BC_INTFA_KEYWORD_TABLE),
+                                      bc.VBROp:new(8),
+                                      bc.VBROp:new(6))
+
+  abbrevs.bc_intfa_keyword = bc_file:define_abbreviation(9,
+                                      bc.LiteralOp:new(BC_INTFA_KEYWORD),
+                                      bc.VBROp:new(6),
+                                      bc.VBROp:new(5),
+                                      bc.VBROp:new(5),
+                                      bc.VBROp:new(5))
+
+  abbrevs.bc_intfa_skip = bc_file:define_abbreviation(10,
+                                      bc.LiteralOp:new(BC_INTFA_SKIP),
+                                      bc.VBROp:new(5))
+
   -- Strings abbreviations
   bc_file:write_unabbreviated_record(bc.SETBID, BC_STRINGS)
 
@@ -239,6 +239,8 @@ define_class("IntFA", FA)
 function IntFA:initialize(init)
   FA.initialize(self, init)
   self.termset = nil
+  self.skip_terms = nil  -- terminals of the termset to skip (@allow)
+  self.keywords = nil  -- keywords recognized with a hash table, if any
   self.regex_text = nil
 end
 
@@ -478,6 +480,7 @@ function RTN:initialize(init)
   self.name = nil
   self.slot_count = nil
   self.text = nil
+  self.skip_terms = nil  -- terminals the lexer skips in this rule (@allow)
 end
 
 function RTN:new_graph(init)
@@ -157,6 +157,9 @@ function Grammar:initialize()
   -- to separate lists for processing.
   self.rtns = nil
   self.terminals = nil
+
+  -- RTN state -> Set of terminals the lexer skips there, from @allow.
+  self.skip_terms_by_state = nil
 end
 
 function Grammar:parse_source_string(string)
@@ -226,6 +229,10 @@ function Grammar:process()
 end
 
 function Grammar:compute_lookahead(max_k)
+  -- What the lexer skips is worked out on the final RTNs, but before the
+  -- lookahead, since it can give states @allow transitions back.
+  self.skip_terms_by_state = self:get_skip_terminals_by_state()
+
   -- Generate GLAs by doing lookahead calculations.
   -- This annotates every nontrivial state in the grammar with a GLA.
   --print_verbose("Doing LL(*) lookahead calculations...")
@@ -286,9 +293,34 @@ function Grammar:add_allow(what_to_allow, start_nonterm, end_nonterms)
   table.insert(self.allow, {what_to_allow, start_nonterm, end_nonterms})
 end
 
+-- If every path through the given rule is a single terminal (as it is for
+-- the usual whitespace or comment rule), returns the Set of those terminals.
+-- Otherwise returns nil.
+function Grammar:get_skip_terminals(rule_name)
+  local rtn = self.rtns:get(rule_name)
+  if not rtn or rtn.start.final then return nil end
+  local terms = Set:new()
+  for edge_val, dest_state in rtn.start:transitions() do
+    if fa.is_nonterm(edge_val) or edge_val == fa.eof or
+       not dest_state.final or dest_state:num_transitions() > 0 then
+      return nil
+    end
+    terms:add(edge_val)
+  end
+  return terms
+end
+
 function Grammar:process_allow()
   for allow in each(self.allow) do
     local what_to_allow, start_nonterm, end_nonterms = unpack(allow)
+    local allow_rtn = self.rtns:get(what_to_allow)
+
+    -- When what we allow is just a choice of terminals, the lexer skips them
+    -- wherever they are allowed, and the RTNs and GLAs never see them.
+    local skip_terms = self:get_skip_terminals(what_to_allow)
+    local skipping_rules = Set:new()
+    local allow_states = Set:new()
+
     local function children_func(rule_name)
       if not end_nonterms:contains(rule_name) then
         local rtn = self.rtns:get(rule_name)
@@ -306,10 +338,20 @@ function Grammar:process_allow()
           end
         end
 
-        -- add self-transitions for every state
+        if skip_terms then
+          rtn.skip_terms = rtn.skip_terms or Set:new()
+          rtn.skip_terms:add_collection(skip_terms)
+          skipping_rules:add(rule_name)
+        end
+
+        -- add self-transitions for every state.  When the lexer skips the
+        -- allowed terminals we only need them where the start rule ends, so
+        -- that they are still consumed after the last terminal of the input.
         for state in each(rtn:states()) do
-          local allow_rtn = self.rtns:get(what_to_allow)
-          state:add_transition(allow_rtn, state, {name=allow_rtn.name, slotnum=-1})
+          if not skip_terms or
+             (rule_name == self.start and state.final and state:num_transitions() == 0) then
+            allow_states:add(state)
+          end
         end
 
         return subrules
@@ -317,9 +359,72 @@ function Grammar:process_allow()
     end
 
     depth_first_traversal(start_nonterm, children_func)
+    if skip_terms then
+      allow_states:add_collection(self:get_states_after_open_rules(skipping_rules))
+    end
+    for state in each(allow_states) do
+      state:add_transition(allow_rtn, state, {name=allow_rtn.name, slotnum=-1})
+    end
   end
 end
 
+-- Whether a final state can also go on, other than by an @allow transition
+-- (like a number after its integer part, which can have a decimal part).
+function has_continuation(state)
+  for edge_val, dest_state, properties in state:transitions() do
+    if properties.slotnum ~= -1 then
+      return true
+    end
+  end
+  return false
+end
+
+-- A rule that doesn't skip the allowed terminals itself ends "open" if one
+-- of its final states has a continuation, or if it ends by calling a rule
+-- that ends open.  The lexer can't skip its callers' terminals in such a
+-- state, or they would be accepted before the continuation ("1 .5" would be
+-- one JSON number), so where it returns to one of the skipping_rules that
+-- state consumes them with an @allow transition instead, as before the
+-- lexer skipped anything.  Returns the Set of those states.
+function Grammar:get_states_after_open_rules(skipping_rules)
+  local open_rules = Set:new()
+  local changed = true
+  while changed do
+    changed = false
+    for name, rtn in each(self.rtns) do
+      if not skipping_rules:contains(name) and not open_rules:contains(name) then
+        for state in each(rtn:states()) do
+          if state.final and has_continuation(state) then
+            open_rules:add(name)
+          end
+          for edge_val, dest_state, properties in state:transitions() do
+            if fa.is_nonterm(edge_val) and properties.slotnum ~= -1 and
+               dest_state.final and open_rules:contains(edge_val.name) then
+              open_rules:add(name)
+            end
+          end
+        end
+        if open_rules:contains(name) then
+          changed = true
+        end
+      end
+    end
+  end
+
+  local states = Set:new()
+  for name in each(skipping_rules) do
+    for state in each(self.rtns:get(name):states()) do
+      for edge_val, dest_state, properties in state:transitions() do
+        if fa.is_nonterm(edge_val) and properties.slotnum ~= -1 and
+           open_rules:contains(edge_val.name) then
+          states:add(dest_state)
+        end
+      end
+    end
+  end
+  return states
+end
+
 function Grammar:canonicalize_properties()
   for name, rtn in each(self.rtns) do
     for state in each(rtn:states()) do
@@ -431,6 +536,198 @@ function Grammar:minimize_rtns()
   self.rtns = new_rtns
 end
 
+-- Computes which terminals @allow lets the lexer skip in each RTN state.
+-- This is mostly just the terminals the state's rule skips, but a rule's
+-- first terminal is also next to whatever its callers have before the call,
+-- and where the rule has certainly ended, to whatever they have after it.
+-- So a rule outside the @allow region (like a string) can still be preceded
+-- and followed by whitespace where rules inside the region call it.  Only
+-- what every call site allows is skipped there, or a rule that is also
+-- called from outside the region would accept whitespace there too.  A
+-- start state that can be reached again from inside its own rule is
+-- between two of the rule's components, so it doesn't get its callers'
+-- terminals, and neither does a final state with a continuation (see
+-- get_states_after_open_rules()).  Returns a table of RTN state -> Set of
+-- terminals.
+function Grammar:get_skip_terminals_by_state()
+  -- Every call of one rule from another, leaving out @allow transitions.
+  -- The start rule is called once more from outside the grammar, where
+  -- nothing is skipped.
+  local calls = {}
+  local start_reentered = {}
+  for name, rtn in each(self.rtns) do
+    calls[rtn] = {}
+    for state in each(rtn:states()) do
+      for edge_val, dest_state in state:transitions() do
+        if dest_state == rtn.start then
+          start_reentered[rtn] = true
+        end
+      end
+    end
+  end
+  for name, rtn in each(self.rtns) do
+    for state in each(rtn:states()) do
+      for edge_val, dest_state, properties in state:transitions() do
+        if fa.is_nonterm(edge_val) and properties.slotnum ~= -1 then
+          -- Transitions still point to the RTNs as they were parsed.
+          table.insert(calls[self.rtns:get(edge_val.name)], {state, dest_state})
+        end
+      end
+    end
+  end
+  local outside = {}
+  table.insert(calls[self.rtns:get(self.start)], {outside, outside})
+
+  -- What a rule's callers all allow before and after it.  nil means "not
+  -- known yet", and stands for every terminal until the rule turns out to
+  -- be called from somewhere.
+  local before = {[outside]=Set:new()}
+  local after = {}
+  local function skip_terms_for(state)
+    if state == outside then return before[outside] end
+    local rtn = state.rtn
+    local terms = Set:new()
+    terms:add_collection(rtn.skip_terms or {})
+    if state == rtn.start and not start_reentered[rtn] then
+      if not before[rtn] then return nil end
+      terms:add_collection(before[rtn])
+    end
+    if state.final and not has_continuation(state) then
+      if not after[rtn] then return nil end
+      terms:add_collection(after[rtn])
+    end
+    return terms
+  end
+
+  local function intersect(terms, other)
+    if not other then return terms end
+    if not terms then return other end
+    local result = Set:new()
+    for term in each(terms) do
+      if other:contains(term) then result:add(term) end
+    end
+    return result
+  end
+
+  local function same(terms, other)
+    if not terms or not other then return terms == other end
+    return terms:count() == other:count() and
+           intersect(terms, other):count() == terms:count()
+  end
+
+  local changed = true
+  while changed do
+    changed = false
+    for rtn, rtn_calls in pairs(calls) do
+      local new_before, new_after
+      for call in each(rtn_calls) do
+        local state, dest_state = unpack(call)
+        new_before = intersect(new_before, skip_terms_for(state))
+        new_after = intersect(new_after, skip_terms_for(dest_state))
+      end
+      if not same(new_before, before[rtn]) or not same(new_after, after[rtn]) then
+        before[rtn], after[rtn] = new_before, new_after
+        changed = true
+      end
+    end
+  end
+
+  -- A rule that is only called from rules that are never called itself.
+  for rtn in pairs(calls) do
+    before[rtn] = before[rtn] or Set:new()
+    after[rtn] = after[rtn] or Set:new()
+  end
+
+  local skip_terms = {}
+  for name, rtn in each(self.rtns) do
+    for state in each(rtn:states()) do
+      skip_terms[state] = skip_terms_for(state)
+    end
+  end
+  self:add_allow_transitions_for_calls(calls, skip_terms)
+  return skip_terms
+end
+
+-- Where a call site allows something its callee's first or last state
+-- doesn't skip, or the other way around, the lexer would now reject what
+-- @allow allowed before it skipped anything.  Those states get the @allow
+-- self-transition back: a caller that allows whitespace consumes it before
+-- or after a rule that is also called from outside the region, and a rule
+-- in the region consumes it at its start or end where its caller doesn't.
+function Grammar:add_allow_transitions_for_calls(calls, skip_terms)
+  local allow_states = {}
+  local function allow_in(state, terms)
+    allow_states[state] = allow_states[state] or Set:new()
+    allow_states[state]:add_collection(terms)
+  end
+  local function missing(terms, other)
+    local result = Set:new()
+    for term in each(terms) do
+      if not other:contains(term) then result:add(term) end
+    end
+    return result
+  end
+
+  for rtn, rtn_calls in pairs(calls) do
+    for call in each(rtn_calls) do
+      local state, dest_state = unpack(call)
+      if skip_terms[state] then
+        allow_in(state, missing(skip_terms[state], skip_terms[rtn.start]))
+        if state:needs_gla() then
+          allow_in(rtn.start, missing(skip_terms[rtn.start], skip_terms[state]))
+        end
+      end
+      for final_state in each(rtn:states()) do
+        if final_state.final and not has_continuation(final_state) then
+          if skip_terms[dest_state] and final_state:num_transitions() > 0 then
+            allow_in(dest_state, missing(skip_terms[dest_state], skip_terms[final_state]))
+          end
+          allow_in(final_state, missing(skip_terms[final_state],
+                                        skip_terms[dest_state] or Set:new()))
+        end
+      end
+    end
+  end
+
+  for allow in each(self.allow) do
+    local allow_rtn = self.rtns:get(allow[1])
+    local terms = self:get_skip_terminals(allow[1])
+    local properties = get_unique_table_for_table({name=allow_rtn.name, slotnum=-1})
+    for name, rtn in each(self.rtns) do
+      for state in each(rtn:states()) do
+        local needed, present = false, false
+        for term in each(terms or {}) do
+          if allow_states[state] and allow_states[state]:contains(term) then
+            needed = true
+          end
+        end
+        for edge_val, dest_state in state:transitions() do
+          if fa.is_nonterm(edge_val) and edge_val.name == allow_rtn.name and
+             dest_state == state then
+            present = true
+          end
+        end
+        if needed and not present then
+          state:add_transition(allow_rtn, state, properties)
+        end
+      end
+    end
+  end
+end
+
+-- Returns the terminals the lexer may skip in the given RTN or GLA state.
+-- For a GLA, only the first terminal of lookahead is next to the RTN state;
+-- later ones just get what the RTN state's rule skips.
+function Grammar:get_skip_terminals_for_state(state, skip_terms_by_state)
+  if state.rtn then
+    return skip_terms_by_state[state]
+  elseif state == state.gla.start then
+    return skip_terms_by_state[state.gla.rtn_state]
+  else
+    return state.gla.rtn_state.rtn.skip_terms or Set:new()
+  end
+end
+
 function Grammar:generate_intfas()
   --print_verbose("Generating lexer DFAs...")
   -- first generate the set of states that need an IntFA: some RTN
@@ -447,7 +744,9 @@ function Grammar:generate_intfas()
   -- All states in the "states" set are nonfinal and have only
   -- terminals as transitions.  Create a list of:
   --   {state, set of outgoing terms}
-  -- pairs for the states.
+  -- pairs for the states, with the set of terms the lexer should skip in
+  -- that state (from @allow) as a third element.
+  local skip_terms_by_state = self.skip_terms_by_state
   local state_term_pairs = {}
   for state in each(states) do
     local terms = Set:new()
@@ -460,7 +759,15 @@ function Grammar:generate_intfas()
       end
     end
     assert(terms:count() > 0)
-    table.insert(state_term_pairs, {state, terms})
+
+    -- A terminal the state explicitly expects is not skipped.
+    local skip_terms = Set:new()
+    for term in each(self:get_skip_terminals_for_state(state, skip_terms_by_state)) do
+      if not terms:contains(term) then
+        skip_terms:add(term)
+      end
+    end
+    table.insert(state_term_pairs, {state, terms, skip_terms})
   end
 
   self.master_intfas = intfa_combine(self.terminals, state_term_pairs)
@@ -490,6 +797,13 @@ function Grammar:get_strings()
     strings:add(term)
   end
 
+  -- add the text of keywords, which the runtime compares against identifiers
+  for intfa in each(self.master_intfas or {}) do
+    for keyword in each(intfa.keywords or {}) do
+      strings:add(keyword[2])
+    end
+  end
+
   -- add the names of the rtns, and of named edges with the rtns.
   for name, rtn in each(grammar.rtns) do
     strings:add(name)
@@ -614,6 +928,7 @@ function copy_attributes(rtn, new_rtn)
   new_rtn.name = rtn.name
   new_rtn.slot_count = rtn.slot_count
   new_rtn.text = rtn.text
+  new_rtn.skip_terms = rtn.skip_terms
   for state in each(new_rtn:states()) do
     state.rtn = new_rtn
   end
@@ -11,17 +11,30 @@
   as possible -- only when two terminals conflict is it necessary to
   use different DFAs.
 
+  Terminals that @allow lets appear anywhere in a state (like whitespace)
+  are built into its DFA too, but marked as terminals to skip: the runtime
+  discards them as soon as they are lexed.
+
+  A literal terminal that is also matched by a regex terminal (like the
+  keyword "if" and an identifier /[a-z]+/) is a keyword.  A keyword is
+  not built into the DFA at all when its identifier is in the same DFA:
+  instead the DFA gets a perfect hash table of its keywords, which the
+  runtime checks once for each identifier it lexes.  This keeps DFAs
+  for keyword-heavy languages small.
+
   Copyright (c) 2007 Joshua Haberman.  See LICENSE for details.
 
 --------------------------------------------------------------------]]--
 
 -- Determine what terminals (if any) conflict with each other.
 -- In this context, "conflict" means that a string of characters can
--- be interpreted as one or more terminals.
+-- be interpreted as one or more terminals.  Also returns the keywords:
+-- a table of literal terminal -> Set of the regex terminals that match it.
 function analyze_conflicts(terminals)
   -- We detect conflicts by combining all the NFAs into a single DFA.
   -- We then observe what states are final to more than one terminal.
   local conflicts = {}
+  local keywords = {}
   local nfas = {}
   for name, terminal in pairs(terminals) do
     if type(terminal) == "string" then
@@ -39,19 +52,38 @@ function analyze_conflicts(terminals)
             conflicts[term1] = conflicts[term1] or Set:new()
             conflicts[term1]:add(term2)
           end
+          if type(terminals[term1]) == "string" and
+             type(terminals[term2]) ~= "string" then
+            keywords[term1] = keywords[term1] or Set:new()
+            keywords[term1]:add(term2)
+          end
         end
       end
     end
   end
 
-  return conflicts
+  return conflicts, keywords
+end
+
+-- A keyword and its identifier can share a DFA, but only if every state
+-- that uses the DFA expects both of them.  Otherwise a state that only
+-- expects the identifier would see the keyword where it didn't expect it.
+function is_keyword_pair(keywords, term1, term2, term_set1, term_set2)
+  local keyword, identifier = term1, term2
+  if not keywords[keyword] then
+    keyword, identifier = term2, term1
+  end
+  return keywords[keyword] and keywords[keyword]:contains(identifier) and
+         term_set1:contains(keyword) and term_set1:contains(identifier) and
+         term_set2:contains(keyword) and term_set2:contains(identifier)
 end
 
-function has_conflicts(conflicts, term_set1, term_set2)
+function has_conflicts(conflicts, term_set1, term_set2, keywords)
   for term1 in each(term_set1) do
     if conflicts[term1] then
       for conflict in each(conflicts[term1]) do
-        if term_set2:contains(conflict) then
+        if term_set2:contains(conflict) and
+           not is_keyword_pair(keywords, term1, conflict, term_set1, term_set2) then
           return true, term1, conflict
         end
       end
@@ -59,9 +91,17 @@ function has_conflicts(conflicts, term_set1, term_set2)
   end
 end
 
-function create_or_reuse_termset_for(terminals, conflicts, termsets, nonterm)
-  if has_conflicts(conflicts, terminals, terminals) then
-    local has_conflict, c1, c2 = has_conflicts(conflicts, terminals, terminals)
+-- The terminals to skip (from @allow) are lexed along with the others, but a
+-- termset can only be shared by states that skip the same terminals:
+-- termset_skip_terms[i] is what termsets[i] skips.
+function create_or_reuse_termset_for(terminals, skip_terminals, conflicts, keywords,
+                                     termsets, termset_skip_terms, nonterm)
+  terminals = terminals:dup()
+  terminals:add_collection(skip_terminals)
+  local skip_key = skip_terminals:hash_key()
+
+  if has_conflicts(conflicts, terminals, terminals, keywords) then
+    local has_conflict, c1, c2 = has_conflicts(conflicts, terminals, terminals, keywords)
     error(string.format("Can't build DFA inside %s, because terminals %s and %s conflict",
                         nonterm, c1, c2))
   end
@@ -71,7 +111,8 @@ function create_or_reuse_termset_for(terminals, conflicts, termsets, nonterm)
     -- will this termset do?  it will if none of our terminals conflict with any of the
     -- existing terminals in this set.
     -- (we can probably compute this faster by pre-computing equivalence classes)
-    if not has_conflicts(conflicts, termset, terminals) then
+    if termset_skip_terms[i]:hash_key() == skip_key and
+       not has_conflicts(conflicts, termset, terminals, keywords) then
       found_termset = i
       break
     end
@@ -80,6 +121,7 @@ function create_or_reuse_termset_for(terminals, conflicts, termsets, nonterm)
   if found_termset == false then
     local new_termset = Set:new()
     table.insert(termsets, new_termset)
+    table.insert(termset_skip_terms, skip_terminals)
     found_termset = #termsets
   end
 
@@ -93,15 +135,72 @@ function create_or_reuse_termset_for(terminals, conflicts, termsets, nonterm)
   return found_termset
 end
 
+-- The hash function for keyword tables, which the runtime computes too:
+--   h = (h * multiplier + byte) mod 2^32
+-- The multiplier is kept below 2^20 so that this is exact in a Lua number.
+function keyword_hash(str, multiplier)
+  local h = 0
+  for i=1,str:len() do
+    h = (h * multiplier + str:byte(i)) % 4294967296
+  end
+  return h
+end
+
+-- Finds a table size and multiplier for which keyword_hash() puts each of
+-- the given strings in its own slot, preferring small tables.  Returns the
+-- multiplier, the size, and a table of string -> slot (0-based).
+function perfect_hash(strs)
+  local size = math.max(#strs, 1)
+  while size <= 64 * math.max(#strs, 1) do
+    for multiplier=3,2047,2 do
+      local slots = {}
+      local used = {}
+      for str in each(strs) do
+        local slot = keyword_hash(str, multiplier) % size
+        if used[slot] then
+          slots = nil
+          break
+        end
+        used[slot] = true
+        slots[str] = slot
+      end
+      if slots then
+        return multiplier, size, slots
+      end
+    end
+    size = size + 1
+  end
+  error("Couldn't find a perfect hash function for keywords: " .. table.concat(strs, " "))
+end
+
+-- Removes the keywords from a termset whose identifier is also in the
+-- termset, and returns them as a list of {keyword, identifier} pairs.
+function split_keywords(termset, all_terminals, keywords)
+  local keyword_list = {}
+  for term in each(termset) do
+    if keywords[term] then
+      for identifier in each(keywords[term]) do
+        if termset:contains(identifier) then
+          table.insert(keyword_list, {term, identifier})
+        end
+      end
+    end
+  end
+  -- sort for deterministic output
+  table.sort(keyword_list, function (a, b) return a[1] < b[1] end)
+  return keyword_list
+end
+
 function intfa_combine(all_terminals, state_term_pairs)
-  local conflicts = analyze_conflicts(all_terminals)
+  local conflicts, keywords = analyze_conflicts(all_terminals)
 
   -- For each state in the grammar, create (or reuse) a DFA to run
   -- when we hit that state.
   local termsets = {}
+  local termset_skip_terms = {}
   local intfa_nums = {}
   for state_term_pair in each(state_term_pairs) do
-    local state, terms = unpack(state_term_pair)
+    local state, terms, skip_terms = unpack(state_term_pair)
     assert(terms:count() > 0)
     local nonterm
     if state.rtn == nil then
@@ -109,11 +208,19 @@ function intfa_combine(all_terminals, state_term_pairs)
     else
       nonterm = state.rtn.name
     end
-    intfa_nums[state] = create_or_reuse_termset_for(terms, conflicts, termsets, nonterm)
+    intfa_nums[state] = create_or_reuse_termset_for(terms, skip_terms or Set:new(),
+                                                    conflicts, keywords, termsets,
+                                                    termset_skip_terms, nonterm)
   end
 
   local dfas = OrderedSet:new()
-  for termset in each(termsets) do
+  for i, termset in ipairs(termsets) do
+    local keyword_list = split_keywords(termset, all_terminals, keywords)
+    local is_keyword = {}
+    for keyword in each(keyword_list) do
+      is_keyword[keyword[1]] = true
+    end
+
     local nfas = {}
     for term in each(termset) do
       local target = all_terminals[term]
@@ -121,10 +228,28 @@ function intfa_combine(all_terminals, state_term_pairs)
       if type(target) == "string" then
         target = fa.intfa_for_string(target)
       end
-      table.insert(nfas, {target, term})
+      if not is_keyword[term] then
+        table.insert(nfas, {target, term})
+      end
     end
     local dfa = hopcroft_minimize(nfas_to_dfa(nfas))
     dfa.termset = termset
+    dfa.skip_terms = termset_skip_terms[i]
+
+    -- Each keyword is {name, text, identifier name, slot}.
+    if #keyword_list > 0 then
+      local texts = {}
+      for keyword in each(keyword_list) do
+        table.insert(texts, all_terminals[keyword[1]])
+      end
+      local multiplier, size, slots = perfect_hash(texts)
+      dfa.keywords = {multiplier=multiplier, size=size}
+      for keyword in each(keyword_list) do
+        local name, identifier = unpack(keyword)
+        local text = all_terminals[name]
+        table.insert(dfa.keywords, {name, text, identifier, slots[text]})
+      end
+    end
     dfas:add(dfa)
   end
 
@@ -154,4 +154,149 @@ function kleene(nfa, favor_repeat)
   return new_nfa
 end
 
+
+--[[--------------------------------------------------------------------
+
+  char_class(int_set): Returns an NFA that matches one character from the
+  given set.
+
+  The lexer works on bytes, not characters.  A set that only mentions
+  characters below 0x80 matches single bytes, as it always has, so "." and
+  negated classes like [^"] match any byte (and therefore any sequence of
+  UTF-8 bytes).  A set that mentions any code point at or above 0x80 is a
+  set of Unicode code points, and matches the UTF-8 encoding of exactly
+  those code points.  Each range of code points becomes an alternation of
+  byte-range sequences, eg. [\x{391}-\x{3C9}] becomes:
+
+     [CE]     [91-BF]
+  o ------ o --------,
+  |                  v
+  |  [CF]     [80-89]
+  o ------ o ------> *
+
+  This lets the runtime lex UTF-8 input with no decoding step.
+
+--------------------------------------------------------------------]]--
+
+MAX_CODE_POINT = 0x10FFFF
+
+function char_class(int_set)
+  local is_unicode = false
+  for range in each(int_set.list) do
+    if range.high >= 0x80 and range.high ~= math.huge then
+      is_unicode = true
+    end
+  end
+
+  if not is_unicode then
+    return fa.IntFA:new{symbol=int_set}
+  end
+
+  local nfas = {}
+  for range in int_set:each_range() do
+    local high = math.min(range.high, MAX_CODE_POINT)
+    if range.low <= high then
+      for sequence in each(utf8_byte_ranges(range.low, high)) do
+        local nfa
+        for byte_range in each(sequence) do
+          local byte_set = IntSet:new()
+          byte_set:add(byte_range)
+          local byte_nfa = fa.IntFA:new{symbol=byte_set}
+          if nfa then
+            nfa = concat(nfa, byte_nfa)
+          else
+            nfa = byte_nfa
+          end
+        end
+        table.insert(nfas, nfa)
+      end
+    end
+  end
+
+  if #nfas == 0 then
+    return fa.IntFA:new{symbol=IntSet:new()}
+  end
+  return alt(nfas)
+end
+
+-- utf8_encode(code_point): returns the list of bytes that encode the
+-- given code point in UTF-8.
+function utf8_encode(code_point)
+  local floor = math.floor
+  if code_point < 0x80 then
+    return {code_point}
+  elseif code_point < 0x800 then
+    return {0xC0 + floor(code_point / 0x40),
+            0x80 + code_point % 0x40}
+  elseif code_point < 0x10000 then
+    return {0xE0 + floor(code_point / 0x1000),
+            0x80 + floor(code_point / 0x40) % 0x40,
+            0x80 + code_point % 0x40}
+  else
+    return {0xF0 + floor(code_point / 0x40000),
+            0x80 + floor(code_point / 0x1000) % 0x40,
+            0x80 + floor(code_point / 0x40) % 0x40,
+            0x80 + code_point % 0x40}
+  end
+end
+
+-- utf8_byte_ranges(low, high): returns a list of byte-range sequences that
+-- together match the UTF-8 encodings of exactly the code points from low to
+-- high (inclusive), skipping the surrogates, which UTF-8 cannot encode.
+-- Each sequence is a list of Ranges, one per byte.  This is the same
+-- splitting that RE2 and Rust's utf8-ranges use: split the range until
+-- every piece has a single encoded length and every byte after the first
+-- that varies covers its whole continuation range.
+function utf8_byte_ranges(low, high, sequences)
+  sequences = sequences or {}
+  if low > high then
+    return sequences
+  end
+
+  if low <= 0xDFFF and high >= 0xD800 then
+    utf8_byte_ranges(low, 0xD7FF, sequences)
+    utf8_byte_ranges(0xE000, high, sequences)
+    return sequences
+  end
+
+  for max_for_length in each({0x7F, 0x7FF, 0xFFFF}) do
+    if low <= max_for_length and high > max_for_length then
+      utf8_byte_ranges(low, max_for_length, sequences)
+      utf8_byte_ranges(max_for_length + 1, high, sequences)
+      return sequences
+    end
+  end
+
+  if high < 0x80 then
+    table.insert(sequences, {Range:new(low, high)})
+    return sequences
+  end
+
+  for i=1,3 do
+    local block = 2 ^ (6 * i)
+    if math.floor(low / block) ~= math.floor(high / block) then
+      if low % block ~= 0 then
+        local boundary = (math.floor(low / block) + 1) * block
+        utf8_byte_ranges(low, boundary - 1, sequences)
+        utf8_byte_ranges(boundary, high, sequences)
+        return sequences
+      elseif high % block ~= block - 1 then
+        local boundary = math.floor(high / block) * block
+        utf8_byte_ranges(low, boundary - 1, sequences)
+        utf8_byte_ranges(boundary, high, sequences)
+        return sequences
+      end
+    end
+  end
+
+  local low_bytes = utf8_encode(low)
+  local high_bytes = utf8_encode(high)
+  local sequence = {}
+  for i=1,#low_bytes do
+    table.insert(sequence, Range:new(low_bytes[i], high_bytes[i]))
+  end
+  table.insert(sequences, sequence)
+  return sequences
+end
+
 -- vim:et:sts=2:sw=2
@@ -32,8 +32,7 @@ bool Grammar::loadFile(const char *path) {
 
 
 bool Grammar::loadData(const void *data, size_t len) {
-  // Note: bc_rs_open_mem does not (yet) support length
-  bc_read_stream *stream = bc_rs_open_mem((const char*)data);
+  bc_read_stream *stream = bc_rs_open_mem_len((const char*)data, len);
   if (!stream)
     return false;
   return loadBitCodeStream(stream, true);
@@ -46,7 +45,5 @@ bool Grammar::loadBitCodeStream(bc_read_stream *stream, bool closeStream) {
   grammar_ = gzl_load_grammar(stream);
   if (closeStream)
     bc_rs_close_stream(stream);
-  // Note: the current implementation of gzl_load_grammar either succeeds or
-  // calls exit() with a value of 1. Ugly but true.
   return !!grammar_;
 }
@@ -0,0 +1,165 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  alloc.c
+
+  The arena allocator declared in alloc.h.  (The rest of the allocator
+  interface is inline functions in the header.)
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "gazelle/alloc.h"
+
+/* Every allocation is rounded up to this, which is enough alignment for any
+ * type on the machines we run on. */
+#define ARENA_ALIGN 16
+#define ROUND_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* The header of a block that a heap arena got from malloc(); its space
+ * starts BLOCK_HEADER_SIZE bytes in. */
+struct gzl_arena_block
+{
+    struct gzl_arena_block *next;
+    size_t size;
+};
+#define BLOCK_HEADER_SIZE ROUND_UP(sizeof(struct gzl_arena_block))
+
+static
+bool new_arena_block(struct gzl_arena *a, size_t size)
+{
+    if(a->fixed)
+        return false;
+    size_t block_size = BLOCK_HEADER_SIZE + size;
+    if(block_size < a->block_size)
+        block_size = a->block_size;
+    struct gzl_arena_block *block = malloc(block_size);
+    if(!block)
+        return false;
+    block->next = a->blocks;
+    block->size = block_size;
+    a->blocks = block;
+    a->start = a->ptr = (char*)block + BLOCK_HEADER_SIZE;
+    a->end = (char*)block + block_size;
+    a->last = NULL;
+    return true;
+}
+
+static
+void *arena_alloc(void *ctx, size_t size)
+{
+    struct gzl_arena *a = ctx;
+    size = ROUND_UP(size ? size : 1);
+    if(size > (size_t)(a->end - a->ptr) && !new_arena_block(a, size))
+        return NULL;
+    a->last = a->ptr;
+    a->ptr += size;
+    return a->last;
+}
+
+static
+void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    struct gzl_arena *a = ctx;
+    if(!ptr)
+        return arena_alloc(ctx, new_size);
+
+    /* The last allocation can grow or shrink where it is, if there is room. */
+    size_t size = ROUND_UP(new_size ? new_size : 1);
+    if(ptr == a->last && size <= (size_t)(a->end - a->last)) {
+        a->ptr = a->last + size;
+        return ptr;
+    }
+    if(new_size <= old_size)
+        return ptr;
+
+    void *new_ptr = arena_alloc(ctx, new_size);
+    if(new_ptr)
+        memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+static
+void arena_free(void *ctx, void *ptr)
+{
+    struct gzl_arena *a = ctx;
+    if(ptr && ptr == a->last) {
+        a->ptr = a->last;
+        a->last = NULL;
+    }
+}
+
+static
+void init_arena(struct gzl_arena *a)
+{
+    a->allocator.alloc = arena_alloc;
+    a->allocator.realloc = arena_realloc;
+    a->allocator.free = arena_free;
+    a->allocator.ctx = a;
+    a->last = NULL;
+    a->blocks = NULL;
+}
+
+void gzl_init_arena(struct gzl_arena *a, size_t block_size)
+{
+    init_arena(a);
+    a->start = a->ptr = a->end = NULL;
+    a->block_size = block_size;
+    a->fixed = false;
+}
+
+void gzl_init_fixed_arena(struct gzl_arena *a, void *mem, size_t size)
+{
+    init_arena(a);
+    /* Start at the first aligned byte of mem. */
+    char *aligned = (char*)ROUND_UP((uintptr_t)mem);
+    a->start = a->ptr = aligned;
+    a->end = (size_t)(aligned - (char*)mem) < size ? (char*)mem + size : aligned;
+    a->block_size = 0;
+    a->fixed = true;
+}
+
+void gzl_reset_arena(struct gzl_arena *a)
+{
+    /* Keep the newest block, which is the one we are allocating from. */
+    if(a->blocks) {
+        struct gzl_arena_block *block = a->blocks->next;
+        while(block) {
+            struct gzl_arena_block *next = block->next;
+            free(block);
+            block = next;
+        }
+        a->blocks->next = NULL;
+    }
+    a->ptr = a->start;
+    a->last = NULL;
+}
+
+void gzl_free_arena(struct gzl_arena *a)
+{
+    if(a->fixed) {
+        gzl_reset_arena(a);
+        return;
+    }
+    while(a->blocks) {
+        struct gzl_arena_block *next = a->blocks->next;
+        free(a->blocks);
+        a->blocks = next;
+    }
+    a->start = a->ptr = a->end = NULL;
+    a->last = NULL;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
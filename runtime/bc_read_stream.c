@@ -93,6 +93,7 @@ struct bc_read_stream
     /* Values for the stream */
     FILE *infile;
     unsigned char *inmem;
+    size_t inmem_len;
     uint32_t next_bits;
     int num_next_bits;
     int stream_err;
@@ -194,9 +195,15 @@ static int refill_next_bits(struct bc_read_stream *stream);
 struct bc_read_stream *bc_read_stream_init();
 
 struct bc_read_stream *bc_rs_open_mem(const char *data)
+{
+    return bc_rs_open_mem_len(data, SIZE_MAX);
+}
+
+struct bc_read_stream *bc_rs_open_mem_len(const char *data, size_t len)
 {
     struct bc_read_stream *stream = bc_read_stream_init();
     stream->inmem = (unsigned char *)data;
+    stream->inmem_len = len;
     refill_next_bits(stream);
     return stream;
 }
@@ -358,6 +365,9 @@ static int refill_next_bits(struct bc_read_stream *stream)
     }
     else
     {
+        /* Running off the end is EOF, as it is for a file. */
+        if((size_t)stream->stream_offset + 4 > stream->inmem_len)
+            return -1;
         memcpy(buf, stream->inmem + stream->stream_offset, 4);
     }
 
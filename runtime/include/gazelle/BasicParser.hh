@@ -0,0 +1,286 @@
+#ifndef GAZELLE_CXX_BASIC_PARSER_H_
+#define GAZELLE_CXX_BASIC_PARSER_H_
+
+#include <gazelle/parse.h>
+#include <gazelle/Grammar.hh>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+namespace gazelle {
+
+// True if Handler defines the hook itself (see hookOf below)
+#define GZL_BASIC_PARSER_HANDLES(hook) \
+    (sizeof(hookOf(&Handler::hook)) != sizeof(char))
+
+/**
+ * A stateful Gazelle parser whose events go straight to |Handler|, which
+ * derives from BasicParser<Handler> and defines (as public, non-virtual
+ * methods) whichever of the event hooks below it wants.
+ *
+ * Each hook is called from a small static function that the compiler can
+ * inline it into, with no virtual call in between.  A hook that Handler
+ * does not define is not bound at all: the runtime sees no callback for
+ * that event and skips it.
+ *
+ * Example:
+ *
+ *    class Counter : public gazelle::BasicParser<Counter> {
+ *     public:
+ *      Counter() : terminals(0) {}
+ *      void onTerminal(gzl_terminal *terminal) { terminals++; }
+ *      int terminals;
+ *    };
+ *
+ *    Counter parser;
+ *    gazelle::Grammar grammar;
+ *    if (!grammar.loadFile("./json.gzc"))
+ *      exit(1);
+ *    parser.setGrammar(&grammar);
+ *    gzl_status status = parser.parse("the text to parse", 0, true);
+ *
+ * gazelle::Parser is a BasicParser whose hooks are virtual methods, for
+ * handlers that are chosen at run time.
+ */
+template <class Handler>
+class BasicParser {
+ public:
+  // Set the grammar which should be used for the next call to parse
+  void setGrammar(Grammar *grammar) {
+    grammar_ = grammar;
+    if (state_)
+      gzl_free_parse_state(state_);
+    state_ = gzl_alloc_parse_state();
+    assert(state_ != NULL);
+    state_->user_data = (void*)this;
+    // subscriptions are to the old grammar's rules and terminals
+    gzl_clear_subscriptions(&boundGrammar_);
+    // setup bound grammar, leaving out the events Handler does not handle
+    boundGrammar_.grammar = grammar ? grammar->grammar() : NULL;
+    boundGrammar_.terminal_cb =
+        GZL_BASIC_PARSER_HANDLES(onTerminal) ? terminalCallback : NULL;
+    boundGrammar_.will_start_rule_cb =
+        GZL_BASIC_PARSER_HANDLES(onWillStartRule) ?
+            willStartRuleCallback : NULL;
+    boundGrammar_.did_start_rule_cb =
+        GZL_BASIC_PARSER_HANDLES(onDidStartRule) ? didStartRuleCallback : NULL;
+    boundGrammar_.will_end_rule_cb =
+        GZL_BASIC_PARSER_HANDLES(onWillEndRule) ? willEndRuleCallback : NULL;
+    boundGrammar_.did_end_rule_cb =
+        GZL_BASIC_PARSER_HANDLES(onDidEndRule) ? didEndRuleCallback : NULL;
+    boundGrammar_.error_char_cb =
+        GZL_BASIC_PARSER_HANDLES(onUnknownTransitionError) ?
+            unknownTransitionCallback : NULL;
+    boundGrammar_.error_terminal_cb =
+        GZL_BASIC_PARSER_HANDLES(onUnexpectedTerminalError) ?
+            unexpectedTerminalCallback : NULL;
+    boundGrammar_.jit = NULL;
+    gzl_init_parse_state(state_, &boundGrammar_);
+  }
+  Grammar *grammar() { return grammar_; }
+
+  // Only report the rules (or terminals) that are subscribed to, once any
+  // are (see gzl_subscribe_rule() in parse.h).  Returns false if the grammar
+  // has no such rule (or terminal).
+  bool subscribeRule(const char *name) {
+    return boundGrammar_.grammar &&
+           gzl_subscribe_rule(&boundGrammar_, name);
+  }
+  bool subscribeTerminal(const char *name) {
+    return boundGrammar_.grammar &&
+           gzl_subscribe_terminal(&boundGrammar_, name);
+  }
+
+  // A structure which contains the current state (see parse.h for details)
+  inline gzl_parse_state *state() { return state_; }
+  inline void setState(gzl_parse_state *state) {
+    if (state_) gzl_free_parse_state(state_);
+    state_ = state;
+  }
+  inline gzl_parse_state *swapState(gzl_parse_state *state) {
+    gzl_parse_state *prevState = state_;
+    state_ = state;
+    return prevState;
+  }
+
+  // Parse a chunk of text, which continues where the previous chunk left off.
+  // If |finalize| is true, finalizeParsing is called after successfully parsing
+  // |source| (a convenience feature).
+  gzl_status parse(const char *source, size_t len=0, bool finalize=false) {
+    if (!boundGrammar_.grammar)
+      return GZL_STATUS_BAD_GRAMMAR;
+    if (len == 0)
+      len = strlen(source);
+    gzl_status status = gzl_parse(state_, source, len);
+    if (finalize && (status == GZL_STATUS_HARD_EOF || status == GZL_STATUS_OK)) {
+      if (!finalizeParsing())
+        status = GZL_STATUS_PREMATURE_EOF_ERROR;
+    }
+    return status;
+  }
+
+  // Complete the parsing. This primarily involves calling all the final
+  // callbacks. Returns false if the parse state does not allow EOF here.
+  bool finalizeParsing() {
+    return gzl_finish_parse(state_);
+  }
+
+  // Start over on a new document with the same grammar, keeping the memory
+  // the parse state has grown into (see gzl_reset_parse_state() in parse.h)
+  void reset() {
+    if (state_)
+      gzl_reset_parse_state(state_);
+  }
+
+  // Convenience method to parse the complete |file|, a chunk at a time, and
+  // then finalize the parse as parse() does.  The parse state keeps what it
+  // needs of a terminal that spans chunks, so one buffer does for them all.
+  gzl_status parseFile(FILE *file) {
+    if (!boundGrammar_.grammar)
+      return GZL_STATUS_BAD_GRAMMAR;
+    char buf[4096];
+    gzl_status status;
+    do {
+      size_t len = fread(buf, 1, sizeof(buf), file);
+      if (ferror(file))
+        return GZL_STATUS_IO_ERROR;
+      status = gzl_parse(state_, buf, len);
+    } while (status == GZL_STATUS_OK && !feof(file));
+    if (status == GZL_STATUS_HARD_EOF || status == GZL_STATUS_OK) {
+      if (!finalizeParsing())
+        status = GZL_STATUS_PREMATURE_EOF_ERROR;
+    }
+    return status;
+  }
+
+  // Retrieve a stack frame |offset| levels down
+  inline gzl_parse_stack_frame *stackFrameAt(int offset) {
+    int depth = stackDepth();
+    if (offset < 0 || offset >= depth)
+      return NULL;
+    return gzl_stack_frame_at(state_, (depth - 1) - offset);
+  }
+
+  // The offset at which the RTN frame |offset| levels down started
+  inline gzl_offset *stackFrameStartOffsetAt(int offset) {
+    int depth = stackDepth();
+    if (offset < 0 || offset >= depth)
+      return NULL;
+    return gzl_stack_frame_start_offset_at(state_, (depth - 1) - offset);
+  }
+
+  // The top ("latest") frame in the stack
+  inline gzl_parse_stack_frame *currentStackFrame() {
+    return stackFrameAt(0);
+  }
+
+  // Current stack depth
+  inline int stackDepth() { return gzl_stack_depth(state_); }
+
+  // Current source line number (starts at 1)
+  inline size_t line() { return state_->offset.line; }
+  // Current source column number (starts at 1)
+  inline size_t column() { return state_->offset.column; }
+  // Current source byte offset
+  inline size_t offset() { return state_->offset.byte; }
+
+  // ---- parser events ----
+  // Handler hides these with its own methods for the events it wants.  The
+  // ones it leaves alone are never called.
+
+  // Invoked when a rule starts
+  void onWillStartRule(gzl_rtn *rtn, const char *name, gzl_offset *offset) {}
+  void onDidStartRule(gzl_rtn_frame *frame, const char *name) {}
+
+  void onWillEndRule(gzl_rtn_frame *frame, const char *name) {}
+  void onDidEndRule(gzl_rtn_frame *frame, const char *name) {}
+
+  void onTerminal(gzl_terminal *terminal) {}
+
+  void onUnknownTransitionError(int ch) {}
+
+  void onUnexpectedTerminalError(gzl_terminal *terminal) {}
+
+ protected:
+  // Creates a new parser optionally bound to a grammar
+  BasicParser(Grammar *grammar=NULL) : state_(NULL) {
+    memset(&boundGrammar_, 0, sizeof(boundGrammar_));
+    setGrammar(grammar);
+  }
+
+  ~BasicParser() {
+    if (state_)
+      gzl_free_parse_state(state_);
+    gzl_clear_subscriptions(&boundGrammar_);
+  }
+
+  // Grammar and callbacks struct needed for the Gazelle API
+  gzl_bound_grammar boundGrammar_;
+
+  // The Gazelle parse state
+  gzl_parse_state *state_;
+
+  Grammar *grammar_;  // weak
+
+ private:
+  // The parse state points back at this object.
+  BasicParser(const BasicParser&);
+  BasicParser& operator=(const BasicParser&);
+
+  // A hook that Handler does not define is one of ours, so taking its
+  // address yields a pointer to a member of BasicParser.
+  template <class F> static char hookOf(F BasicParser::*);
+  static long hookOf(...);
+
+  static inline Handler *handler(gzl_parse_state *state) {
+    return static_cast<Handler*>((BasicParser*)state->user_data);
+  }
+
+  static inline gzl_rtn_frame *topRtnFrame(gzl_parse_state *state) {
+    gzl_parse_stack_frame *frame = GZL_STACK_TOP(state);
+    assert(frame->frame_type == gzl_parse_stack_frame::GZL_FRAME_TYPE_RTN);
+    return &frame->f.rtn_frame;
+  }
+
+  static void willStartRuleCallback(gzl_parse_state *state, gzl_rtn *rtn,
+                                    gzl_offset *start_offset) {
+    handler(state)->onWillStartRule(rtn, rtn->name, start_offset);
+  }
+
+  static void didStartRuleCallback(gzl_parse_state *state) {
+    gzl_rtn_frame *rtn_frame = topRtnFrame(state);
+    handler(state)->onDidStartRule(rtn_frame, rtn_frame->rtn->name);
+  }
+
+  static void willEndRuleCallback(gzl_parse_state *state) {
+    gzl_rtn_frame *rtn_frame = topRtnFrame(state);
+    handler(state)->onWillEndRule(rtn_frame, rtn_frame->rtn->name);
+  }
+
+  static void didEndRuleCallback(gzl_parse_state *state,
+                                 gzl_parse_stack_frame *frame) {
+    assert(frame->frame_type == gzl_parse_stack_frame::GZL_FRAME_TYPE_RTN);
+    gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
+    handler(state)->onDidEndRule(rtn_frame, rtn_frame->rtn->name);
+  }
+
+  static void terminalCallback(gzl_parse_state *state,
+                               gzl_terminal *terminal) {
+    handler(state)->onTerminal(terminal);
+  }
+
+  static void unknownTransitionCallback(gzl_parse_state *state, int ch) {
+    handler(state)->onUnknownTransitionError(ch);
+  }
+
+  static void unexpectedTerminalCallback(gzl_parse_state *state,
+                                         gzl_terminal *terminal) {
+    handler(state)->onUnexpectedTerminalError(terminal);
+  }
+};
+
+#undef GZL_BASIC_PARSER_HANDLES
+
+}  // namespace gazelle
+#endif  // GAZELLE_CXX_BASIC_PARSER_H_
@@ -0,0 +1,122 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  alloc.h
+
+  The interface through which the runtime allocates memory, so that
+  clients can give it something other than malloc(), and an arena
+  allocator that implements it.
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+#ifndef GAZELLE_ALLOC
+#define GAZELLE_ALLOC
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An allocator for the grammar loader (gzl_load_grammar_with()), parse states
+ * (gzl_alloc_parse_state_with()) and the buffering layer in gzl_parse_file(),
+ * which get all of their memory from it and give it back when they are
+ * freed.  The one exception is the loader's scratch space, which comes from
+ * malloc() and is freed again before gzl_load_grammar_with() returns.
+ * Wherever the runtime takes a struct gzl_allocator*, NULL means malloc(),
+ * realloc() and free().
+ *
+ * All three functions are passed ctx.  alloc() and realloc() return NULL if
+ * there is no memory, in which case realloc() leaves ptr as it was; the
+ * memory they return is aligned for any type.  realloc() is also told how
+ * big ptr was, which is 0 when ptr is NULL. */
+struct gzl_allocator
+{
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+};
+
+static inline void *gzl_alloc(struct gzl_allocator *a, size_t size)
+{
+    return a ? a->alloc(a->ctx, size) : malloc(size);
+}
+
+static inline void *gzl_realloc(struct gzl_allocator *a, void *ptr,
+                                size_t old_size, size_t new_size)
+{
+    return a ? a->realloc(a->ctx, ptr, old_size, new_size) :
+               realloc(ptr, new_size);
+}
+
+static inline void gzl_free(struct gzl_allocator *a, void *ptr)
+{
+    if(a)
+        a->free(a->ctx, ptr);
+    else
+        free(ptr);
+}
+
+/* A bump allocator, for clients that create and throw away many short-lived
+ * parse states (one per request, say) and would rather not go to malloc()
+ * for each of their allocations.  Give the runtime &arena->allocator.
+ *
+ * Allocating from an arena just advances a pointer.  Freeing does nothing
+ * (except to the most recent allocation, which realloc() can also grow in
+ * place); instead gzl_reset_arena() frees everything allocated from the
+ * arena at once, so it must come after whatever was using the arena has
+ * been freed.  An arena is not safe to use from more than one thread at a
+ * time.
+ *
+ * gzl_init_arena() makes an arena that gets its memory from malloc() in
+ * blocks of at least block_size bytes, as it needs them; gzl_reset_arena()
+ * keeps the block it is using, so that an arena which is reset after every
+ * request soon stops calling malloc() at all.  gzl_init_fixed_arena() makes
+ * an arena out of the size bytes at mem, which never touches the heap: once
+ * they are used up, allocations from it fail.  (The parser reports this as
+ * GZL_STATUS_RESOURCE_LIMIT_EXCEEDED, and the loader by returning NULL.)
+ * gzl_free_arena() gives back the blocks of a heap arena; it does not free
+ * a fixed arena's mem. */
+struct gzl_arena_block;
+struct gzl_arena
+{
+    struct gzl_allocator allocator;
+
+    /* The current block's space, the part of it that is free, and the last
+     * allocation (or NULL if it cannot be grown in place). */
+    char *start;
+    char *ptr;
+    char *end;
+    char *last;
+
+    /* For heap arenas, the blocks from malloc() (newest first). */
+    struct gzl_arena_block *blocks;
+    size_t block_size;
+    bool fixed;
+};
+
+void gzl_init_arena(struct gzl_arena *arena, size_t block_size);
+void gzl_init_fixed_arena(struct gzl_arena *arena, void *mem, size_t size);
+void gzl_reset_arena(struct gzl_arena *arena);
+void gzl_free_arena(struct gzl_arena *arena);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* GAZELLE_ALLOC */
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
@@ -15,6 +15,7 @@
 #ifndef BITCODE_READ_STREAM
 #define BITCODE_READ_STREAM
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -31,6 +32,7 @@ struct bc_read_stream;
 
 struct bc_read_stream *bc_rs_open_file(const char *filename);
 struct bc_read_stream *bc_rs_open_mem(const char *data);
+struct bc_read_stream *bc_rs_open_mem_len(const char *data, size_t len);
 void bc_rs_close_stream(struct bc_read_stream *stream);
 
 /**********************************************************
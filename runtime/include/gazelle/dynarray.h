@@ -1,4 +1,6 @@
 
+#include "gazelle/alloc.h"
+
 #ifndef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
@@ -28,6 +30,37 @@
 #define FREE_DYNARRAY(name) \
   free(name);
 
+/* The same for dynarrays whose memory comes from an allocator (see alloc.h),
+ * which may run out: if it does, INIT_DYNARRAY_IN leaves name NULL, and
+ * RESIZE_DYNARRAY_IN leaves the dynarray as it was and sets ok to false. */
+#define INIT_DYNARRAY_IN(alloc, name, initial_len, initial_size) \
+  name ## _len = initial_len; \
+  name ## _size = initial_size; \
+  name = gzl_alloc(alloc, name ## _size * sizeof(*name))
+
+#define RESIZE_DYNARRAY_IN(alloc, name, desired_len, ok) { \
+  int new_size = name ## _size; \
+  while(new_size < (desired_len)) \
+    new_size *= 2; \
+  void *new_ptr = name; \
+  if(new_size != name ## _size) \
+    new_ptr = gzl_realloc(alloc, name, name ## _size * sizeof(*name), \
+                          new_size * sizeof(*name)); \
+  ok = new_ptr != NULL; \
+  if(ok) { \
+    name = new_ptr; \
+    name ## _size = new_size; \
+    name ## _len = desired_len; \
+  } \
+}
+
+#define FREE_DYNARRAY_IN(alloc, name) \
+  gzl_free(alloc, name);
+
+/* Shortens a dynarray of either kind, which never needs memory. */
+#define SHRINK_DYNARRAY(name, desired_len) \
+  name ## _len = desired_len;
+
 #define DYNARRAY_GET_TOP(name) \
   (&name[name ## _len - 1])
 
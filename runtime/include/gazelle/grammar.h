@@ -24,6 +24,22 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gazelle/alloc.h"
+
+/*
+ * Terminals are given small, dense integer IDs when the grammar is loaded,
+ * so that the parser can find the transition for a terminal without
+ * comparing names.  EOF is ID 0; the others count up from 1.
+ */
+
+#define GZL_EOF_TERMINAL_ID 0
+
+/* RTN and GLA states with more terminal transitions than this get a table
+ * indexed by terminal ID; smaller states are quicker to scan. */
+#define GZL_MAX_SCANNED_TRANSITIONS 4
 
 /*
  * RTN
@@ -42,6 +58,9 @@ struct gzl_rtn
 
     int num_transitions;
     struct gzl_rtn_transition *transitions;
+
+    /* Storage for the terminal tables of this RTN's states. */
+    struct gzl_rtn_transition **terminal_tables;
 };
 
 struct gzl_rtn_transition
@@ -55,38 +74,96 @@ struct gzl_rtn_transition
       char            *terminal_name;
       struct gzl_rtn  *nonterminal;
     } edge;
+    int terminal_id;  /* for terminal transitions */
 
     struct gzl_rtn_state *dest_state;
     char *slotname;
     int slotnum;
 };
 
+/* What the parser does in an RTN state.  The loader decodes this from the
+ * rest of the state, so that the parser can go straight to the code for it
+ * instead of working it out again every time it enters the state. */
+enum gzl_rtn_op {
+    GZL_RTN_OP_TERMINAL,  /* take a terminal transition (lexes with an IntFA) */
+    GZL_RTN_OP_LL1,       /* decide on one terminal with ll1_table */
+    GZL_RTN_OP_GLA,       /* push a GLA frame for d.state_gla */
+    GZL_RTN_OP_DESCEND,   /* push frames for the descend_transitions */
+    GZL_RTN_OP_CALL,      /* push a frame for the only (nonterminal) transition */
+    GZL_RTN_OP_RETURN     /* final with no transitions: pop the frame */
+};
+
 struct gzl_rtn_state
 {
     bool is_final;
+    enum gzl_rtn_op op;
 
     enum {
       GZL_STATE_HAS_INTFA,
       GZL_STATE_HAS_GLA,
-      GZL_STATE_HAS_NEITHER
+      GZL_STATE_HAS_NEITHER,
+      GZL_STATE_HAS_LL1_TABLE  /* see ll1_table below */
     } lookahead_type;
 
     union {
-      struct gzl_intfa *state_intfa;
+      struct gzl_intfa *state_intfa;  /* also for GZL_STATE_HAS_LL1_TABLE */
       struct gzl_gla *state_gla;
     } d;
 
     int num_transitions;
     struct gzl_rtn_transition *transitions;
+
+    /* If there are more than GZL_MAX_SCANNED_TRANSITIONS terminal
+     * transitions, the transition for terminal_id is
+     * terminal_table[terminal_id - min_terminal_id], if that is within the
+     * table.  Otherwise terminal_table is NULL. */
+    int min_terminal_id;
+    int terminal_table_size;
+    struct gzl_rtn_transition **terminal_table;
+
+    /* If this state has neither an IntFA nor a GLA but one nonterminal
+     * transition, the nonterminal transitions the parser descends through
+     * from here before it reaches a state that has one (or a final state
+     * with no transitions), in the order they are taken.  Otherwise
+     * num_descend_transitions is 0. */
+    int num_descend_transitions;
+    struct gzl_rtn_transition **descend_transitions;
+
+    /* If this state has neither an IntFA nor a GLA but one nonterminal
+     * transition, the IntFA that lexes the first terminal of the rule it
+     * goes into, or NULL if that rule can be empty.  The parser lexes that
+     * terminal before it descends, so that the rules start where it does
+     * rather than at any whitespace or comments skipped before it. */
+    struct gzl_intfa *descend_intfa;
+
+    /* A GLA whose start state goes straight to final states only ever looks
+     * at one terminal, so the loader replaces it with this table and makes
+     * the state GZL_STATE_HAS_LL1_TABLE; the state lexes with the IntFA of
+     * the GLA's start state.  For terminal_id,
+     * ll1_table[terminal_id - ll1_min_terminal_id] is 0 if the rule returns,
+     * n if the parser takes transitions[n-1], or -1 (as is everything outside
+     * the table) if the terminal is an error. */
+    int ll1_min_terminal_id;
+    int ll1_table_size;
+    int *ll1_table;
 };
 
 /*
  * GLA
  */
 
+struct gzl_gla;
 struct gzl_gla_state;
 struct gzl_gla_transition;
 
+/* A GLA's decisions coded directly as C, which gzlc --emit-c generates.  It
+ * does what find_gla_transition() in parse.c does with the GLA's tables:
+ * returns the transition that nonfinal state takes on terminal term_id, or
+ * NULL if there is none. */
+typedef struct gzl_gla_transition *gzl_gla_func(struct gzl_gla *gla,
+                                                struct gzl_gla_state *state,
+                                                int term_id);
+
 struct gzl_gla
 {
     int num_states;
@@ -94,11 +171,19 @@ struct gzl_gla
 
     int num_transitions;
     struct gzl_gla_transition *transitions;
+
+    /* Storage for the transition tables of this GLA's states. */
+    struct gzl_gla_transition **transition_tables;
+
+    /* If not NULL, the parser runs this instead of the tables above.  The
+     * loader leaves it NULL; code generated by gzlc --emit-c sets it. */
+    gzl_gla_func *decide;
 };
 
 struct gzl_gla_transition
 {
     char *term;  /* if NULL, then the term is EOF */
+    int term_id;
     struct gzl_gla_state *dest_state;
 };
 
@@ -111,6 +196,13 @@ struct gzl_gla_state
             struct gzl_intfa *intfa;
             int num_transitions;
             struct gzl_gla_transition *transitions;
+
+            /* If there are more than GZL_MAX_SCANNED_TRANSITIONS, the
+             * transition for term_id is table[term_id - min_term_id], if
+             * that is within the table.  Otherwise table is NULL. */
+            int min_term_id;
+            int table_size;
+            struct gzl_gla_transition **table;
         } nonfinal;
 
         struct gzl_final_info {
@@ -123,9 +215,19 @@ struct gzl_gla_state
  * IntFA
  */
 
+struct gzl_intfa;
 struct gzl_intfa_state;
 struct gzl_intfa_transition;
 
+/* A lexer for one IntFA coded directly as C control flow, which gzlc
+ * --emit-c generates.  It does what lex_bytes() in parse.c does with the
+ * IntFA's tables: moves *state through buf from byte i for as long as no
+ * terminal is complete, and returns the index of the first byte it did not
+ * consume. */
+typedef size_t gzl_lex_func(struct gzl_intfa *intfa,
+                            struct gzl_intfa_state **state,
+                            const char *buf, size_t i, size_t buf_len);
+
 struct gzl_intfa
 {
     int num_states;
@@ -133,6 +235,40 @@ struct gzl_intfa
 
     int num_transitions;
     struct gzl_intfa_transition *transitions;
+
+    /* Bytes that no state of this IntFA tells apart share an equivalence
+     * class.  Most IntFAs only distinguish a handful of classes (a quote,
+     * digits, "everything else"), which keeps the table below small. */
+    int num_byte_classes;
+    unsigned char byte_class[256];
+
+    /* A dense table of num_states rows, each with num_byte_classes entries,
+     * built at load time from the transition ranges.  This lets the lexer
+     * find the next state with two indexed loads per byte instead of
+     * scanning the ranges.  NULL entries mean there is no transition. */
+    struct gzl_intfa_state **transition_table;
+
+    /* Keywords are literal terminals that one of this IntFA's terminals
+     * (the "identifier") also matches.  The DFA only yields the identifier,
+     * so whenever it does the lexer looks the identifier's text up in this
+     * perfect hash table.  keywords is NULL if there are none; otherwise it
+     * has keyword_table_size slots, and unused slots have a NULL text. */
+    int keyword_table_size;
+    uint32_t keyword_multiplier;
+    struct gzl_intfa_keyword *keywords;
+
+    /* If not NULL, the lexer runs this instead of the tables above.  The
+     * loader leaves it NULL; code generated by gzlc --emit-c sets it. */
+    gzl_lex_func *lex;
+};
+
+struct gzl_intfa_keyword
+{
+    char *text;
+    size_t len;
+    char *terminal;
+    int terminal_id;
+    int identifier_id;
 };
 
 struct gzl_intfa_transition
@@ -142,17 +278,49 @@ struct gzl_intfa_transition
     struct gzl_intfa_state *dest_state;
 };
 
+#define GZL_MAX_RUN_BYTES 4
+
 struct gzl_intfa_state
 {
     char *final;  /* NULL if not final */
+    int final_id;
+
+    /* True if the terminal is one that @allow permits here, which the lexer
+     * discards instead of passing it on to the GLA or RTN. */
+    bool skip;
+
     int num_transitions;
     struct gzl_intfa_transition *transitions;
+
+    /* This state's row of the IntFA's transition_table, indexed by the
+     * byte's class in the IntFA's byte_class map. */
+    struct gzl_intfa_state **next_state;
+
+    /* If this state loops back to itself on all but a few bytes (like the
+     * body of a string) or on only a few bytes (like whitespace), the lexer
+     * can skip a whole run of such bytes at once instead of transitioning
+     * byte by byte.  Computed at load time. */
+    enum {
+      GZL_INTFA_RUN_NONE,
+      GZL_INTFA_RUN_UNTIL_ANY,  /* loops on every byte except run_bytes */
+      GZL_INTFA_RUN_WHILE_ANY   /* loops on run_bytes only */
+    } run_type;
+
+    int num_run_bytes;
+    unsigned char run_bytes[GZL_MAX_RUN_BYTES];
 };
 
+struct gzl_parse_stack_frame;  /* see parse.h */
+
 struct gzl_grammar
 {
     char         **strings;
 
+    /* The name of each terminal, indexed by terminal ID.  The name of EOF
+     * (ID 0) is NULL. */
+    int num_terminals;
+    char **terminal_names;
+
     int num_rtns;
     struct gzl_rtn   *rtns;
 
@@ -161,10 +329,31 @@ struct gzl_grammar
 
     int num_intfas;
     struct gzl_intfa *intfas;
+
+    /* Storage for the descend chains and LL(1) tables of all RTN states. */
+    struct gzl_rtn_transition **descend_transitions;
+    int *ll1_tables;
+
+    /* The frames that every parse starts by pushing, before it needs any
+     * input: the start rule, the rules it descends into, and possibly a GLA
+     * frame on top.  Each RTN frame but the top one has the transition into
+     * the next.  gzl_parse() copies these instead of running the parser to
+     * push them.  num_start_frames is 0 if starting a parse does more than
+     * push frames (when the start rule can be empty). */
+    int num_start_frames;
+    struct gzl_parse_stack_frame *start_frames;
+
+    /* Where all of the above came from (NULL for malloc()). */
+    struct gzl_allocator *alloc;
 };
 
-/* Functions for loading a grammar from a bytecode file. */
+/* Functions for loading a grammar from a bytecode file.  The grammar is
+ * allocated from alloc (see alloc.h), which has to last as long as it does;
+ * gzl_load_grammar() uses malloc().  Both return NULL if the input is
+ * corrupt or memory runs out, having freed whatever they had loaded. */
 struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s);
+struct gzl_grammar *gzl_load_grammar_with(struct bc_read_stream *s,
+                                          struct gzl_allocator *alloc);
 void gzl_free_grammar(struct gzl_grammar *g);
 
 #ifdef __cplusplus
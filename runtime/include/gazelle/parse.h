@@ -39,13 +39,65 @@ struct gzl_offset
     size_t column;  /* 1-based. */
 };
 
+/* A run of consecutive newline bytes, which counts as one logical newline.
+ * These make up the newline index that the parser keeps in lazy_lines mode;
+ * "start" is the byte offset of the first newline byte in the run, and "end"
+ * is the byte offset just past the last one. */
+struct gzl_newline_run
+{
+    size_t start;
+    size_t end;
+};
+
+/* Newline runs that two or more parse states share, like a
+ * gzl_stack_segment: they come after the first below_len runs of the
+ * segments under them.  See gzl_dup_parse_state(). */
+struct gzl_newline_segment
+{
+    int refcount;
+    int len;
+    struct gzl_newline_run *runs;
+    struct gzl_newline_segment *below;
+    int below_len;
+    struct gzl_allocator *alloc;
+};
+
+/* An IntFA state that the lexer has reached at a given byte offset, and
+ * from which it knows no terminal can be matched.  See gzl_parse_state's
+ * munch_memo. */
+struct gzl_munch_memo_entry
+{
+    struct gzl_intfa_state *state;
+    size_t byte;
+};
+
 struct gzl_terminal
 {
     char *name;
+    int id;  /* see GZL_EOF_TERMINAL_ID in grammar.h */
     struct gzl_offset offset;
     size_t len;
 };
 
+/* A record of one parse event, which the parser appends to the client's
+ * event tape instead of calling the rule and terminal callbacks, if it has
+ * been given one (see gzl_set_event_tape()).  Events come in the order the
+ * callbacks would have been called: GZL_EVENT_START_RULE where
+ * did_start_rule_cb would be, GZL_EVENT_END_RULE where will_end_rule_cb
+ * would be, and GZL_EVENT_TERMINAL where terminal_cb would be. */
+struct gzl_event
+{
+    enum gzl_event_kind {
+      GZL_EVENT_START_RULE,
+      GZL_EVENT_END_RULE,
+      GZL_EVENT_TERMINAL
+    } kind;
+    int id;         /* The rule's index in grammar->rtns, or the terminal ID. */
+    size_t offset;  /* The byte offset where the rule or terminal starts. */
+    size_t len;     /* Its length in bytes, which for a rule is up to
+                     * state->offset when it ended (0 at its start). */
+};
+
 struct gzl_parse_val;
 
 struct gzl_slotarray
@@ -81,39 +133,62 @@ struct gzl_gla_frame {
   struct gzl_gla            *gla;
   struct gzl_gla_state      *gla_state;
 };
-struct gzl_intfa_frame {
-  struct gzl_intfa          *intfa;
-  struct gzl_intfa_state    *intfa_state;
-};
 
-/* This structure is the format for every stack frame of the parse stack. */
+/* This structure is the format for every stack frame of the parse stack.
+ * It is kept small (32 bytes on a 64-bit machine) because the parser pushes
+ * and pops frames constantly; the offset at which each frame started is kept
+ * beside the stack instead (see GZL_FRAME_START_OFFSET). */
 struct gzl_parse_stack_frame
 {
     union {
       struct gzl_rtn_frame rtn_frame;
       struct gzl_gla_frame gla_frame;
-      struct gzl_intfa_frame intfa_frame;
     } f;
 
-    struct gzl_offset start_offset;
-
     enum gzl_frame_type {
       GZL_FRAME_TYPE_RTN,
-      GZL_FRAME_TYPE_GLA,
-      GZL_FRAME_TYPE_INTFA
+      GZL_FRAME_TYPE_GLA
     } frame_type;
 };
 
 #define GET_PARSE_STACK_FRAME(ptr) \
     (struct gzl_parse_stack_frame*)((char*)ptr-offsetof(struct gzl_parse_stack_frame,f))
 
+/* The offset at which an RTN frame in state s's private_stack started.  This
+ * is also valid for the frame passed to did_end_rule_cb, which has just been
+ * popped.  GLA frames do not record their start offset.  For frames below
+ * private_stack (see shared_stack), use gzl_stack_frame_start_offset_at(). */
+#define GZL_FRAME_START_OFFSET(s, frame) \
+    (&(s)->private_start_offsets[(frame) - (s)->private_stack])
+
+/* The frame on top of state s's parse stack, which is always in its
+ * private_stack: the frame that a rule or terminal callback is called for.
+ * The stack must not be empty. */
+#define GZL_STACK_TOP(s) DYNARRAY_GET_TOP((s)->private_stack)
+
+/* A run of parse stack frames that two or more parse states share, and so
+ * none of them may change.  It sits on top of the first below_len frames of
+ * the segments under it.  See gzl_dup_parse_state(). */
+struct gzl_stack_segment
+{
+    int refcount;
+    int len;
+    struct gzl_parse_stack_frame *frames;
+    struct gzl_offset *frame_start_offsets;
+    struct gzl_stack_segment *below;
+    int below_len;
+    struct gzl_allocator *alloc;
+};
+
 /* A gzl_bound_grammar struct represents a grammar which has had callbacks bound
- * to it and has possibly been JIT-compiled.  Though JIT compilation is not
- * supported yet, the APIs are in-place to anticipate this feature.
+ * to it and has possibly been JIT-compiled.
  *
- * At the moment you initialize a bound_grammar structure directly, but in the
- * future there will be a set of functions that do so, possibly doing JIT
- * compilation and other such things in the process. */
+ * At the moment you initialize a bound_grammar structure directly, and then
+ * optionally call gzl_bind_grammar_jit() and gzl_subscribe_rule() or
+ * gzl_subscribe_terminal() on it.  Zero the whole struct first (with a
+ * designated initializer like {.grammar = g}, or memset()): the parser uses
+ * jit and the subscriptions whenever they are not NULL, and fields may be
+ * added to the end of it. */
 
 struct gzl_parse_state;
 typedef void (*gzl_rule_callback_t)(struct gzl_parse_state *state);
@@ -138,6 +213,49 @@ struct gzl_bound_grammar
     gzl_did_rule_callback_t did_end_rule_cb;
     gzl_error_char_callback_t error_char_cb;
     gzl_error_terminal_callback_t error_terminal_cb;
+
+    /* Native code for the grammar's IntFAs and GLAs, or NULL to interpret
+     * them.  Set by gzl_bind_grammar_jit(). */
+    struct gzl_jit *jit;
+
+    /* Subscriptions.  If rule_subscribed is not NULL, the four rule
+     * callbacks only fire for rules whose entry (indexed like grammar->rtns)
+     * is true; likewise terminal_cb and terminal_subscribed (indexed by
+     * terminal ID).  NULL means every rule or terminal.  Set these with
+     * gzl_subscribe_rule() and gzl_subscribe_terminal(), which allocate them
+     * from the grammar's allocator and remember it in subscriptions_alloc. */
+    bool *rule_subscribed;
+    bool *terminal_subscribed;
+    struct gzl_allocator *subscriptions_alloc;
+};
+
+/* The native code that gzl_bind_grammar_jit() generates.  Each IntFA's
+ * function does what the interpreter does with the IntFA's tables: it moves
+ * the IntFA from *state_num through buf from byte i for as long as no
+ * terminal is complete, and returns the index of the first byte it did not
+ * consume.  Each GLA's function returns the transition that nonfinal state
+ * state_num takes on terminal term_id, or NULL if there is none. */
+typedef size_t gzl_jit_lex_func(const char *buf, size_t i, size_t buf_len,
+                                int *state_num);
+typedef struct gzl_gla_transition *gzl_jit_gla_func(int state_num,
+                                                    int term_id);
+struct gzl_jit
+{
+    void *code;
+    size_t code_size;
+    gzl_jit_lex_func **intfas;  /* indexed like grammar->intfas */
+    gzl_jit_gla_func **glas;    /* indexed like grammar->glas */
+};
+
+/* The callbacks that a state duplicated in them has to know about:
+ * will_start_rule_cb and will_end_rule_cb come before what they report, so
+ * the copy must not make them again; after an error callback the copy has
+ * failed too; and did_end_rule_cb has a frame that must not move. */
+enum gzl_callback_point {
+  GZL_NO_CALLBACK,
+  GZL_BEFORE_CALLBACK,
+  GZL_ERROR_CALLBACK,
+  GZL_DID_END_RULE_CALLBACK
 };
 
 /* This structure defines the core state of a parsing stream.  By saving this
@@ -155,6 +273,9 @@ struct gzl_parse_state
     /* A pointer that the client can use for their own purposes. */
     void *user_data;
 
+    /* Where all of this state's memory comes from (NULL for malloc()). */
+    struct gzl_allocator *alloc;
+
     /* The offset of the next byte in the stream we will process. */
     struct gzl_offset offset;
 
@@ -173,6 +294,64 @@ struct gzl_parse_state
      * newline. */
     bool last_char_was_newline;
 
+    /* If the client sets lazy_lines (after calling gzl_init_parse_state()
+     * and before the first call to gzl_parse()), the parser tracks only byte
+     * offsets as it lexes, which is measurably faster.  The line and column
+     * of every gzl_offset the parser reports are then 0, and the client calls
+     * gzl_resolve_offset() to compute them when they are actually needed
+     * (for example, to report an error).
+     *
+     * To make this possible the parser keeps an index of where the newlines
+     * are in the input it has consumed.  It is built a buffer at a time,
+     * separately from lexing, and takes 16 bytes per line of input on a
+     * 64-bit machine.  Its first shared_newlines_len runs are in
+     * shared_newlines, which duplicated states share (see
+     * gzl_dup_parse_state()), and the rest are in newline_index, which always
+     * has the last run if there is one. */
+    bool lazy_lines;
+    DEFINE_DYNARRAY(newline_index, struct gzl_newline_run);
+    struct gzl_newline_segment *shared_newlines;
+    int shared_newlines_len;
+
+    /* How much of the input has been added to the newline index. */
+    size_t newline_index_end;
+
+    /* The buffer gzl_parse() is currently parsing and the offset of its
+     * first byte, so that callbacks can resolve offsets into input that has
+     * not been indexed yet.  buf is NULL outside of gzl_parse(), and then
+     * buf_offset is where the next buffer starts. */
+    const char *buf;
+    size_t buf_len;
+    size_t buf_offset;
+
+    /* Whether gzl_finish_parse() is running, whose callbacks cannot
+     * duplicate the state. */
+    bool finishing;
+
+    /* The kind of callback the parser is making, which a state duplicated
+     * in it keeps until it gets back there (see gzl_dup_parse_state()). */
+    enum gzl_callback_point callback;
+
+    /* The bytes of the terminal the lexer is in the middle of that came from
+     * earlier buffers (from byte carry_offset up to buf_offset).  The lexer
+     * keeps its own copy because it may have to back up into them; see
+     * munch_memo. */
+    DEFINE_DYNARRAY(carry, char);
+    size_t carry_offset;
+
+    /* The lexer implements maximal munch: when it gets stuck partway through
+     * a longer terminal, it backs up to the end of the longest terminal it
+     * matched and continues from there.  Backing up means some input is
+     * lexed more than once, so to stay linear-time in the worst case the
+     * lexer remembers which (IntFA state, byte offset) pairs it has seen get
+     * stuck (this is Reps' "tabulation" technique).  munch_memo is an
+     * open-addressed hash table of those pairs, all of which are for offsets
+     * below munch_memo_end.  It is empty except just after backing up. */
+    struct gzl_munch_memo_entry *munch_memo;
+    int munch_memo_size;
+    int munch_memo_count;
+    size_t munch_memo_end;
+
     /* Resource limits, which clients can use to prevent degenerate or malicious
      * input from taking up an arbitrary amount of resources.
      * gzl_init_parse_state() will set reasonable defaults for these, but the
@@ -188,20 +367,90 @@ struct gzl_parse_state
     int max_lookahead;
 
     /* The parse stack is the main piece of state that the parser keeps.
-     * There is a stack frame for every RTN, GLA, and IntFA state we are
-     * currently in. */
-    DEFINE_DYNARRAY(parse_stack, struct gzl_parse_stack_frame);
+     * There is a stack frame for every RTN and GLA state we are currently
+     * in.  private_stack is the part of it that belongs to this state alone:
+     * all of it until the state is duplicated, but after that only the top
+     * of it (see shared_stack).  So walk the stack with gzl_stack_depth()
+     * and gzl_stack_frame_at(), not private_stack_len.
+     *
+     * This used to be parse_stack, the whole stack; see the macros for the
+     * old names below. */
+    struct gzl_parse_stack_frame *private_stack;
+    int private_stack_len;
+    int private_stack_size;
+
+    /* The start offset of each frame of private_stack, at the same index as
+     * the frame; this always has room for private_stack_size frames.  Use
+     * GZL_FRAME_START_OFFSET() to get at it. */
+    struct gzl_offset *private_start_offsets;
+
+    /* Once a state has been duplicated, the shared_stack_len frames below
+     * private_stack are in segments that it shares with its duplicates, and
+     * are copied into private_stack as it pops down to them.  The top frame
+     * is always in private_stack, unless the stack is empty.  shared_stack
+     * is NULL if the state shares no frames. */
+    struct gzl_stack_segment *shared_stack;
+    int shared_stack_len;
+
+    /* The IntFA the lexer is running for the RTN or GLA frame on top of the
+     * stack, and the state it is in.  intfa is NULL when the parser is not
+     * lexing: before the first call to gzl_parse(), and after hard EOF or a
+     * parse error.  intfa_start_offset is where the terminal being lexed
+     * began.  There is only ever one of these, and it is replaced after
+     * every terminal, so it is kept here rather than on the parse stack. */
+    struct gzl_intfa *intfa;
+    struct gzl_intfa_state *intfa_state;
+    struct gzl_offset intfa_start_offset;
 
     /* The token buffer stores tokens that have already been used to transition
      * the current GLA, but will be used to transition an RTN (and perhaps
      * other GLAs) when the current GLA hits a final state.  Keeping those
-     * terminals here prevents us from having to re-lex them. */
-    DEFINE_DYNARRAY(token_buffer, struct gzl_terminal);
+     * terminals here prevents us from having to re-lex them.
+     *
+     * It is a ring buffer, so that consuming terminals from the front is
+     * cheap: the token_buffer_len buffered terminals start at index
+     * token_buffer_head and wrap around.  token_buffer_size is always a
+     * power of two. */
+    struct gzl_terminal *token_buffer;
+    int token_buffer_head;
+    int token_buffer_len;
+    int token_buffer_size;
+
+    /* While the parser runs on the token buffer, how many of its terminals
+     * the RTN frames have consumed and how many the GLA frame on top of the
+     * stack has looked at; a state duplicated in a callback carries on from
+     * there.  rtn_term_offset is -1 when the parser is not running. */
+    int rtn_term_offset;
+    int gla_term_offset;
+
+    /* The event tape that the client set with gzl_set_event_tape(), or NULL
+     * if events go to the bound grammar's callbacks.  The first tape_len of
+     * its tape_size records have been filled in.  Events that come when it
+     * is full wait in tape_overflow for the next tape. */
+    struct gzl_event *tape;
+    size_t tape_size;
+    size_t tape_len;
+    DEFINE_DYNARRAY(tape_overflow, struct gzl_event);
 };
 
+/* The old names of private_stack, still here for code written for them.
+ * They are deprecated, since they name the whole stack only of a state
+ * that has not been duplicated and is not a copy:
+ * DYNARRAY_GET_TOP(s->parse_stack) is always right, but should be
+ * GZL_STACK_TOP(s), while s->parse_stack_len and &s->parse_stack[i] must
+ * become gzl_stack_depth(s) and gzl_stack_frame_at(s, i).  Define
+ * GZL_NO_PARSE_STACK_NAMES if they get in the way of names of your own. */
+#ifndef GZL_NO_PARSE_STACK_NAMES
+#define parse_stack private_stack
+#define parse_stack_len private_stack_len
+#define parse_stack_size private_stack_size
+#endif
+
 /* Begin or continue a parse using grammar g, with the current state of the
  * parse represented by s.  It is expected that the text in buf represents the
- * input file or stream at offset s->offset.
+ * input file or stream at offset s->buf_offset, which is s->offset unless s
+ * was duplicated in a callback (see gzl_dup_parse_state()).  Terminals can
+ * span buffers.
  *
  * Return values:
  *  - GZL_STATUS_OK: the entire buffer has been consumed successfully, and
@@ -224,6 +473,11 @@ struct gzl_parse_state
  *    gzl_finish_parse() if it wants to receive final callbacks.
  *  - GZL_STATUS_RESOURCE_LIMIT_EXCEEDED: a resource limit like maximum stack
  *    depth or maximum lookahead limit was exceeded.
+ *  - GZL_STATUS_TAPE_FULL: the event tape filled up, so the parse stopped
+ *    after the first (state->offset - <offset when gzl_parse() was called>)
+ *    bytes of the buffer.  Once the client has read the tape and set a new
+ *    one, it continues the parse by calling gzl_parse() with the rest of the
+ *    buffer, just as it would with the next buffer after GZL_STATUS_OK.
  */
 enum gzl_status {
   GZL_STATUS_OK,
@@ -237,6 +491,9 @@ enum gzl_status {
    * interface: */
   GZL_STATUS_IO_ERROR,             /* Error reading the file, check errno. */
   GZL_STATUS_PREMATURE_EOF_ERROR,  /* File hit EOF but the grammar wasn't EOF */
+
+  /* Added after the others so that they keep their values. */
+  GZL_STATUS_TAPE_FULL,
 };
 enum gzl_status gzl_parse(struct gzl_parse_state *state, const char *buf,
                           size_t buf_len);
@@ -246,14 +503,144 @@ enum gzl_status gzl_parse(struct gzl_parse_state *state, const char *buf,
  * state does not allow EOF here. */
 bool gzl_finish_parse(struct gzl_parse_state *s);
 
+/* Makes the parser append rule and terminal events to tape, which has room
+ * for tape_size of them, instead of calling the bound grammar's callbacks
+ * for them.  (The error callbacks are still called, and subscriptions still
+ * apply.)  This saves an indirect call per event, and lets the client handle
+ * events in batches.  A NULL tape switches back to callbacks.
+ *
+ * gzl_parse() returns GZL_STATUS_TAPE_FULL when the tape fills up, but it
+ * can only stop between terminals, and gzl_finish_parse() does not stop at
+ * all; the events that do not fit on the tape are kept for the next one.
+ * So after every gzl_parse() or gzl_finish_parse() the client reads
+ * state->tape_len events off the tape and sets it again, until it comes
+ * back with no events in it:
+ *
+ *    gzl_finish_parse(state);
+ *    while(state->tape_len > 0) {
+ *        handle_events(state->tape, state->tape_len);
+ *        gzl_set_event_tape(state, tape, tape_size);
+ *    }
+ *
+ * tape_size must be at least 1. */
+void gzl_set_event_tape(struct gzl_parse_state *state,
+                        struct gzl_event *tape, size_t tape_size);
+
+/* In lazy_lines mode, fills in offset->line and offset->column from
+ * offset->byte.  The byte offset must be no later than state->offset, or
+ * the offset of the byte passed to the callback that is currently running.
+ * Returns false if the byte offset is outside of the input seen so far.
+ * Like gzl_stack_frame_at(), this also takes time proportional to how many
+ * times the state's ancestors have been duplicated. */
+bool gzl_resolve_offset(struct gzl_parse_state *state,
+                        struct gzl_offset *offset);
+
+/* gzl_alloc_parse_state_with() allocates the state and everything it grows
+ * into from alloc (see alloc.h), as gzl_dup_parse_state() does its copy;
+ * gzl_alloc_parse_state() uses malloc().  Both return NULL if there is no
+ * memory.  If there is no memory for the state to grow into while parsing,
+ * the parse fails with GZL_STATUS_RESOURCE_LIMIT_EXCEEDED.
+ *
+ * A callback made by gzl_parse() can duplicate the state it is called
+ * for.  The copy carries on from where the callback returns to when it is
+ * next given input: it makes the callbacks that the rest of the terminal
+ * (and of any terminals that lookahead had already lexed) brings, but not
+ * the one it was duplicated in, and a copy made in an error callback fails
+ * as the original does.  It has not seen the rest of the buffer, so give it
+ * the input from byte copy->buf_offset on.  Duplicating a state moves its
+ * frames, so a callback that goes on using the stack afterwards must get its
+ * frames again (the frame passed to did_end_rule_cb stays where it is).
+ * gzl_finish_parse() cannot stop partway, so gzl_dup_parse_state() returns
+ * NULL from its callbacks.
+ *
+ * The copy shares the parse stack and the newline index with the original
+ * (see below), so duplicating a state does not take longer the further it
+ * has got.  It copies the lookahead in the token buffer (up to
+ * max_lookahead terminals), the bytes of the terminal the lexer is in the
+ * middle of, which it keeps from earlier buffers (see carry), and any
+ * events waiting for the next tape (see tape_overflow), which grow only
+ * until the client sets one.  It starts with no munch memo, so it may lex
+ * again input that the original knows it need not.
+ *
+ * The copy that gzl_dup_parse_state() makes has no event tape, even if the
+ * original has one: two states cannot share a tape.  Give the copy a tape of
+ * its own with gzl_set_event_tape() before parsing with it, or its events go
+ * to the callbacks; the events that were waiting for the original's next tape
+ * go on the copy's first one too. */
 struct gzl_parse_state *gzl_alloc_parse_state();
+struct gzl_parse_state *gzl_alloc_parse_state_with(struct gzl_allocator *alloc);
 struct gzl_parse_state *gzl_dup_parse_state(struct gzl_parse_state *state);
 void gzl_free_parse_state(struct gzl_parse_state *state);
+
+/* gzl_dup_parse_state() does not copy the parse stack: the copy and the
+ * original share all of it but the top frame, and each copies the shared
+ * frames it pops down to a few at a time (see shared_stack), so duplicating
+ * a state takes the same time however deep its stack is.  These see the
+ * whole stack, shared or not: its depth, and the frame i frames up from the
+ * bottom of it and the offset at which that frame started.  They take time
+ * proportional to how many times the state's ancestors have been
+ * duplicated, and shared frames must not be changed. */
+int gzl_stack_depth(struct gzl_parse_state *state);
+struct gzl_parse_stack_frame *gzl_stack_frame_at(struct gzl_parse_state *state,
+                                                 int i);
+struct gzl_offset *gzl_stack_frame_start_offset_at(
+    struct gzl_parse_state *state, int i);
 void gzl_init_parse_state(struct gzl_parse_state *state, struct gzl_bound_grammar *bg);
 
+/* Makes state ready to parse a new document with the same bound grammar,
+ * keeping the memory it has grown into and everything the client has set
+ * (user_data, lazy_lines, the event tape and the resource limits), but
+ * throwing away any events still waiting for the tape.  This is much
+ * cheaper than freeing the state and allocating another. */
+void gzl_reset_parse_state(struct gzl_parse_state *state);
+
+/* For clients that parse many small documents, possibly on many threads:
+ * gzl_acquire_parse_state() takes a state from the calling thread's pool
+ * (or allocates one if the pool is empty, returning NULL if there is no
+ * memory) and initializes it for bg.  gzl_release_parse_state() resets it
+ * and puts it back in the pool, forgetting its user_data and event tape and
+ * letting go of anything it shares with its copies, or frees it if the pool
+ * is full or the state did not come from malloc().  A state can be released
+ * on a different thread from the one that acquired it.
+ *
+ * gzl_drain_parse_state_pool() frees the states in the calling thread's pool,
+ * which a thread should call before it exits. */
+struct gzl_parse_state *gzl_acquire_parse_state(struct gzl_bound_grammar *bg);
+void gzl_release_parse_state(struct gzl_parse_state *state);
+void gzl_drain_parse_state_pool();
+
+/* For lexers generated by gzlc --emit-c: returns how many bytes at the start
+ * of buf leave the IntFA in state, which must loop on itself (its run_type
+ * is not GZL_INTFA_RUN_NONE). */
+size_t gzl_scan_intfa_run(struct gzl_intfa_state *state, const char *buf,
+                          size_t len);
+
+/* Compiles the grammar's IntFAs and GLAs into native code and sets bg->jit,
+ * which parse states bound to bg then use.  Returns false, leaving bg->jit
+ * NULL and the parser interpreting the grammar as usual, on architectures the
+ * JIT does not support (it supports x86-64), if there is no memory to
+ * compile the grammar, or if the code could not be made executable.
+ * gzl_unbind_grammar_jit() frees the code; call it before
+ * freeing the grammar. */
+bool gzl_bind_grammar_jit(struct gzl_bound_grammar *bg);
+void gzl_unbind_grammar_jit(struct gzl_bound_grammar *bg);
+
+/* Subscribes bg's rule callbacks to the rule named rule_name, or bg's
+ * terminal callback to the terminal named terminal_name.  Once a bound
+ * grammar has subscribed to any rule, its rule callbacks fire for those
+ * rules only, and the same goes for terminals.  Returns false if the grammar
+ * has no such rule or terminal, or if there is no memory for the
+ * subscriptions.  gzl_clear_subscriptions() frees the subscriptions, so that
+ * the callbacks fire for everything again. */
+bool gzl_subscribe_rule(struct gzl_bound_grammar *bg, const char *rule_name);
+bool gzl_subscribe_terminal(struct gzl_bound_grammar *bg,
+                            const char *terminal_name);
+void gzl_clear_subscriptions(struct gzl_bound_grammar *bg);
+
 /* A buffering layer provides the most common use case of parsing a whole file
  * by streaming from a FILE*.  This "struct buffer" will be the parse state's
- * user_data, the client's user_data is inside "struct buffer". */
+ * user_data, the client's user_data is inside "struct buffer".  It comes from
+ * the parse state's allocator. */
 struct gzl_buffer
 {
     /* The buffer itself. */
@@ -0,0 +1,597 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  jit.c
+
+  A JIT compiler that turns a grammar's IntFAs and GLAs into x86-64
+  machine code when a grammar is bound with gzl_bind_grammar_jit().
+  Each IntFA becomes a function that does what lex_bytes() in parse.c
+  does with the IntFA's tables, one block of code per state, and each
+  GLA a function that does what find_gla_transition() does.  The rest
+  of the parser -- and so every callback -- is the same interpreter as
+  without the JIT.
+
+  On other architectures gzl_bind_grammar_jit() does nothing, and the
+  interpreter runs as it always does.
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+/* For MAP_ANONYMOUS, which -std=c99 hides. */
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gazelle/parse.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define GZL_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+#ifdef GZL_JIT_X86_64
+
+/* States with more byte ranges (for an IntFA) or transitions (for a GLA)
+ * than these jump through a table instead of comparing against each. */
+#define MAX_RANGE_TESTS 4
+#define MAX_TERMINAL_TESTS 8
+
+/*
+ * The code is assembled into a growable buffer, with jumps to labels whose
+ * offsets are filled in once everything has been placed.  Everything is
+ * position-independent except pointers into the grammar, so the buffer is
+ * then copied as it is into executable memory.
+ *
+ * If memory runs out, the buffer is marked as failed and stops growing; the
+ * functions below carry on without emitting anything, and
+ * gzl_bind_grammar_jit() gives up once they return.
+ */
+
+enum fixup_type {
+    FIXUP_REL32,    /* a jump or RIP-relative displacement to the label */
+    FIXUP_TABLE32   /* a jump table entry: label minus the table's offset */
+};
+
+struct fixup
+{
+    enum fixup_type type;
+    int offset;
+    int label;
+    int table_offset;
+};
+
+struct jit_buf
+{
+    DEFINE_DYNARRAY(code, unsigned char);
+    DEFINE_DYNARRAY(labels, int);  /* the offset of each label, or -1 */
+    DEFINE_DYNARRAY(fixups, struct fixup);
+    bool failed;
+};
+
+/* Like RESIZE_DYNARRAY(), but if realloc() fails the array is kept as it was
+ * and the buffer is marked as failed. */
+#define RESIZE_JIT_ARRAY(b, name, desired_len) { \
+  int new_size = (b)->name ## _size; \
+  while(new_size < (desired_len)) \
+    new_size *= 2; \
+  if(new_size != (b)->name ## _size) { \
+    void *resized = realloc((b)->name, new_size * sizeof(*(b)->name)); \
+    if(resized) { \
+      (b)->name = resized; \
+      (b)->name ## _size = new_size; \
+    } else \
+      (b)->failed = true; \
+  } \
+  if(!(b)->failed) \
+    (b)->name ## _len = desired_len; \
+}
+
+static
+void emit(struct jit_buf *b, int len, const unsigned char *bytes)
+{
+    int offset = b->code_len;
+    if(b->failed)
+        return;
+    RESIZE_JIT_ARRAY(b, code, offset + len);
+    if(b->failed)
+        return;
+    memcpy(&b->code[offset], bytes, len);
+}
+
+#define EMIT(b, ...) \
+    do { \
+        const unsigned char bytes[] = {__VA_ARGS__}; \
+        emit(b, sizeof(bytes), bytes); \
+    } while(0)
+
+static
+void emit32(struct jit_buf *b, int32_t val)
+{
+    EMIT(b, val & 0xFF, (val >> 8) & 0xFF, (val >> 16) & 0xFF,
+         (val >> 24) & 0xFF);
+}
+
+static
+void emit64(struct jit_buf *b, uint64_t val)
+{
+    emit32(b, (int32_t)(val & 0xFFFFFFFF));
+    emit32(b, (int32_t)(val >> 32));
+}
+
+static
+int new_label(struct jit_buf *b)
+{
+    if(b->failed)
+        return 0;
+    RESIZE_JIT_ARRAY(b, labels, b->labels_len+1);
+    if(b->failed)
+        return 0;
+    *DYNARRAY_GET_TOP(b->labels) = -1;
+    return b->labels_len - 1;
+}
+
+static
+void place_label(struct jit_buf *b, int label)
+{
+    if(!b->failed)
+        b->labels[label] = b->code_len;
+}
+
+static
+void add_fixup(struct jit_buf *b, enum fixup_type type, int label,
+               int table_offset)
+{
+    if(b->failed)
+        return;
+    RESIZE_JIT_ARRAY(b, fixups, b->fixups_len+1);
+    if(b->failed)
+        return;
+    struct fixup *f = DYNARRAY_GET_TOP(b->fixups);
+    f->type = type;
+    f->offset = b->code_len;
+    f->label = label;
+    f->table_offset = table_offset;
+    emit32(b, 0);
+}
+
+static
+void align(struct jit_buf *b, int alignment)
+{
+    while(!b->failed && b->code_len % alignment)
+        EMIT(b, 0xCC);  /* int3 */
+}
+
+/* The instructions used below, by what they do.  r/m operands are spelled
+ * out in the ModRM (and SIB) bytes of each. */
+
+static void emit_jmp(struct jit_buf *b, int label)
+{ EMIT(b, 0xE9); add_fixup(b, FIXUP_REL32, label, 0); }
+
+static void emit_je(struct jit_buf *b, int label)
+{ EMIT(b, 0x0F, 0x84); add_fixup(b, FIXUP_REL32, label, 0); }
+
+static void emit_ja(struct jit_buf *b, int label)
+{ EMIT(b, 0x0F, 0x87); add_fixup(b, FIXUP_REL32, label, 0); }
+
+static void emit_jae(struct jit_buf *b, int label)
+{ EMIT(b, 0x0F, 0x83); add_fixup(b, FIXUP_REL32, label, 0); }
+
+static void emit_jbe(struct jit_buf *b, int label)
+{ EMIT(b, 0x0F, 0x86); add_fixup(b, FIXUP_REL32, label, 0); }
+
+/* Jumps through the table of 32-bit offsets at table_label, entry index_reg
+ * (which must be zero-extended): lea r8, [rip + table];
+ * movsxd rax, dword [r8 + index_reg*4]; add rax, r8; jmp rax */
+static void emit_jump_through_table(struct jit_buf *b, int table_label,
+                                    int index_reg)
+{
+    EMIT(b, 0x4C, 0x8D, 0x05); add_fixup(b, FIXUP_REL32, table_label, 0);
+    EMIT(b, 0x49, 0x63, 0x04, 0x80 | (index_reg << 3));
+    EMIT(b, 0x4C, 0x01, 0xC0);
+    EMIT(b, 0xFF, 0xE0);
+}
+
+#define REG_RAX 0
+#define REG_RDI 7
+
+/* Emits a table of 32-bit offsets to the given labels, relative to the
+ * start of the table. */
+static
+void emit_table(struct jit_buf *b, int table_label, int *labels, int n)
+{
+    align(b, 4);
+    place_label(b, table_label);
+    int table_offset = b->code_len;
+    for(int i = 0; i < n; i++)
+        add_fixup(b, FIXUP_TABLE32, labels[i], table_offset);
+}
+
+/*
+ * compile_intfa(): emits a function for the IntFA, of type
+ * gzl_jit_lex_func.  It is called once per terminal, so it uses only the
+ * registers a call may clobber and needs no prologue.  While it runs:
+ *
+ *   rdi: buf       rsi: the next byte      rdx: the end of buf
+ *   rcx: state_num                         rax, r8: scratch
+ *
+ * Each state k has a label to enter it having consumed a byte (which
+ * increments rsi and falls through), one to resume in it, and one that
+ * leaves the function in it.
+ */
+static
+void compile_intfa(struct jit_buf *b, struct gzl_intfa *intfa)
+{
+    int n = intfa->num_states;
+    int *enter = malloc(n * sizeof(*enter));
+    int *resume = malloc(n * sizeof(*resume));
+    int *leave = malloc(n * sizeof(*leave));
+    int *class_tables = malloc(n * sizeof(*class_tables));
+    int *targets = malloc(intfa->num_byte_classes * sizeof(*targets));
+    if(!enter || !resume || !leave || !class_tables || !targets)
+    {
+        b->failed = true;
+        free(targets);
+        free(class_tables);
+        free(leave);
+        free(resume);
+        free(enter);
+        return;
+    }
+    for(int i = 0; i < n; i++)
+    {
+        enter[i] = new_label(b);
+        resume[i] = new_label(b);
+        leave[i] = new_label(b);
+        class_tables[i] = -1;
+    }
+    int entry_table = new_label(b);
+    int out = new_label(b);
+
+    EMIT(b, 0x48, 0x01, 0xFE);        /* add rsi, rdi */
+    EMIT(b, 0x48, 0x01, 0xFA);        /* add rdx, rdi */
+    EMIT(b, 0x8B, 0x01);              /* mov eax, [rcx] */
+    /* Most terminals start in the start state, so skip the table. */
+    EMIT(b, 0x85, 0xC0);              /* test eax, eax */
+    emit_je(b, resume[0]);
+    emit_jump_through_table(b, entry_table, REG_RAX);
+
+    for(int i = 0; i < n; i++)
+    {
+        struct gzl_intfa_state *state = &intfa->states[i];
+        place_label(b, enter[i]);
+        EMIT(b, 0x48, 0xFF, 0xC6);    /* inc rsi */
+        place_label(b, resume[i]);
+
+        if(state->run_type != GZL_INTFA_RUN_NONE)
+        {
+            /* rsi += gzl_scan_intfa_run(state, rsi, rdx - rsi), saving our
+             * registers (and keeping the stack aligned) around the call. */
+            EMIT(b, 0x57, 0x56, 0x52, 0x51);  /* push rdi, rsi, rdx, rcx */
+            EMIT(b, 0x48, 0x83, 0xEC, 0x08);  /* sub rsp, 8 */
+            EMIT(b, 0x48, 0x29, 0xF2);        /* sub rdx, rsi */
+            EMIT(b, 0x48, 0xBF); emit64(b, (uintptr_t)state);  /* mov rdi */
+            EMIT(b, 0x48, 0xB8);
+            emit64(b, (uintptr_t)gzl_scan_intfa_run);          /* mov rax */
+            EMIT(b, 0xFF, 0xD0);              /* call rax */
+            EMIT(b, 0x48, 0x83, 0xC4, 0x08);  /* add rsp, 8 */
+            EMIT(b, 0x59, 0x5A, 0x5E, 0x5F);  /* pop rcx, rdx, rsi, rdi */
+            EMIT(b, 0x48, 0x01, 0xC6);        /* add rsi, rax */
+        }
+
+        EMIT(b, 0x48, 0x39, 0xD6);    /* cmp rsi, rdx */
+        emit_je(b, leave[i]);
+        EMIT(b, 0x0F, 0xB6, 0x06);    /* movzx eax, byte [rsi] */
+
+        /* Only transitions that leave a terminal incomplete keep going, as
+         * in lex_bytes(). */
+        int num_ranges = 0;
+        for(int j = 0; j < state->num_transitions; j++)
+        {
+            struct gzl_intfa_state *dest = state->transitions[j].dest_state;
+            if(!(dest->final && dest->num_transitions == 0))
+                num_ranges++;
+        }
+
+        if(num_ranges <= MAX_RANGE_TESTS)
+        {
+            for(int j = 0; j < state->num_transitions; j++)
+            {
+                struct gzl_intfa_transition *t = &state->transitions[j];
+                struct gzl_intfa_state *dest = t->dest_state;
+                if(dest->final && dest->num_transitions == 0)
+                    continue;
+                int dest_label = enter[dest - intfa->states];
+                if(t->ch_low == t->ch_high) {
+                    EMIT(b, 0x3D); emit32(b, t->ch_low);  /* cmp eax */
+                    emit_je(b, dest_label);
+                } else if(t->ch_low == 0) {
+                    EMIT(b, 0x3D); emit32(b, t->ch_high);
+                    emit_jbe(b, dest_label);
+                } else if(t->ch_high == 255) {
+                    EMIT(b, 0x3D); emit32(b, t->ch_low);
+                    emit_jae(b, dest_label);
+                } else {
+                    /* lea r8d, [rax - low]; cmp r8d, high - low */
+                    EMIT(b, 0x44, 0x8D, 0x80); emit32(b, -t->ch_low);
+                    EMIT(b, 0x41, 0x81, 0xF8);
+                    emit32(b, t->ch_high - t->ch_low);
+                    emit_jbe(b, dest_label);
+                }
+            }
+        }
+        else
+        {
+            /* Jump through a table indexed by the byte's class. */
+            class_tables[i] = new_label(b);
+            EMIT(b, 0x49, 0xB8);
+            emit64(b, (uintptr_t)intfa->byte_class);  /* mov r8 */
+            EMIT(b, 0x41, 0x0F, 0xB6, 0x04, 0x00);   /* movzx eax, [r8+rax] */
+            emit_jump_through_table(b, class_tables[i], REG_RAX);
+        }
+
+        place_label(b, leave[i]);
+        EMIT(b, 0xC7, 0x01); emit32(b, i);  /* mov dword [rcx], i */
+        emit_jmp(b, out);
+    }
+
+    place_label(b, out);
+    EMIT(b, 0x48, 0x89, 0xF0);        /* mov rax, rsi */
+    EMIT(b, 0x48, 0x29, 0xF8);        /* sub rax, rdi */
+    EMIT(b, 0xC3);                    /* ret */
+
+    emit_table(b, entry_table, resume, n);
+    for(int i = 0; i < n; i++)
+    {
+        if(class_tables[i] < 0)
+            continue;
+        struct gzl_intfa_state *state = &intfa->states[i];
+        for(int j = 0; j < intfa->num_byte_classes; j++)
+        {
+            struct gzl_intfa_state *dest = state->next_state[j];
+            if(!dest || (dest->final && dest->num_transitions == 0))
+                targets[j] = leave[i];
+            else
+                targets[j] = enter[dest - intfa->states];
+        }
+        emit_table(b, class_tables[i], targets, intfa->num_byte_classes);
+    }
+
+    free(targets);
+    free(class_tables);
+    free(leave);
+    free(resume);
+    free(enter);
+}
+
+/*
+ * compile_gla(): emits a function for the GLA, of type gzl_jit_gla_func,
+ * which returns the transition that a nonfinal state (edi) takes on a
+ * terminal (esi), or NULL.
+ */
+static
+void compile_gla(struct jit_buf *b, struct gzl_gla *gla)
+{
+    int n = gla->num_states;
+    int *states = malloc(n * sizeof(*states));
+    if(!states)
+    {
+        b->failed = true;
+        return;
+    }
+    int entry_table = new_label(b);
+    int null = new_label(b);
+
+    EMIT(b, 0x89, 0xFF);              /* mov edi, edi (zero-extend) */
+    emit_jump_through_table(b, entry_table, REG_RDI);
+
+    for(int i = 0; i < n; i++)
+    {
+        struct gzl_gla_state *state = &gla->states[i];
+        if(state->is_final)
+        {
+            states[i] = null;
+            continue;
+        }
+        states[i] = new_label(b);
+        place_label(b, states[i]);
+
+        struct gzl_nonfinal_info *nonfinal = &state->d.nonfinal;
+        int *found = malloc(nonfinal->num_transitions * sizeof(*found));
+        if(!found)
+        {
+            b->failed = true;
+            break;
+        }
+        for(int j = 0; j < nonfinal->num_transitions; j++)
+            found[j] = new_label(b);
+
+        int min_id = 0, max_id = 0;
+        for(int j = 0; j < nonfinal->num_transitions; j++)
+        {
+            int id = nonfinal->transitions[j].term_id;
+            if(j == 0 || id < min_id) min_id = id;
+            if(j == 0 || id > max_id) max_id = id;
+        }
+
+        int table = -1;
+        if(nonfinal->num_transitions <= MAX_TERMINAL_TESTS)
+        {
+            for(int j = 0; j < nonfinal->num_transitions; j++)
+            {
+                EMIT(b, 0x81, 0xFE);  /* cmp esi, term_id */
+                emit32(b, nonfinal->transitions[j].term_id);
+                emit_je(b, found[j]);
+            }
+            emit_jmp(b, null);
+        }
+        else
+        {
+            /* lea eax, [rsi - min_id]; cmp eax, max_id - min_id */
+            table = new_label(b);
+            EMIT(b, 0x8D, 0x86); emit32(b, -min_id);
+            EMIT(b, 0x3D); emit32(b, max_id - min_id);
+            emit_ja(b, null);
+            emit_jump_through_table(b, table, REG_RAX);
+        }
+
+        for(int j = 0; j < nonfinal->num_transitions; j++)
+        {
+            place_label(b, found[j]);
+            EMIT(b, 0x48, 0xB8);      /* mov rax, transition */
+            emit64(b, (uintptr_t)&nonfinal->transitions[j]);
+            EMIT(b, 0xC3);            /* ret */
+        }
+
+        if(table >= 0)
+        {
+            /* Earlier transitions win, as in find_gla_transition(). */
+            int size = max_id - min_id + 1;
+            int *targets = malloc(size * sizeof(*targets));
+            if(targets)
+            {
+                for(int j = 0; j < size; j++)
+                    targets[j] = null;
+                for(int j = nonfinal->num_transitions - 1; j >= 0; j--)
+                    targets[nonfinal->transitions[j].term_id - min_id] =
+                        found[j];
+                emit_table(b, table, targets, size);
+            }
+            else
+                b->failed = true;
+            free(targets);
+        }
+        free(found);
+    }
+
+    place_label(b, null);
+    EMIT(b, 0x31, 0xC0);              /* xor eax, eax */
+    EMIT(b, 0xC3);                    /* ret */
+
+    /* If we broke out of the loop, not every state has a label. */
+    if(!b->failed)
+        emit_table(b, entry_table, states, n);
+    free(states);
+}
+
+static
+void resolve_fixups(struct jit_buf *b)
+{
+    for(int i = 0; i < b->fixups_len; i++)
+    {
+        struct fixup *f = &b->fixups[i];
+        int32_t val = b->labels[f->label];
+        if(f->type == FIXUP_REL32)
+            val -= f->offset + 4;
+        else
+            val -= f->table_offset;
+        memcpy(&b->code[f->offset], &val, sizeof(val));
+    }
+}
+
+#endif  /* GZL_JIT_X86_64 */
+
+/*
+ * The rest of this file is the publicly-exposed API
+ */
+
+bool gzl_bind_grammar_jit(struct gzl_bound_grammar *bg)
+{
+    bg->jit = NULL;
+#ifdef GZL_JIT_X86_64
+    struct gzl_grammar *g = bg->grammar;
+    struct jit_buf b;
+    INIT_DYNARRAY(b.code, 0, 4096);
+    INIT_DYNARRAY(b.labels, 0, 64);
+    INIT_DYNARRAY(b.fixups, 0, 64);
+    /* One extra entry each, so that there is something to allocate even for
+     * a grammar with no GLAs. */
+    int *intfa_offsets = malloc((g->num_intfas + 1) * sizeof(*intfa_offsets));
+    int *gla_offsets = malloc((g->num_glas + 1) * sizeof(*gla_offsets));
+    b.failed = !b.code || !b.labels || !b.fixups ||
+               !intfa_offsets || !gla_offsets;
+
+    for(int i = 0; i < g->num_intfas && !b.failed; i++)
+    {
+        align(&b, 16);
+        intfa_offsets[i] = b.code_len;
+        compile_intfa(&b, &g->intfas[i]);
+    }
+    for(int i = 0; i < g->num_glas && !b.failed; i++)
+    {
+        align(&b, 16);
+        gla_offsets[i] = b.code_len;
+        compile_gla(&b, &g->glas[i]);
+    }
+
+    struct gzl_jit *jit = NULL;
+    if(!b.failed)
+    {
+        resolve_fixups(&b);
+        jit = malloc(sizeof(*jit));
+        if(jit)
+        {
+            jit->intfas = malloc((g->num_intfas + 1) * sizeof(*jit->intfas));
+            jit->glas = malloc((g->num_glas + 1) * sizeof(*jit->glas));
+        }
+    }
+
+    unsigned char *code = MAP_FAILED;
+    if(jit && jit->intfas && jit->glas)
+        code = mmap(NULL, b.code_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code != MAP_FAILED)
+    {
+        memcpy(code, b.code, b.code_len);
+        if(mprotect(code, b.code_len, PROT_READ | PROT_EXEC) == 0)
+        {
+            jit->code = code;
+            jit->code_size = b.code_len;
+            for(int i = 0; i < g->num_intfas; i++)
+                jit->intfas[i] = (gzl_jit_lex_func*)(code + intfa_offsets[i]);
+            for(int i = 0; i < g->num_glas; i++)
+                jit->glas[i] = (gzl_jit_gla_func*)(code + gla_offsets[i]);
+            bg->jit = jit;
+        }
+        else
+            munmap(code, b.code_len);
+    }
+
+    if(!bg->jit && jit)
+    {
+        free(jit->intfas);
+        free(jit->glas);
+        free(jit);
+    }
+    free(gla_offsets);
+    free(intfa_offsets);
+    FREE_DYNARRAY(b.fixups);
+    FREE_DYNARRAY(b.labels);
+    FREE_DYNARRAY(b.code);
+#endif
+    return bg->jit != NULL;
+}
+
+void gzl_unbind_grammar_jit(struct gzl_bound_grammar *bg)
+{
+    if(!bg->jit)
+        return;
+#ifdef GZL_JIT_X86_64
+    munmap(bg->jit->code, bg->jit->code_size);
+#endif
+    free(bg->jit->intfas);
+    free(bg->jit->glas);
+    free(bg->jit);
+    bg->jit = NULL;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
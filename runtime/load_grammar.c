@@ -11,11 +11,14 @@
 
 *********************************************************************/
 
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "gazelle/bc_read_stream.h"
 #include "gazelle/grammar.h"
+#include "gazelle/parse.h"
 
 #define BC_INTFAS 8
 #define BC_INTFA 9
@@ -29,6 +32,9 @@
 #define BC_INTFA_FINAL_STATE 1
 #define BC_INTFA_TRANSITION 2
 #define BC_INTFA_TRANSITION_RANGE 3
+#define BC_INTFA_KEYWORD_TABLE 4
+#define BC_INTFA_KEYWORD 5
+#define BC_INTFA_SKIP 6
 
 #define BC_STRING 0
 
@@ -63,8 +69,12 @@ void check_error(struct bc_read_stream *s)
     }
 }
 
+/*
+ * unexpected(): reports a record that has no business where it is.  Returns
+ * false, so that loaders can give up with "return unexpected(s, ri);".
+ */
 static
-void unexpected(struct bc_read_stream *s, struct record_info ri)
+bool unexpected(struct bc_read_stream *s, struct record_info ri)
 {
     printf("Unexpected.  Record is: ");
     if(ri.record_type == DataRecord)
@@ -86,11 +96,37 @@ void unexpected(struct bc_read_stream *s, struct record_info ri)
     else if(ri.record_type == Err)
         printf("error\n");
 
-    exit(1);
+    return false;
 }
 
+/*
+ * grammar_alloc(), grammar_calloc(): allocate memory for the grammar from
+ * its allocator, returning NULL if it is out.  Zero bytes are allocated as
+ * one, so that NULL always means failure.  (The scratch space that the loader
+ * frees again before it returns comes from malloc().)
+ */
 static
-char **load_strings(struct bc_read_stream *s)
+void *grammar_alloc(struct gzl_grammar *g, size_t size)
+{
+    return gzl_alloc(g->alloc, size > 0 ? size : 1);
+}
+
+static
+void *grammar_calloc(struct gzl_grammar *g, size_t num, size_t size)
+{
+    void *ptr = grammar_alloc(g, num * size);
+    if(ptr)
+        memset(ptr, 0, num * size);
+    return ptr;
+}
+
+/*
+ * load_strings() and the other load_*() functions below return false if the
+ * block is corrupt or memory runs out, leaving what they did load where
+ * gzl_free_grammar() will find it.
+ */
+static
+bool load_strings(struct bc_read_stream *s, struct gzl_grammar *g)
 {
     /* first get a count of the strings */
     int num_strings = 0;
@@ -103,11 +139,15 @@ char **load_strings(struct bc_read_stream *s)
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    char **strings = malloc((num_strings+1) * sizeof(*strings));
+    /* Zeroed, so that it is NULL-terminated however far we get. */
+    char **strings = grammar_calloc(g, num_strings+1, sizeof(*strings));
+    if(!strings)
+        return false;
+    g->strings = strings;
     int string_offset = 0;
 
     while(1)
@@ -115,7 +155,9 @@ char **load_strings(struct bc_read_stream *s)
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == DataRecord && ri.id == BC_STRING)
         {
-            char *str = malloc((bc_rs_get_record_size(s)+1) * sizeof(char));
+            char *str = grammar_alloc(g, (bc_rs_get_record_size(s)+1) * sizeof(char));
+            if(!str)
+                return false;
             int i;
             for(i = 0; bc_rs_get_remaining_record_size(s) > 0; i++)
             {
@@ -131,19 +173,156 @@ char **load_strings(struct bc_read_stream *s)
             break;
         }
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
+    }
+
+    return true;
+}
+
+/*
+ * intern_terminal(): returns the ID of the terminal named by the given
+ * string, giving it the next free ID if it doesn't have one yet.
+ * terminal_ids maps string offsets to the IDs given out so far (0 for none).
+ */
+static
+int intern_terminal(struct gzl_grammar *g, int *terminal_ids, int string_offset)
+{
+    if(terminal_ids[string_offset] == 0)
+    {
+        int id = ++g->num_terminals;
+        g->terminal_names[id] = g->strings[string_offset];
+        terminal_ids[string_offset] = id;
     }
+    return terminal_ids[string_offset];
+}
 
-    strings[string_offset] = NULL;
-    return strings;
+/*
+ * find_intfa_state_run(): decides whether the lexer can skip runs of bytes
+ * that leave this state where it is, given the state's full 256-entry row
+ * of destination states.  This is only worthwhile when the set of bytes
+ * that end the run (or the set of bytes that continue it) is small enough
+ * to test for a whole vector of input at a time.
+ */
+static
+void find_intfa_state_run(struct gzl_intfa_state *state,
+                          struct gzl_intfa_state **row)
+{
+    int num_looping = 0;
+    for(int ch = 0; ch < 256; ch++)
+        if(row[ch] == state)
+            num_looping++;
+
+    state->run_type = GZL_INTFA_RUN_NONE;
+    state->num_run_bytes = 0;
+    if(num_looping == 0)
+        return;
+
+    bool until_any = (256 - num_looping <= GZL_MAX_RUN_BYTES);
+    if(!until_any && num_looping > GZL_MAX_RUN_BYTES)
+        return;
+
+    state->run_type = until_any ? GZL_INTFA_RUN_UNTIL_ANY : GZL_INTFA_RUN_WHILE_ANY;
+    for(int ch = 0; ch < 256; ch++)
+        if((row[ch] == state) != until_any)
+            state->run_bytes[state->num_run_bytes++] = ch;
 }
 
+/*
+ * build_intfa_transition_table(): expands the transition ranges of every
+ * state of the IntFA into a dense table, so that the lexer can find the
+ * next state without scanning the ranges.  The table is indexed by byte
+ * equivalence class rather than by byte: two bytes are in the same class
+ * if every state of the IntFA sends them to the same place.
+ */
 static
-void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **strings)
+bool build_intfa_transition_table(struct gzl_intfa *intfa,
+                                  struct gzl_grammar *g)
 {
+    /* First expand every state's ranges into a full 256-entry row. */
+    struct gzl_intfa_state **by_byte =
+        malloc(intfa->num_states * 256 * sizeof(*by_byte));
+    if(!by_byte && intfa->num_states > 0)
+        return false;
+
+    for(int i = 0; i < intfa->num_states; i++)
+    {
+        struct gzl_intfa_state *state = &intfa->states[i];
+        struct gzl_intfa_state **row = &by_byte[i * 256];
+
+        for(int ch = 0; ch < 256; ch++)
+            row[ch] = NULL;
+
+        /* Walk the ranges backwards so that if any ranges overlap, the first
+         * one wins, just as it would for a linear scan. */
+        for(int j = state->num_transitions - 1; j >= 0; j--)
+        {
+            struct gzl_intfa_transition *t = &state->transitions[j];
+            for(int ch = t->ch_low; ch <= t->ch_high && ch < 256; ch++)
+                row[ch] = t->dest_state;
+        }
+    }
+
+    /* Assign each byte to a class by comparing its column of the table with
+     * the column of the first byte of every class found so far. */
+    int class_rep[256];
+    intfa->num_byte_classes = 0;
+    for(int ch = 0; ch < 256; ch++)
+    {
+        int c;
+        for(c = 0; c < intfa->num_byte_classes; c++)
+        {
+            int i;
+            for(i = 0; i < intfa->num_states; i++)
+                if(by_byte[i * 256 + ch] != by_byte[i * 256 + class_rep[c]])
+                    break;
+            if(i == intfa->num_states)
+                break;
+        }
+
+        if(c == intfa->num_byte_classes)
+            class_rep[intfa->num_byte_classes++] = ch;
+        intfa->byte_class[ch] = c;
+    }
+
+    /* Find the states that loop on themselves for long runs of bytes. */
+    for(int i = 0; i < intfa->num_states; i++)
+        find_intfa_state_run(&intfa->states[i], &by_byte[i * 256]);
+
+    /* Now build the compressed table, one column per class. */
+    int num_classes = intfa->num_byte_classes;
+    intfa->transition_table = grammar_alloc(g,
+        intfa->num_states * num_classes * sizeof(*intfa->transition_table));
+    if(!intfa->transition_table)
+    {
+        free(by_byte);
+        return false;
+    }
+
+    for(int i = 0; i < intfa->num_states; i++)
+    {
+        struct gzl_intfa_state *state = &intfa->states[i];
+        state->next_state = &intfa->transition_table[i * num_classes];
+        for(int c = 0; c < num_classes; c++)
+            state->next_state[c] = by_byte[i * 256 + class_rep[c]];
+    }
+
+    free(by_byte);
+    return true;
+}
+
+static
+bool load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa,
+                struct gzl_grammar *g, int *terminal_ids)
+{
+    char **strings = g->strings;
+
     /* first get a count of the states and transitions */
     intfa->num_states = 0;
     intfa->num_transitions = 0;
+    intfa->keyword_table_size = 0;
+    intfa->keyword_multiplier = 0;
+    intfa->keywords = NULL;
+    intfa->lex = NULL;
 
     while(1)
     {
@@ -158,12 +337,14 @@ void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **string
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    intfa->states = malloc(intfa->num_states * sizeof(*intfa->states));
-    intfa->transitions = malloc(intfa->num_transitions * sizeof(*intfa->transitions));
+    intfa->states = grammar_alloc(g, intfa->num_states * sizeof(*intfa->states));
+    intfa->transitions = grammar_alloc(g, intfa->num_transitions * sizeof(*intfa->transitions));
+    if(!intfa->states || !intfa->transitions)
+        return false;
     int state_offset = 0;
     int transition_offset = 0;
     int state_transition_offset = 0;
@@ -182,9 +363,17 @@ void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **string
                 state_transition_offset += state->num_transitions;
 
                 if(ri.id == BC_INTFA_FINAL_STATE)
-                    state->final = strings[bc_rs_read_next_32(s)];
+                {
+                    int name = bc_rs_read_next_32(s);
+                    state->final = strings[name];
+                    state->final_id = intern_terminal(g, terminal_ids, name);
+                }
                 else
+                {
                     state->final = NULL;
+                    state->final_id = GZL_EOF_TERMINAL_ID;
+                }
+                state->skip = false;
             }
             else if(ri.id == BC_INTFA_TRANSITION || ri.id == BC_INTFA_TRANSITION_RANGE)
             {
@@ -202,16 +391,46 @@ void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **string
 
                 transition->dest_state = &intfa->states[bc_rs_read_next_8(s)];
             }
+            else if(ri.id == BC_INTFA_SKIP)
+            {
+                char *terminal = strings[bc_rs_read_next_32(s)];
+                for(int i = 0; i < intfa->num_states; i++)
+                    if(intfa->states[i].final == terminal)
+                        intfa->states[i].skip = true;
+            }
+            else if(ri.id == BC_INTFA_KEYWORD_TABLE)
+            {
+                intfa->keyword_multiplier = bc_rs_read_next_32(s);
+                intfa->keyword_table_size = bc_rs_read_next_32(s);
+                intfa->keywords = grammar_calloc(g, intfa->keyword_table_size,
+                                                 sizeof(*intfa->keywords));
+                if(!intfa->keywords)
+                    return false;
+            }
+            else if(ri.id == BC_INTFA_KEYWORD)
+            {
+                struct gzl_intfa_keyword *keyword = &intfa->keywords[bc_rs_read_next_32(s)];
+                keyword->text = strings[bc_rs_read_next_32(s)];
+                keyword->len = strlen(keyword->text);
+                int terminal = bc_rs_read_next_32(s);
+                keyword->terminal = strings[terminal];
+                keyword->terminal_id = intern_terminal(g, terminal_ids, terminal);
+                keyword->identifier_id =
+                    intern_terminal(g, terminal_ids, bc_rs_read_next_32(s));
+            }
         }
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
+
+    return build_intfa_transition_table(intfa, g);
 }
 
 static
-void load_intfas(struct bc_read_stream *s, struct gzl_grammar *g)
+bool load_intfas(struct bc_read_stream *s, struct gzl_grammar *g,
+                 int *terminal_ids)
 {
     /* first get a count of the intfas */
     g->num_intfas = 0;
@@ -226,11 +445,13 @@ void load_intfas(struct bc_read_stream *s, struct gzl_grammar *g)
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    g->intfas = malloc((g->num_intfas) * sizeof(*g->intfas));
+    g->intfas = grammar_calloc(g, g->num_intfas, sizeof(*g->intfas));
+    if(!g->intfas)
+        return false;
     int intfa_offset = 0;
 
     while(1)
@@ -238,21 +459,25 @@ void load_intfas(struct bc_read_stream *s, struct gzl_grammar *g)
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == StartBlock && ri.id == BC_INTFA)
         {
-            load_intfa(s, &g->intfas[intfa_offset++], g->strings);
+            if(!load_intfa(s, &g->intfas[intfa_offset++], g, terminal_ids))
+                return false;
         }
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
+    return true;
 }
 
 static
-void load_gla(struct bc_read_stream *s, struct gzl_gla *gla, struct gzl_grammar *g)
+bool load_gla(struct bc_read_stream *s, struct gzl_gla *gla, struct gzl_grammar *g,
+              int *terminal_ids)
 {
     /* first get a count of the states and transitions */
     gla->num_states = 0;
     gla->num_transitions = 0;
+    gla->decide = NULL;
 
     while(1)
     {
@@ -268,12 +493,14 @@ void load_gla(struct bc_read_stream *s, struct gzl_gla *gla, struct gzl_grammar
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    gla->states = malloc(gla->num_states * sizeof(*gla->states));
-    gla->transitions = malloc(gla->num_transitions * sizeof(*gla->transitions));
+    gla->states = grammar_alloc(g, gla->num_states * sizeof(*gla->states));
+    gla->transitions = grammar_alloc(g, gla->num_transitions * sizeof(*gla->transitions));
+    if(!gla->states || !gla->transitions)
+        return false;
 
     int state_offset = 0;
     int transition_offset = 0;
@@ -309,20 +536,28 @@ void load_gla(struct bc_read_stream *s, struct gzl_gla *gla, struct gzl_grammar
                 int dest_state_offset = bc_rs_read_next_32(s);
                 transition->dest_state = &gla->states[dest_state_offset];
                 if(term == 0)
+                {
                     transition->term = NULL;
+                    transition->term_id = GZL_EOF_TERMINAL_ID;
+                }
                 else
+                {
                     transition->term = g->strings[term-1];
+                    transition->term_id = intern_terminal(g, terminal_ids, term-1);
+                }
             }
         }
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
+    return true;
 }
 
 static
-void load_glas(struct bc_read_stream *s, struct gzl_grammar *g)
+bool load_glas(struct bc_read_stream *s, struct gzl_grammar *g,
+               int *terminal_ids)
 {
     /* first get a count of the glas */
     g->num_glas = 0;
@@ -337,11 +572,13 @@ void load_glas(struct bc_read_stream *s, struct gzl_grammar *g)
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    g->glas = malloc(g->num_glas * sizeof(*g->glas));
+    g->glas = grammar_calloc(g, g->num_glas, sizeof(*g->glas));
+    if(!g->glas)
+        return false;
     int gla_offset = 0;
 
     while(1)
@@ -349,17 +586,20 @@ void load_glas(struct bc_read_stream *s, struct gzl_grammar *g)
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == StartBlock && ri.id == BC_GLA)
         {
-            load_gla(s, &g->glas[gla_offset++], g);
+            if(!load_gla(s, &g->glas[gla_offset++], g, terminal_ids))
+                return false;
         }
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
+    return true;
 }
 
 static
-void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar *g)
+bool load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar *g,
+              int *terminal_ids)
 {
     /* first get a count of the states and transitions */
     rtn->num_states = 0;
@@ -381,12 +621,14 @@ void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    rtn->states = malloc(rtn->num_states * sizeof(*rtn->states));
-    rtn->transitions = malloc(rtn->num_transitions * sizeof(*rtn->transitions));
+    rtn->states = grammar_alloc(g, rtn->num_states * sizeof(*rtn->states));
+    rtn->transitions = grammar_alloc(g, rtn->num_transitions * sizeof(*rtn->transitions));
+    if(!rtn->states || !rtn->transitions)
+        return false;
 
     int state_offset = 0;
     int transition_offset = 0;
@@ -440,7 +682,9 @@ void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar
                 if(ri.id == BC_RTN_TRANSITION_TERMINAL)
                 {
                     transition->transition_type = GZL_TERMINAL_TRANSITION;
-                    transition->edge.terminal_name = g->strings[bc_rs_read_next_32(s)];
+                    int name = bc_rs_read_next_32(s);
+                    transition->edge.terminal_name = g->strings[name];
+                    transition->terminal_id = intern_terminal(g, terminal_ids, name);
                 }
                 else if(ri.id == BC_RTN_TRANSITION_NONTERM)
                 {
@@ -456,12 +700,14 @@ void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
+    return true;
 }
 
 static
-void load_rtns(struct bc_read_stream *s, struct gzl_grammar *g)
+bool load_rtns(struct bc_read_stream *s, struct gzl_grammar *g,
+               int *terminal_ids)
 {
     /* first get a count of the rtns */
     g->num_rtns = 0;
@@ -476,11 +722,13 @@ void load_rtns(struct bc_read_stream *s, struct gzl_grammar *g)
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
     }
 
     bc_rs_rewind_block(s);
-    g->rtns = malloc(g->num_rtns * sizeof(*g->rtns));
+    g->rtns = grammar_calloc(g, g->num_rtns, sizeof(*g->rtns));
+    if(!g->rtns)
+        return false;
     int rtn_offset = 0;
 
     while(1)
@@ -488,13 +736,515 @@ void load_rtns(struct bc_read_stream *s, struct gzl_grammar *g)
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == StartBlock && ri.id == BC_RTN)
         {
-            load_rtn(s, &g->rtns[rtn_offset++], g);
+            if(!load_rtn(s, &g->rtns[rtn_offset++], g, terminal_ids))
+                return false;
         }
         else if(ri.record_type == EndBlock)
             break;
         else
-            unexpected(s, ri);
+            return unexpected(s, ri);
+    }
+    return true;
+}
+
+/*
+ * build_rtn_terminal_tables(): gives every state of the RTN with more than
+ * GZL_MAX_SCANNED_TRANSITIONS terminal transitions a table of them indexed
+ * by terminal ID.  Terminal IDs are dense, so a table is never larger than
+ * the grammar's number of terminals, and IDs are handed out in the order
+ * the IntFAs name them, so terminals that are lexed together tend to be
+ * close.
+ */
+static
+bool build_rtn_terminal_tables(struct gzl_rtn *rtn, struct gzl_grammar *g)
+{
+    int total_size = 0;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        if(pass == 1 && total_size > 0)
+        {
+            rtn->terminal_tables =
+                grammar_calloc(g, total_size, sizeof(*rtn->terminal_tables));
+            if(!rtn->terminal_tables)
+                return false;
+        }
+        int offset = 0;
+
+        for(int i = 0; i < rtn->num_states; i++)
+        {
+            struct gzl_rtn_state *state = &rtn->states[i];
+            int num_terminals = 0;
+            int min_id = 0, max_id = 0;
+            for(int j = 0; j < state->num_transitions; j++)
+            {
+                struct gzl_rtn_transition *t = &state->transitions[j];
+                if(t->transition_type != GZL_TERMINAL_TRANSITION)
+                    continue;
+                if(num_terminals == 0 || t->terminal_id < min_id)
+                    min_id = t->terminal_id;
+                if(num_terminals == 0 || t->terminal_id > max_id)
+                    max_id = t->terminal_id;
+                num_terminals++;
+            }
+
+            state->terminal_table = NULL;
+            state->min_terminal_id = min_id;
+            state->terminal_table_size = 0;
+            if(num_terminals <= GZL_MAX_SCANNED_TRANSITIONS)
+                continue;
+
+            if(pass == 0)
+            {
+                total_size += max_id - min_id + 1;
+                continue;
+            }
+
+            state->terminal_table = &rtn->terminal_tables[offset];
+            state->terminal_table_size = max_id - min_id + 1;
+            offset += state->terminal_table_size;
+            for(int j = state->num_transitions - 1; j >= 0; j--)
+            {
+                /* Backwards, so the first of any duplicates wins, as it
+                 * does when scanning. */
+                struct gzl_rtn_transition *t = &state->transitions[j];
+                if(t->transition_type == GZL_TERMINAL_TRANSITION)
+                    state->terminal_table[t->terminal_id - min_id] = t;
+            }
+        }
     }
+    return true;
+}
+
+/*
+ * build_gla_transition_tables(): like build_rtn_terminal_tables(), for the
+ * nonfinal states of a GLA.
+ */
+static
+bool build_gla_transition_tables(struct gzl_gla *gla, struct gzl_grammar *g)
+{
+    int total_size = 0;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        if(pass == 1 && total_size > 0)
+        {
+            gla->transition_tables =
+                grammar_calloc(g, total_size, sizeof(*gla->transition_tables));
+            if(!gla->transition_tables)
+                return false;
+        }
+        int offset = 0;
+
+        for(int i = 0; i < gla->num_states; i++)
+        {
+            struct gzl_gla_state *state = &gla->states[i];
+            if(state->is_final)
+                continue;
+
+            struct gzl_nonfinal_info *nonfinal = &state->d.nonfinal;
+            int min_id = 0, max_id = 0;
+            for(int j = 0; j < nonfinal->num_transitions; j++)
+            {
+                int id = nonfinal->transitions[j].term_id;
+                if(j == 0 || id < min_id)
+                    min_id = id;
+                if(j == 0 || id > max_id)
+                    max_id = id;
+            }
+
+            nonfinal->table = NULL;
+            nonfinal->min_term_id = min_id;
+            nonfinal->table_size = 0;
+            if(nonfinal->num_transitions <= GZL_MAX_SCANNED_TRANSITIONS)
+                continue;
+
+            if(pass == 0)
+            {
+                total_size += max_id - min_id + 1;
+                continue;
+            }
+
+            nonfinal->table = &gla->transition_tables[offset];
+            nonfinal->table_size = max_id - min_id + 1;
+            offset += nonfinal->table_size;
+            for(int j = nonfinal->num_transitions - 1; j >= 0; j--)
+            {
+                struct gzl_gla_transition *t = &nonfinal->transitions[j];
+                nonfinal->table[t->term_id - min_id] = t;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * walk_descend_chain(): follows the chain of single nonterminal transitions
+ * that starts at state, storing them in chain if it is non-NULL.  Returns
+ * the length of the chain, or -1 if it is longer than max_len (which can
+ * only happen if it loops).
+ */
+static
+int walk_descend_chain(struct gzl_rtn_state *state, int max_len,
+                       struct gzl_rtn_transition **chain)
+{
+    int len = 0;
+    while(state->lookahead_type == GZL_STATE_HAS_NEITHER &&
+          state->num_transitions == 1)
+    {
+        struct gzl_rtn_transition *t = &state->transitions[0];
+        assert(t->transition_type == GZL_NONTERM_TRANSITION);
+        if(len == max_len)
+            return -1;
+        if(chain)
+            chain[len] = t;
+        len++;
+        state = &t->edge.nonterminal->states[0];
+    }
+    return len;
+}
+
+/*
+ * build_descend_chains(): precomputes, for every RTN state that has neither
+ * an IntFA nor a GLA, the nonterminal transitions the parser will push
+ * through before it needs lookahead again, so that run_parser() can
+ * push them all at once.  Every push but the first enters a rule's start
+ * state, so a chain longer than the number of rules must loop; such states
+ * get no chain and are descended one frame at a time.
+ */
+static
+bool build_descend_chains(struct gzl_grammar *g)
+{
+    int total_len = 0;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        if(pass == 1 && total_len > 0)
+        {
+            g->descend_transitions =
+                grammar_alloc(g, total_len * sizeof(*g->descend_transitions));
+            if(!g->descend_transitions)
+                return false;
+        }
+        int offset = 0;
+
+        for(int i = 0; i < g->num_rtns; i++)
+        {
+            struct gzl_rtn *rtn = &g->rtns[i];
+            for(int j = 0; j < rtn->num_states; j++)
+            {
+                struct gzl_rtn_state *state = &rtn->states[j];
+                int len = walk_descend_chain(state, g->num_rtns, NULL);
+                state->num_descend_transitions = 0;
+                state->descend_transitions = NULL;
+                if(len <= 0)
+                    continue;
+
+                if(pass == 0)
+                {
+                    total_len += len;
+                    continue;
+                }
+
+                state->descend_transitions = &g->descend_transitions[offset];
+                state->num_descend_transitions = len;
+                walk_descend_chain(state, len, state->descend_transitions);
+                offset += len;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * gla_is_ll1(): returns true if the given GLA of rtn_state decides on the
+ * first terminal alone: every transition out of its start state goes to a
+ * final state, and each final state that predicts a terminal transition
+ * was reached on that terminal.
+ */
+static
+bool gla_is_ll1(struct gzl_rtn_state *rtn_state, struct gzl_gla *gla)
+{
+    struct gzl_gla_state *start = &gla->states[0];
+    if(start->is_final || start->d.nonfinal.num_transitions == 0)
+        return false;
+
+    for(int i = 0; i < start->d.nonfinal.num_transitions; i++)
+    {
+        struct gzl_gla_transition *t = &start->d.nonfinal.transitions[i];
+        if(!t->dest_state->is_final)
+            return false;
+        int offset = t->dest_state->d.final.transition_offset;
+        if(offset > 0 &&
+           rtn_state->transitions[offset-1].transition_type ==
+               GZL_TERMINAL_TRANSITION &&
+           rtn_state->transitions[offset-1].terminal_id != t->term_id)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * build_ll1_tables(): replaces every GLA that only looks at one terminal
+ * with an LL(1) table on its RTN state, so that the parser can decide on a
+ * terminal as soon as it is lexed instead of pushing a GLA frame and
+ * buffering the terminal.
+ */
+static
+bool build_ll1_tables(struct gzl_grammar *g)
+{
+    int total_size = 0;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        if(pass == 1 && total_size > 0)
+        {
+            g->ll1_tables = grammar_alloc(g, total_size * sizeof(*g->ll1_tables));
+            if(!g->ll1_tables)
+                return false;
+        }
+        int offset = 0;
+
+        for(int i = 0; i < g->num_rtns; i++)
+        {
+            struct gzl_rtn *rtn = &g->rtns[i];
+            for(int j = 0; j < rtn->num_states; j++)
+            {
+                struct gzl_rtn_state *state = &rtn->states[j];
+                if(pass == 0)
+                {
+                    state->ll1_min_terminal_id = 0;
+                    state->ll1_table_size = 0;
+                    state->ll1_table = NULL;
+                }
+                if(state->lookahead_type != GZL_STATE_HAS_GLA ||
+                   !gla_is_ll1(state, state->d.state_gla))
+                    continue;
+
+                struct gzl_nonfinal_info *nonfinal =
+                    &state->d.state_gla->states[0].d.nonfinal;
+                int min_id = 0, max_id = 0;
+                for(int k = 0; k < nonfinal->num_transitions; k++)
+                {
+                    int id = nonfinal->transitions[k].term_id;
+                    if(k == 0 || id < min_id)
+                        min_id = id;
+                    if(k == 0 || id > max_id)
+                        max_id = id;
+                }
+
+                if(pass == 0)
+                {
+                    total_size += max_id - min_id + 1;
+                    continue;
+                }
+
+                state->ll1_table = &g->ll1_tables[offset];
+                state->ll1_min_terminal_id = min_id;
+                state->ll1_table_size = max_id - min_id + 1;
+                offset += state->ll1_table_size;
+                for(int k = 0; k < state->ll1_table_size; k++)
+                    state->ll1_table[k] = -1;
+                for(int k = nonfinal->num_transitions - 1; k >= 0; k--)
+                {
+                    struct gzl_gla_transition *t = &nonfinal->transitions[k];
+                    state->ll1_table[t->term_id - min_id] =
+                        t->dest_state->d.final.transition_offset;
+                }
+                state->lookahead_type = GZL_STATE_HAS_LL1_TABLE;
+                state->d.state_intfa = nonfinal->intfa;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * find_descend_intfa(): returns the IntFA the parser lexes with once it has
+ * descended from state, which has neither an IntFA nor a GLA: that of the
+ * first state it reaches that has one.  Returns NULL if the descent reaches
+ * a final state with no transitions (so a rule is empty) or loops.
+ */
+static
+struct gzl_intfa *find_descend_intfa(struct gzl_grammar *g,
+                                     struct gzl_rtn_state *state)
+{
+    /* Every step enters a rule's start state. */
+    for(int i = 0; i <= g->num_rtns; i++)
+    {
+        switch(state->lookahead_type)
+        {
+            case GZL_STATE_HAS_INTFA:
+            case GZL_STATE_HAS_LL1_TABLE:
+                return state->d.state_intfa;
+
+            case GZL_STATE_HAS_GLA:
+                if(state->d.state_gla->states[0].is_final)
+                    return NULL;
+                return state->d.state_gla->states[0].d.nonfinal.intfa;
+
+            case GZL_STATE_HAS_NEITHER:
+                if(state->num_transitions == 0)
+                    return NULL;
+                state = &state->transitions[0].edge.nonterminal->states[0];
+                break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * build_descend_intfas(): sets descend_intfa for every RTN state.  Runs
+ * after build_ll1_tables(), which changes where states keep their IntFAs.
+ */
+static
+void build_descend_intfas(struct gzl_grammar *g)
+{
+    for(int i = 0; i < g->num_rtns; i++)
+    {
+        struct gzl_rtn *rtn = &g->rtns[i];
+        for(int j = 0; j < rtn->num_states; j++)
+        {
+            struct gzl_rtn_state *state = &rtn->states[j];
+            state->descend_intfa = NULL;
+            if(state->lookahead_type == GZL_STATE_HAS_NEITHER &&
+               state->num_transitions == 1)
+                state->descend_intfa = find_descend_intfa(g, state);
+        }
+    }
+}
+
+/*
+ * decode_rtn_ops(): sets the op of every RTN state from its lookahead type
+ * and transitions.  Runs last, since build_descend_chains() and
+ * build_ll1_tables() both change what the parser does in a state.
+ */
+static
+void decode_rtn_ops(struct gzl_grammar *g)
+{
+    for(int i = 0; i < g->num_rtns; i++)
+    {
+        struct gzl_rtn *rtn = &g->rtns[i];
+        for(int j = 0; j < rtn->num_states; j++)
+        {
+            struct gzl_rtn_state *state = &rtn->states[j];
+            switch(state->lookahead_type)
+            {
+                case GZL_STATE_HAS_INTFA:
+                    state->op = GZL_RTN_OP_TERMINAL;
+                    break;
+
+                case GZL_STATE_HAS_LL1_TABLE:
+                    state->op = GZL_RTN_OP_LL1;
+                    break;
+
+                case GZL_STATE_HAS_GLA:
+                    state->op = GZL_RTN_OP_GLA;
+                    break;
+
+                case GZL_STATE_HAS_NEITHER:
+                    /* Either final with no transitions, or one nonterminal
+                     * transition; the chain is missing only if it loops. */
+                    assert(state->num_transitions < 2);
+                    if(state->num_descend_transitions > 0)
+                        state->op = GZL_RTN_OP_DESCEND;
+                    else if(state->num_transitions == 1)
+                    {
+                        assert(state->transitions[0].transition_type ==
+                               GZL_NONTERM_TRANSITION);
+                        state->op = GZL_RTN_OP_CALL;
+                    }
+                    else
+                        state->op = GZL_RTN_OP_RETURN;
+                    break;
+            }
+        }
+    }
+}
+
+/*
+ * walk_start_frames(): follows the parser from the start state of the start
+ * rule for as long as it can go without a terminal, storing the frames it
+ * pushes in frames if it is non-NULL.  Returns how many frames that is, or
+ * 0 if the parser would pop a frame on the way (so starting a parse is not
+ * just pushing frames) or would loop.
+ */
+static
+int walk_start_frames(struct gzl_grammar *g,
+                      struct gzl_parse_stack_frame *frames)
+{
+    struct gzl_rtn *rtn = &g->rtns[0];
+    struct gzl_rtn_state *state = &rtn->states[0];
+    int len = 0;
+    while(true)
+    {
+        /* Every frame but the first enters a rule's start state. */
+        if(len > g->num_rtns)
+            return 0;
+
+        if(frames)
+        {
+            frames[len].frame_type = GZL_FRAME_TYPE_RTN;
+            frames[len].f.rtn_frame.rtn = rtn;
+            frames[len].f.rtn_frame.rtn_state = state;
+            frames[len].f.rtn_frame.rtn_transition = NULL;
+        }
+        len++;
+
+        switch(state->op)
+        {
+            case GZL_RTN_OP_TERMINAL:
+            case GZL_RTN_OP_LL1:
+                return len;
+
+            case GZL_RTN_OP_GLA:
+                if(frames)
+                {
+                    struct gzl_gla *gla = state->d.state_gla;
+                    frames[len].frame_type = GZL_FRAME_TYPE_GLA;
+                    frames[len].f.gla_frame.gla = gla;
+                    frames[len].f.gla_frame.gla_state = &gla->states[0];
+                }
+                return len + 1;
+
+            case GZL_RTN_OP_RETURN:
+                return 0;
+
+            case GZL_RTN_OP_DESCEND:
+            case GZL_RTN_OP_CALL:
+            {
+                /* The parser waits for a terminal before descending (see
+                 * descend_intfa), unless the rule it goes into can be
+                 * empty. */
+                if(state->descend_intfa)
+                    return len;
+
+                /* A descend chain is just these transitions one at a time. */
+                struct gzl_rtn_transition *t = &state->transitions[0];
+                if(frames)
+                    frames[len - 1].f.rtn_frame.rtn_transition = t;
+                rtn = t->edge.nonterminal;
+                state = &rtn->states[0];
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * build_start_frames(): precomputes the frames that every parse starts with,
+ * so that gzl_parse() can copy them in.  Runs after decode_rtn_ops().
+ */
+static
+bool build_start_frames(struct gzl_grammar *g)
+{
+    g->num_start_frames = walk_start_frames(g, NULL);
+    g->start_frames = NULL;
+    if(g->num_start_frames > 0)
+    {
+        g->start_frames = grammar_alloc(g, g->num_start_frames *
+                                           sizeof(*g->start_frames));
+        if(!g->start_frames)
+            return false;
+        walk_start_frames(g, g->start_frames);
+    }
+    return true;
 }
 
 /*
@@ -503,21 +1253,51 @@ void load_rtns(struct bc_read_stream *s, struct gzl_grammar *g)
 
 struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s)
 {
-    struct gzl_grammar *g = malloc(sizeof(*g));
+    return gzl_load_grammar_with(s, NULL);
+}
 
-    while(1)
+struct gzl_grammar *gzl_load_grammar_with(struct bc_read_stream *s,
+                                          struct gzl_allocator *alloc)
+{
+    struct gzl_grammar *g = gzl_alloc(alloc, sizeof(*g));
+    if(g == NULL)
+        return NULL;
+
+    /* Everything starts out NULL, so that gzl_free_grammar() can free a
+     * grammar that we gave up on halfway. */
+    memset(g, 0, sizeof(*g));
+    g->alloc = alloc;
+    int *terminal_ids = NULL;
+    bool ok = true;
+
+    while(ok)
     {
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == StartBlock)
         {
             if(ri.id == BC_STRINGS)
-                g->strings = load_strings(s);
+            {
+                ok = load_strings(s, g);
+                if(!ok)
+                    break;
+
+                /* No grammar has more terminals than strings. */
+                int num_strings = 0;
+                while(g->strings[num_strings])
+                    num_strings++;
+                terminal_ids = calloc(num_strings+1, sizeof(*terminal_ids));
+                g->terminal_names = grammar_alloc(g, (num_strings+1) *
+                                                  sizeof(*g->terminal_names));
+                ok = terminal_ids && g->terminal_names;
+                if(ok)
+                    g->terminal_names[GZL_EOF_TERMINAL_ID] = NULL;
+            }
             else if(ri.id == BC_INTFAS)
-                load_intfas(s, g);
+                ok = load_intfas(s, g, terminal_ids);
             else if(ri.id == BC_GLAS)
-                load_glas(s, g);
+                ok = load_glas(s, g, terminal_ids);
             else if(ri.id == BC_RTNS)
-                load_rtns(s, g);
+                ok = load_rtns(s, g, terminal_ids);
             else
                 bc_rs_skip_block(s);
         }
@@ -526,52 +1306,81 @@ struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s)
             if(g->strings == NULL || g->num_intfas == 0 || g->num_rtns == 0)
             {
                 printf("Premature EOF!\n");
-                exit(1);
-            }
-            else
-            {
-                /* Success -- we finished loading! */
-                return g;
-                break;
+                ok = false;
             }
+            break;
         }
+        else if(ri.record_type == Err)
+            ok = unexpected(s, ri);
     }
+    free(terminal_ids);
 
-    free(g);
-    return NULL;
+    if(ok)
+    {
+        for(int i = 0; ok && i < g->num_rtns; i++)
+            ok = build_rtn_terminal_tables(&g->rtns[i], g);
+        for(int i = 0; ok && i < g->num_glas; i++)
+            ok = build_gla_transition_tables(&g->glas[i], g);
+        ok = ok && build_descend_chains(g) && build_ll1_tables(g);
+    }
+
+    if(ok)
+    {
+        /* Success -- we finished loading! */
+        build_descend_intfas(g);
+        decode_rtn_ops(g);
+        ok = build_start_frames(g);
+    }
+
+    if(!ok)
+    {
+        gzl_free_grammar(g);
+        return NULL;
+    }
+    return g;
 }
 
 void gzl_free_grammar(struct gzl_grammar *g)
 {
-    for(int i = 0; g->strings[i] != NULL; i++)
-        free(g->strings[i]);
-    free(g->strings); 
-
-    for(int i = 0; i < g->num_rtns; i++)
+    /* This also frees what gzl_load_grammar_with() had loaded when it gave
+     * up, so any of these arrays may be missing. */
+    for(int i = 0; g->strings && g->strings[i] != NULL; i++)
+        gzl_free(g->alloc, g->strings[i]);
+    gzl_free(g->alloc, g->strings);
+    gzl_free(g->alloc, g->terminal_names);
+
+    for(int i = 0; g->rtns && i < g->num_rtns; i++)
     {
         struct gzl_rtn *rtn = &g->rtns[i];
-        free(rtn->states);
-        free(rtn->transitions);
+        gzl_free(g->alloc, rtn->states);
+        gzl_free(g->alloc, rtn->transitions);
+        gzl_free(g->alloc, rtn->terminal_tables);
     }
-    free(g->rtns);
+    gzl_free(g->alloc, g->rtns);
+    gzl_free(g->alloc, g->descend_transitions);
+    gzl_free(g->alloc, g->ll1_tables);
+    gzl_free(g->alloc, g->start_frames);
 
-    for(int i = 0; i < g->num_glas; i++)
+    for(int i = 0; g->glas && i < g->num_glas; i++)
     {
         struct gzl_gla *gla = &g->glas[i];
-        free(gla->states);
-        free(gla->transitions);
+        gzl_free(g->alloc, gla->states);
+        gzl_free(g->alloc, gla->transitions);
+        gzl_free(g->alloc, gla->transition_tables);
     }
-    free(g->glas);
+    gzl_free(g->alloc, g->glas);
 
-    for(int i = 0; i < g->num_intfas; i++)
+    for(int i = 0; g->intfas && i < g->num_intfas; i++)
     {
         struct gzl_intfa *intfa = &g->intfas[i];
-        free(intfa->states);
-        free(intfa->transitions);
+        gzl_free(g->alloc, intfa->states);
+        gzl_free(g->alloc, intfa->transitions);
+        gzl_free(g->alloc, intfa->transition_table);
+        gzl_free(g->alloc, intfa->keywords);
     }
-    free(g->intfas);
+    gzl_free(g->alloc, g->intfas);
 
-    free(g);
+    gzl_free(g->alloc, g);
 }
 
 /*
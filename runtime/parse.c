@@ -2,14 +2,15 @@
 
   Gazelle: a system for building fast, reusable parsers
 
-  interpreter.c
+  parse.c
 
   Once a compiled grammar has been loaded into memory, the routines
-  in this file are what actually does the parsing.  This file is an
-  "interpreter" in the sense that it parses the input by using the
-  grammar as a data structure -- no grammar-specific code is ever
-  generated or executed.  Despite this, it is still quite fast, and
-  has a very low memory footprint.
+  in this file are what actually does the parsing.  They interpret the
+  grammar as a data structure: the RTNs (the rules) always, and the
+  IntFAs (the lexers) and GLAs (the lookahead automata) unless they
+  have been compiled to native code, by the JIT in jit.c or by
+  gzlc --emit-c.  Both of those only ever replace IntFAs and GLAs, so
+  the parse stack and the callbacks are always run from here.
 
   The interpreter primarily consists of maintaining the parse stack
   properly and transitioning the frames in response to the input.
@@ -22,6 +23,14 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "gazelle/parse.h"
 
@@ -33,8 +42,8 @@ void dump_stack(struct gzl_parse_state *s, FILE *output)
 {
     fprintf(output, "Stack dump:");
     struct gzl_grammar *g = s->bound_grammar->grammar;
-    for(int i = 0; i < s->parse_stack_len; i++) {
-        struct gzl_parse_stack_frame *frame = &s->parse_stack[i];
+    for(int i = 0; i < gzl_stack_depth(s); i++) {
+        struct gzl_parse_stack_frame *frame = gzl_stack_frame_at(s, i);
         switch(frame->frame_type) {
             case GZL_FRAME_TYPE_RTN: {
                 struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
@@ -47,14 +56,10 @@ void dump_stack(struct gzl_parse_state *s, FILE *output)
                 fprintf(output, "GLA: #%zd, ", gla_frame->gla - g->glas);
                 break;
             }
-
-            case GZL_FRAME_TYPE_INTFA: {
-                struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-                fprintf(output, "IntFA: #%zd, ", intfa_frame->intfa - g->intfas);
-                break;
-            }
         }
     }
+    if(s->intfa)
+        fprintf(output, "IntFA: #%zd, ", s->intfa - g->intfas);
     fprintf(output, "\n");
 }
 
@@ -64,59 +69,238 @@ void dump_stack(struct gzl_parse_state *s, FILE *output)
  * provide pushing and popping of different kinds of stack frames.
  */
 
+/*
+ * add_to_refcount(): adds n to the reference count of something that
+ * duplicated states share, and returns the new count.  Duplicated states
+ * may be used on different threads, so this is atomic where we can make it
+ * so.
+ */
+static inline
+int add_to_refcount(int *refcount, int n)
+{
+#if defined(__GNUC__)
+    return __sync_add_and_fetch(refcount, n);
+#else
+    return *refcount += n;
+#endif
+}
+
+/*
+ * retain_stack_segment(), release_stack_segment(): count the parse states
+ * (and segments) that use a shared segment of the stack, freeing it along
+ * with any segments under it that nothing else uses once the last one is
+ * done.
+ */
 static
-struct gzl_parse_stack_frame *push_empty_frame(struct gzl_parse_state *s,
-                                               enum gzl_frame_type frame_type,
-                                               struct gzl_offset *start_offset)
+void retain_stack_segment(struct gzl_stack_segment *seg)
 {
-    RESIZE_DYNARRAY(s->parse_stack, s->parse_stack_len+1);
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    frame->frame_type = frame_type;
-    frame->start_offset = *start_offset;
-    return frame;
+    add_to_refcount(&seg->refcount, 1);
 }
 
 static
-struct gzl_intfa_frame *push_intfa_frame(struct gzl_parse_state *s,
-                                         struct gzl_intfa *intfa,
-                                         struct gzl_offset *start_offset)
+void release_stack_segment(struct gzl_stack_segment *seg)
 {
-    struct gzl_parse_stack_frame *frame =
-        push_empty_frame(s, GZL_FRAME_TYPE_INTFA, start_offset);
-    struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-    intfa_frame->intfa        = intfa;
-    intfa_frame->intfa_state  = &intfa->states[0];
-    return intfa_frame;
+    while(seg) {
+        if(add_to_refcount(&seg->refcount, -1) > 0)
+            return;
+        struct gzl_stack_segment *below = seg->below;
+        gzl_free(seg->alloc, seg->frame_start_offsets);
+        gzl_free(seg->alloc, seg->frames);
+        gzl_free(seg->alloc, seg);
+        seg = below;
+    }
+}
+
+/* The segment that holds frame i of the shared stack (i < shared_stack_len). */
+static
+struct gzl_stack_segment *find_stack_segment(struct gzl_parse_state *s, int i)
+{
+    struct gzl_stack_segment *seg = s->shared_stack;
+    while(i < seg->below_len)
+        seg = seg->below;
+    return seg;
+}
+
+/*
+ * unshare_frames(): once a state has popped all of private_stack, copies the
+ * frames at the top of the shared stack into it (as many as it will take
+ * without growing, up to UNSHARE_FRAMES), and lets go of any segment it no
+ * longer needs.  The frame that was just popped, which was at the bottom of
+ * private_stack, is moved to just past the new top.
+ */
+#define UNSHARE_FRAMES 16
+static
+void unshare_frames(struct gzl_parse_state *s)
+{
+    struct gzl_stack_segment *seg = s->shared_stack;
+    int n = s->shared_stack_len - seg->below_len;
+    if(n > UNSHARE_FRAMES)
+        n = UNSHARE_FRAMES;
+    if(n > s->private_stack_size - 1)
+        n = s->private_stack_size - 1;
+
+    s->private_stack[n] = s->private_stack[0];
+    s->private_start_offsets[n] = s->private_start_offsets[0];
+    int first = s->shared_stack_len - n - seg->below_len;
+    memcpy(s->private_stack, &seg->frames[first],
+           n * sizeof(*s->private_stack));
+    memcpy(s->private_start_offsets, &seg->frame_start_offsets[first],
+           n * sizeof(*s->private_start_offsets));
+    s->private_stack_len = n;
+    s->shared_stack_len -= n;
+
+    if(s->shared_stack_len == seg->below_len) {
+        s->shared_stack = seg->below;
+        if(seg->below)
+            retain_stack_segment(seg->below);
+        release_stack_segment(seg);
+    }
+}
+
+/*
+ * resize_parse_stack(): sets the length of the private stack, growing
+ * private_start_offsets along with it.  Returns false if there is no memory to
+ * grow them, in which case the stack is as it was.
+ */
+static
+bool resize_parse_stack(struct gzl_parse_state *s, int len)
+{
+    int size = s->private_stack_size;
+    while(size < len)
+        size *= 2;
+    if(size != s->private_stack_size) {
+        /* Growing private_start_offsets first keeps it at least as big as the
+         * stack even if the stack cannot grow. */
+        struct gzl_offset *offsets =
+            gzl_realloc(s->alloc, s->private_start_offsets,
+                        s->private_stack_size * sizeof(*offsets),
+                        size * sizeof(*offsets));
+        if(!offsets)
+            return false;
+        s->private_start_offsets = offsets;
+    }
+    bool ok;
+    RESIZE_DYNARRAY_IN(s->alloc, s->private_stack, len, ok);
+    return ok;
+}
+
+static
+struct gzl_parse_stack_frame *push_empty_frame(struct gzl_parse_state *s,
+                                               enum gzl_frame_type frame_type)
+{
+    if(!resize_parse_stack(s, s->private_stack_len+1))
+        return NULL;
+    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->private_stack);
+    frame->frame_type = frame_type;
+    return frame;
 }
 
 static
 struct gzl_parse_stack_frame *push_gla_frame(struct gzl_parse_state *s,
-                                             struct gzl_gla *gla,
-                                             struct gzl_offset *start_offset)
+                                             struct gzl_gla *gla)
 {
     struct gzl_parse_stack_frame *frame =
-        push_empty_frame(s, GZL_FRAME_TYPE_GLA, start_offset);
+        push_empty_frame(s, GZL_FRAME_TYPE_GLA);
+    if(!frame)
+        return NULL;
     struct gzl_gla_frame *gla_frame = &frame->f.gla_frame;
     gla_frame->gla          = gla;
     gla_frame->gla_state    = &gla->states[0];
     return frame;
 }
 
+/*
+ * rule_subscribed(), terminal_subscribed(): whether the bound grammar's
+ * callbacks are to hear about this rule or terminal (see rule_subscribed in
+ * struct gzl_bound_grammar).  Both are true if there is no subscription.
+ */
+static inline
+bool rule_subscribed(struct gzl_bound_grammar *bg, struct gzl_rtn *rtn)
+{
+    return !bg->rule_subscribed ||
+           bg->rule_subscribed[rtn - bg->grammar->rtns];
+}
+
+static inline
+bool terminal_subscribed(struct gzl_bound_grammar *bg, int terminal_id)
+{
+    return !bg->terminal_subscribed || bg->terminal_subscribed[terminal_id];
+}
+
+/*
+ * record_event(): appends an event to the event tape, or to tape_overflow if
+ * the tape is full (see gzl_set_event_tape()).  Returns false if there is no
+ * memory to grow tape_overflow.
+ */
+static
+struct gzl_event *overflow_event(struct gzl_parse_state *s)
+{
+    bool ok;
+    RESIZE_DYNARRAY_IN(s->alloc, s->tape_overflow, s->tape_overflow_len+1, ok);
+    return ok ? DYNARRAY_GET_TOP(s->tape_overflow) : NULL;
+}
+
+static inline
+bool record_event(struct gzl_parse_state *s, enum gzl_event_kind kind,
+                  int id, size_t offset, size_t len)
+{
+    struct gzl_event *event = s->tape_len < s->tape_size ?
+                              &s->tape[s->tape_len++] : overflow_event(s);
+    if(!event)
+        return false;
+    event->kind = kind;
+    event->id = id;
+    event->offset = offset;
+    event->len = len;
+    return true;
+}
+
+/*
+ * BEFORE_CALLBACK(): makes a callback that comes before what it reports,
+ * unless s is a copy made in that callback (see gzl_dup_parse_state()) that
+ * has got back to it, which must not make it twice.  CALLBACK_AT() makes
+ * any other callback that a copy made in it has to know about.
+ */
+#define BEFORE_CALLBACK(s, call) \
+    do { \
+        if((s)->callback == GZL_BEFORE_CALLBACK) \
+            (s)->callback = GZL_NO_CALLBACK; \
+        else \
+            CALLBACK_AT(s, GZL_BEFORE_CALLBACK, call); \
+    } while(0)
+
+#define CALLBACK_AT(s, point, call) \
+    do { \
+        (s)->callback = point; \
+        call; \
+        (s)->callback = GZL_NO_CALLBACK; \
+    } while(0)
+
 static
 enum gzl_status push_rtn_frame(struct gzl_parse_state *s,
                                struct gzl_rtn *rtn,
                                struct gzl_offset *start_offset)
 {
-    if(s->bound_grammar->will_start_rule_cb)
-        s->bound_grammar->will_start_rule_cb(s, rtn, start_offset);
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    bool subscribed = rule_subscribed(bg, rtn);
+    if(bg->will_start_rule_cb && subscribed && !s->tape)
+        BEFORE_CALLBACK(s, bg->will_start_rule_cb(s, rtn, start_offset));
     struct gzl_parse_stack_frame *new_frame =
-        push_empty_frame(s, GZL_FRAME_TYPE_RTN, start_offset);
+        push_empty_frame(s, GZL_FRAME_TYPE_RTN);
+    if(!new_frame)
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    *GZL_FRAME_START_OFFSET(s, new_frame) = *start_offset;
     struct gzl_rtn_frame *new_rtn_frame = &new_frame->f.rtn_frame;
     new_rtn_frame->rtn            = rtn;
     new_rtn_frame->rtn_transition = NULL;
     new_rtn_frame->rtn_state      = &new_rtn_frame->rtn->states[0];
-    if(s->bound_grammar->did_start_rule_cb)
-        s->bound_grammar->did_start_rule_cb(s);
+    if(s->tape && subscribed) {
+        if(!record_event(s, GZL_EVENT_START_RULE, rtn - bg->grammar->rtns,
+                         start_offset->byte, 0))
+            return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    }
+    else if(bg->did_start_rule_cb && subscribed)
+        bg->did_start_rule_cb(s);
     return GZL_STATUS_OK;
 }
 
@@ -126,28 +310,162 @@ enum gzl_status push_rtn_frame_for_transition(struct gzl_parse_state *s,
                                               struct gzl_offset *start_offset)
 {
     struct gzl_rtn_frame *old_rtn_frame =
-        &DYNARRAY_GET_TOP(s->parse_stack)->f.rtn_frame;
+        &DYNARRAY_GET_TOP(s->private_stack)->f.rtn_frame;
     old_rtn_frame->rtn_transition = t;
     return push_rtn_frame(s, t->edge.nonterminal, start_offset);
 }
 
+/*
+ * push_rtn_frames_for_descent(): pushes an RTN frame for every transition in
+ * rtn_state's descend chain (see build_descend_chains()), firing the same
+ * callbacks in the same order as pushing them one at a time would.
+ *
+ * Preconditions:
+ * - the current frame is an RTN frame whose state is rtn_state, and
+ *   rtn_state->num_descend_transitions > 0
+ *
+ * Postconditions:
+ * - the current frame is the RTN frame for the start state of the last rule
+ *   in the chain, which has an IntFA or a GLA or is final with no
+ *   transitions.
+ */
+static
+enum gzl_status push_rtn_frames_for_descent(struct gzl_parse_state *s,
+                                            struct gzl_rtn_state *rtn_state,
+                                            struct gzl_offset *start_offset)
+{
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    int base_len = s->private_stack_len;
+    int n = rtn_state->num_descend_transitions;
+
+    /* The same limit run_parser() checks, applied to the whole chain. */
+    if(s->shared_stack_len + base_len + n >= s->max_stack_depth)
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+
+    /* Grow the stack once for the whole chain, then push into it a frame at
+     * a time so that callbacks see the stack they always have. */
+    if(!resize_parse_stack(s, base_len + n))
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    s->private_stack_len = base_len;
+
+    for(int i = 0; i < n; i++)
+    {
+        struct gzl_rtn_transition *t = rtn_state->descend_transitions[i];
+        struct gzl_rtn *rtn = t->edge.nonterminal;
+        DYNARRAY_GET_TOP(s->private_stack)->f.rtn_frame.rtn_transition = t;
+
+        bool subscribed = rule_subscribed(bg, rtn);
+        if(bg->will_start_rule_cb && subscribed && !s->tape)
+            BEFORE_CALLBACK(s, bg->will_start_rule_cb(s, rtn, start_offset));
+        struct gzl_parse_stack_frame *frame =
+            &s->private_stack[s->private_stack_len++];
+        frame->frame_type = GZL_FRAME_TYPE_RTN;
+        *GZL_FRAME_START_OFFSET(s, frame) = *start_offset;
+        frame->f.rtn_frame.rtn            = rtn;
+        frame->f.rtn_frame.rtn_transition = NULL;
+        frame->f.rtn_frame.rtn_state      = &rtn->states[0];
+        if(s->tape && subscribed) {
+            if(!record_event(s, GZL_EVENT_START_RULE, rtn - bg->grammar->rtns,
+                             start_offset->byte, 0))
+                return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+        }
+        else if(bg->did_start_rule_cb && subscribed)
+            bg->did_start_rule_cb(s);
+    }
+    return GZL_STATUS_OK;
+}
+
+/*
+ * push_start_frames(): pushes the grammar's start frames (see
+ * build_start_frames()) for a parse that is just starting, firing the same
+ * callbacks in the same order as running the parser to push them would.
+ *
+ * Preconditions:
+ * - the stack is empty, and the grammar has start frames
+ */
+static
+enum gzl_status push_start_frames(struct gzl_parse_state *s)
+{
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    struct gzl_parse_stack_frame *start_frames = bg->grammar->start_frames;
+    int n = bg->grammar->num_start_frames;
+
+    if(!resize_parse_stack(s, n))
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+
+    /* If nobody is told about the rules starting, this is all there is. */
+    if(!s->tape && !bg->will_start_rule_cb && !bg->did_start_rule_cb) {
+        memcpy(s->private_stack, start_frames, n * sizeof(*start_frames));
+        for(int i = 0; i < n; i++)
+            s->private_start_offsets[i] = s->offset;
+        return GZL_STATUS_OK;
+    }
+
+    /* Otherwise push them a frame at a time, so that callbacks see the stack
+     * they always have. */
+    s->private_stack_len = 0;
+    for(int i = 0; i < n; i++)
+    {
+        if(i > 0)
+            DYNARRAY_GET_TOP(s->private_stack)->f.rtn_frame.rtn_transition =
+                start_frames[i - 1].f.rtn_frame.rtn_transition;
+        if(start_frames[i].frame_type == GZL_FRAME_TYPE_GLA) {
+            s->private_stack[s->private_stack_len++] = start_frames[i];
+            continue;
+        }
+
+        struct gzl_rtn *rtn = start_frames[i].f.rtn_frame.rtn;
+        bool subscribed = rule_subscribed(bg, rtn);
+        if(bg->will_start_rule_cb && subscribed && !s->tape)
+            BEFORE_CALLBACK(s, bg->will_start_rule_cb(s, rtn, &s->offset));
+        struct gzl_parse_stack_frame *frame =
+            &s->private_stack[s->private_stack_len++];
+        *frame = start_frames[i];
+        frame->f.rtn_frame.rtn_transition = NULL;
+        *GZL_FRAME_START_OFFSET(s, frame) = s->offset;
+        if(s->tape && subscribed) {
+            if(!record_event(s, GZL_EVENT_START_RULE, rtn - bg->grammar->rtns,
+                             s->offset.byte, 0))
+                return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+        }
+        else if(bg->did_start_rule_cb && subscribed)
+            bg->did_start_rule_cb(s);
+    }
+    return GZL_STATUS_OK;
+}
+
 static
 struct gzl_parse_stack_frame *pop_frame(struct gzl_parse_state *s)
 {
-    assert(s->parse_stack_len > 0);
-    RESIZE_DYNARRAY(s->parse_stack, s->parse_stack_len-1);
-    return s->parse_stack_len > 0 ? DYNARRAY_GET_TOP(s->parse_stack) : NULL;
+    assert(s->private_stack_len > 0);
+    SHRINK_DYNARRAY(s->private_stack, s->private_stack_len-1);
+    if(s->private_stack_len == 0 && s->shared_stack_len > 0)
+        unshare_frames(s);
+    return s->private_stack_len > 0 ?
+           DYNARRAY_GET_TOP(s->private_stack) : NULL;
 }
 
 static
 enum gzl_status pop_rtn_frame(struct gzl_parse_state *s)
 {
-    struct gzl_parse_stack_frame *end_frame = DYNARRAY_GET_TOP(s->parse_stack);
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    struct gzl_parse_stack_frame *end_frame =
+        DYNARRAY_GET_TOP(s->private_stack);
     assert(end_frame->frame_type == GZL_FRAME_TYPE_RTN);
-    if(s->bound_grammar->will_end_rule_cb)
-      s->bound_grammar->will_end_rule_cb(s);
+    bool subscribed = rule_subscribed(bg, end_frame->f.rtn_frame.rtn);
+    if(s->tape && subscribed) {
+      size_t start = GZL_FRAME_START_OFFSET(s, end_frame)->byte;
+      if(!record_event(s, GZL_EVENT_END_RULE,
+                       end_frame->f.rtn_frame.rtn - bg->grammar->rtns,
+                       start, s->offset.byte - start))
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    }
+    else if(bg->will_end_rule_cb && subscribed)
+      BEFORE_CALLBACK(s, bg->will_end_rule_cb(s));
 
+    /* Popping can move the frame (see pop_frame()). */
     struct gzl_parse_stack_frame *frame = pop_frame(s);
+    end_frame = &s->private_stack[s->private_stack_len];
     if(frame) {
         assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
         struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
@@ -155,14 +473,16 @@ enum gzl_status pop_rtn_frame(struct gzl_parse_state *s)
             rtn_frame->rtn_state = rtn_frame->rtn_transition->dest_state;
         else {
           /* Should only happen at the top level. */
-          assert(s->parse_stack_len == 1);
+          assert(s->private_stack_len == 1);
         }
-        if(s->bound_grammar->did_end_rule_cb)
-          s->bound_grammar->did_end_rule_cb(s, end_frame);
+        if(bg->did_end_rule_cb && subscribed && !s->tape)
+          CALLBACK_AT(s, GZL_DID_END_RULE_CALLBACK,
+                      bg->did_end_rule_cb(s, end_frame));
         return GZL_STATUS_OK;
     } else {
-        if(s->bound_grammar->did_end_rule_cb)
-          s->bound_grammar->did_end_rule_cb(s, end_frame);
+        if(bg->did_end_rule_cb && subscribed && !s->tape)
+          CALLBACK_AT(s, GZL_DID_END_RULE_CALLBACK,
+                      bg->did_end_rule_cb(s, end_frame));
         return GZL_STATUS_HARD_EOF;
     }
 }
@@ -170,91 +490,37 @@ enum gzl_status pop_rtn_frame(struct gzl_parse_state *s)
 static
 struct gzl_parse_stack_frame *pop_gla_frame(struct gzl_parse_state *s)
 {
-    assert(DYNARRAY_GET_TOP(s->parse_stack)->frame_type == GZL_FRAME_TYPE_GLA);
-    return pop_frame(s);
-}
-
-static
-struct gzl_parse_stack_frame *pop_intfa_frame(struct gzl_parse_state *s)
-{
-    assert(DYNARRAY_GET_TOP(s->parse_stack)->frame_type ==
-           GZL_FRAME_TYPE_INTFA);
+    assert(DYNARRAY_GET_TOP(s->private_stack)->frame_type ==
+           GZL_FRAME_TYPE_GLA);
     return pop_frame(s);
 }
 
 /*
- * descend_to_gla(): given the current parse stack, pushes any RTN or GLA
- * stack frames representing transitions that can be taken without consuming
- * any terminals.
- *
- * Preconditions:
- * - the current frame is either an RTN frame or a GLA frame
- *
- * Postconditions:
- * - the current frame is an RTN frame or a GLA frame.  If a new GLA frame was
- *   entered, entered_gla is set to true.
+ * start_intfa_for_gla_or_rtn(): starts the lexer on the next terminal, at
+ * s->offset, with the IntFA of the GLA or RTN state on top of the stack.
  */
 static
-enum gzl_status descend_to_gla(struct gzl_parse_state *s, bool *entered_gla,
-                               struct gzl_offset *start_offset)
-{
-    *entered_gla = false;
-    while(true) {
-        struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-        if(frame->frame_type != GZL_FRAME_TYPE_RTN) return GZL_STATUS_OK;
-
-        /* Subtract 1 because there can be one IntFA frame beyond the RTN and
-         * GLA frames this function pushes. */
-        if(s->parse_stack_len >= s->max_stack_depth-1)
-            return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
-
-        struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-        switch(rtn_frame->rtn_state->lookahead_type) {
-          case GZL_STATE_HAS_INTFA:
-            return GZL_STATUS_OK;
-
-          case GZL_STATE_HAS_GLA:
-            *entered_gla = true;
-            push_gla_frame(s, rtn_frame->rtn_state->d.state_gla, start_offset);
-            return GZL_STATUS_OK;
-
-          case GZL_STATE_HAS_NEITHER:
-            /* An RTN state has neither an IntFA or a GLA in only two cases:
-             * - it is a final state with no outgoing transitions
-             * - it is a nonfinal state with only one transition (a nonterminal)
-             */
-            assert(rtn_frame->rtn_state->num_transitions < 2);
-            enum gzl_status status = GZL_STATUS_OK;
-            if(rtn_frame->rtn_state->num_transitions == 0)
-                status = pop_rtn_frame(s); /* Final state */
-            else if(rtn_frame->rtn_state->num_transitions == 1) {
-                assert(rtn_frame->rtn_state->transitions[0].transition_type ==
-                       GZL_NONTERM_TRANSITION);
-                status = push_rtn_frame_for_transition(
-                    s, &rtn_frame->rtn_state->transitions[0], start_offset);
-            }
-            if(status != GZL_STATUS_OK) return status;
-            break;
-        }
-    }
-}
-
-static
-struct gzl_intfa_frame *push_intfa_frame_for_gla_or_rtn(
-    struct gzl_parse_state *s)
+void start_intfa_for_gla_or_rtn(struct gzl_parse_state *s)
 {
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
+    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->private_stack);
     if(frame->frame_type == GZL_FRAME_TYPE_GLA) {
         struct gzl_gla_state *gla_state = frame->f.gla_frame.gla_state;
         assert(gla_state->is_final == false);
-        return push_intfa_frame(s, gla_state->d.nonfinal.intfa, &s->offset);
-    } else if(frame->frame_type == GZL_FRAME_TYPE_RTN) {
+        s->intfa = gla_state->d.nonfinal.intfa;
+    } else {
         struct gzl_rtn_state *rtn_state = frame->f.rtn_frame.rtn_state;
-        assert(rtn_state->lookahead_type == GZL_STATE_HAS_INTFA);
-        return push_intfa_frame(s, rtn_state->d.state_intfa, &s->offset);
+        if(rtn_state->lookahead_type == GZL_STATE_HAS_NEITHER) {
+            /* The parser is waiting to descend (see run_parser()). */
+            assert(rtn_state->descend_intfa);
+            s->intfa = rtn_state->descend_intfa;
+        } else {
+            assert(rtn_state->lookahead_type == GZL_STATE_HAS_INTFA ||
+                   rtn_state->lookahead_type == GZL_STATE_HAS_LL1_TABLE);
+            s->intfa = rtn_state->d.state_intfa;
+        }
     }
-    assert(false);  /* should never reach here. */
-    return NULL;
+    s->intfa_state = &s->intfa->states[0];
+    s->intfa_start_offset = s->offset;
 }
 
 static
@@ -262,14 +528,23 @@ enum gzl_status do_rtn_terminal_transition(struct gzl_parse_state *s,
                                            struct gzl_rtn_transition *t,
                                            struct gzl_terminal *terminal)
 {
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
+    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->private_stack);
     assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
     struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
     rtn_frame->rtn_transition = t;
-    if(s->bound_grammar->terminal_cb)
-      s->bound_grammar->terminal_cb(s, terminal);
+    /* Take the transition before reporting it, so that a copy made in
+     * terminal_cb carries on after it. */
     assert(t->transition_type == GZL_TERMINAL_TRANSITION);
     rtn_frame->rtn_state = t->dest_state;
+    if(terminal_subscribed(s->bound_grammar, terminal->id)) {
+      if(s->tape) {
+        if(!record_event(s, GZL_EVENT_TERMINAL, terminal->id,
+                         terminal->offset.byte, terminal->len))
+          return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+      }
+      else if(s->bound_grammar->terminal_cb)
+        s->bound_grammar->terminal_cb(s, terminal);
+    }
     return GZL_STATUS_OK;
 }
 
@@ -277,10 +552,16 @@ static
 struct gzl_rtn_transition *find_rtn_terminal_transition(
     struct gzl_rtn_state *rtn_state, struct gzl_terminal *terminal)
 {
+    if(rtn_state->terminal_table) {
+        unsigned int slot = terminal->id - rtn_state->min_terminal_id;
+        if(slot < (unsigned int)rtn_state->terminal_table_size)
+            return rtn_state->terminal_table[slot];
+        return NULL;
+    }
     for(int i = 0; i < rtn_state->num_transitions; i++) {
         struct gzl_rtn_transition *t = &rtn_state->transitions[i];
         if(t->transition_type == GZL_TERMINAL_TRANSITION &&
-           t->edge.terminal_name == terminal->name)
+           t->terminal_id == terminal->id)
             return t;
     }
     return NULL;
@@ -288,26 +569,70 @@ struct gzl_rtn_transition *find_rtn_terminal_transition(
 
 static
 struct gzl_gla_transition *find_gla_transition(struct gzl_gla_state *gla_state,
-                                               char *term_name)
+                                               int term_id)
 {
-    for(int i = 0; i < gla_state->d.nonfinal.num_transitions; i++) {
-        struct gzl_gla_transition *t = &gla_state->d.nonfinal.transitions[i];
-        if(t->term == term_name)
+    struct gzl_nonfinal_info *nonfinal = &gla_state->d.nonfinal;
+    if(nonfinal->table) {
+        unsigned int slot = term_id - nonfinal->min_term_id;
+        if(slot < (unsigned int)nonfinal->table_size)
+            return nonfinal->table[slot];
+        return NULL;
+    }
+    for(int i = 0; i < nonfinal->num_transitions; i++) {
+        struct gzl_gla_transition *t = &nonfinal->transitions[i];
+        if(t->term_id == term_id)
             return t;
     }
     return NULL;
 }
 
+/*
+ * find_intfa_dest_state(): returns the state the IntFA moves to on this
+ * byte, or NULL if there is no transition.  This is a lookup of the byte's
+ * class followed by a lookup in the dense transition table that
+ * gzl_load_grammar() builds for every state.
+ */
+static inline
+struct gzl_intfa_state *find_intfa_dest_state(
+    struct gzl_intfa *intfa, struct gzl_intfa_state *intfa_state, char ch)
+{
+    return intfa_state->next_state[intfa->byte_class[(unsigned char)ch]];
+}
+
+/*
+ * The token buffer is a ring; see the comment on token_buffer in parse.h.
+ * buffered_terminal() returns the i-th terminal in it, counting from the
+ * oldest.
+ */
+static inline
+struct gzl_terminal *buffered_terminal(struct gzl_parse_state *s, int i)
+{
+    return &s->token_buffer[(s->token_buffer_head + i) &
+                            (s->token_buffer_size - 1)];
+}
+
+/*
+ * append_terminal(): adds a slot to the end of the token buffer, doubling
+ * it if it is full, and returns the slot (or NULL if there is no memory to
+ * double it).
+ */
 static
-struct gzl_intfa_transition *find_intfa_transition(
-    struct gzl_intfa_state *intfa_state, char ch)
+struct gzl_terminal *append_terminal(struct gzl_parse_state *s)
 {
-    for(int i = 0; i < intfa_state->num_transitions; i++) {
-        struct gzl_intfa_transition *t = &intfa_state->transitions[i];
-        if(ch >= t->ch_low && ch <= t->ch_high)
-            return t;
+    if(s->token_buffer_len == s->token_buffer_size) {
+        /* Unwrap the ring into the new buffer, oldest terminal first. */
+        int size = s->token_buffer_size * 2;
+        struct gzl_terminal *buf = gzl_alloc(s->alloc, size * sizeof(*buf));
+        if(!buf)
+            return NULL;
+        for(int i = 0; i < s->token_buffer_len; i++)
+            buf[i] = *buffered_terminal(s, i);
+        gzl_free(s->alloc, s->token_buffer);
+        s->token_buffer = buf;
+        s->token_buffer_head = 0;
+        s->token_buffer_size = size;
     }
-    return NULL;
+    return buffered_terminal(s, s->token_buffer_len++);
 }
 
 /*
@@ -328,18 +653,29 @@ enum gzl_status do_gla_transition(struct gzl_parse_state *s,
                                         struct gzl_terminal *term,
                                         int *rtn_term_offset)
 {
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
+    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->private_stack);
     assert(frame->frame_type == GZL_FRAME_TYPE_GLA);
     assert(frame->f.gla_frame.gla_state->is_final == false);
     struct gzl_gla_state *gla_state = frame->f.gla_frame.gla_state;
     struct gzl_gla_state *dest_gla_state = NULL;
 
-    /* Find the transition. */
-    struct gzl_gla_transition *t = find_gla_transition(gla_state, term->name);
+    /* Find the transition, with the GLA's generated or native code if it
+     * has some. */
+    struct gzl_gla_transition *t;
+    struct gzl_gla *gla = frame->f.gla_frame.gla;
+    struct gzl_jit *jit = s->bound_grammar->jit;
+    if(gla->decide)
+        t = gla->decide(gla, gla_state, term->id);
+    else if(jit)
+        t = jit->glas[gla - s->bound_grammar->grammar->glas](
+            gla_state - gla->states, term->id);
+    else
+        t = find_gla_transition(gla_state, term->id);
     if(!t) {
         /* Parse error: terminal for which we had no GLA transition. */
         if(s->bound_grammar->error_terminal_cb)
-            s->bound_grammar->error_terminal_cb(s, term);
+            CALLBACK_AT(s, GZL_ERROR_CALLBACK,
+                        s->bound_grammar->error_terminal_cb(s, term));
         return GZL_STATUS_ERROR;
     }
     /* Perform the transition. */
@@ -359,13 +695,12 @@ enum gzl_status do_gla_transition(struct gzl_parse_state *s,
         else {
             struct gzl_rtn_state *rtn_state = frame->f.rtn_frame.rtn_state;
             struct gzl_rtn_transition *t = &rtn_state->transitions[offset-1];
-            struct gzl_terminal *next_term = &s->token_buffer[*rtn_term_offset];
+            struct gzl_terminal *next_term =
+                buffered_terminal(s, *rtn_term_offset);
             if(t->transition_type == GZL_TERMINAL_TRANSITION) {
-                /* The transition must match what we have in the token buffer */
-                //assert(next_term->name == t->edge.terminal_name);
-                if (next_term->name != t->edge.terminal_name) {
-                  return GZL_STATUS_ERROR;
-                }
+                /* A GLA only predicts a terminal transition on that
+                 * terminal, which is the next one in the token buffer. */
+                assert(next_term->id == t->terminal_id);
                 (*rtn_term_offset)++;
                 status = do_rtn_terminal_transition(s, t, next_term);
             } else
@@ -377,96 +712,221 @@ enum gzl_status do_gla_transition(struct gzl_parse_state *s,
 }
 
 /*
- * process_terminal(): processes a terminal that was just lexed, possibly
- * triggering a series of RTN and/or GLA transitions.
+ * do_ll1_transition(): decides what to do in an RTN state that has an LL(1)
+ * table in place of a GLA, on the next terminal in the token buffer, and
+ * does it: returns from the rule, takes a terminal transition (consuming the
+ * terminal), or pushes a frame for a nonterminal transition.
  *
  * Preconditions:
- * - the current stack frame is an intfa frame representing the intfa that
- *   just produced this terminal
- * - the given terminal can be recognized by the current GLA or RTN state
- *
- * Postconditions:
- * - the current stack frame is an GLA or RTN frame representing the state after
- *   all available GLA and RTN transitions have been taken.
+ * - the current stack frame is an RTN frame in the state rtn_state, which is
+ *   GZL_STATE_HAS_LL1_TABLE
+ * - term is the terminal at *rtn_term_offset in the token buffer
  */
-
 static
-enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
-                                 struct gzl_offset *start_offset, int len)
+enum gzl_status do_ll1_transition(struct gzl_parse_state *s,
+                                  struct gzl_rtn_state *rtn_state,
+                                  struct gzl_terminal *term,
+                                  int *rtn_term_offset)
 {
-    pop_intfa_frame(s);
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    int rtn_term_offset = 0;
-    int gla_term_offset = s->token_buffer_len;
-
-    RESIZE_DYNARRAY(s->token_buffer, s->token_buffer_len+1);
-    if(s->token_buffer_len >= s->max_lookahead)
-        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    unsigned int slot = term->id - rtn_state->ll1_min_terminal_id;
+    int offset = -1;
+    if(slot < (unsigned int)rtn_state->ll1_table_size)
+        offset = rtn_state->ll1_table[slot];
 
-    struct gzl_terminal *term = DYNARRAY_GET_TOP(s->token_buffer);
-    term->name = term_name;
-    term->offset = *start_offset;
-    term->len = len;
+    if(offset < 0) {
+        /* Parse error: terminal the GLA would have had no transition for. */
+        if(s->bound_grammar->error_terminal_cb)
+            CALLBACK_AT(s, GZL_ERROR_CALLBACK,
+                        s->bound_grammar->error_terminal_cb(s, term));
+        return GZL_STATUS_ERROR;
+    } else if(offset == 0) {
+        return pop_rtn_frame(s);
+    }
 
-    /* Feed tokens to RTNs and GLAs until we have processed all the tokens we
-     * have. */
-    enum gzl_status status = GZL_STATUS_OK;
-    enum gzl_frame_type frame_type = frame->frame_type;
-    do {
-        /* Take one terminal transition, for either an RTN or a GLA. */
-        if(frame_type == GZL_FRAME_TYPE_RTN) {
-            struct gzl_terminal *rtn_term = &s->token_buffer[rtn_term_offset];
-            struct gzl_rtn_transition *t;
-            rtn_term_offset++;
-
-            if(rtn_term->name == NULL)
-                /* Skip: RTNs don't process EOF as a terminal, only GLAs do. */
-                continue;
-            t = find_rtn_terminal_transition(frame->f.rtn_frame.rtn_state,
-                                             rtn_term);
-            if(!t) {
-                /* Parse error: terminal for which we had no RTN transition. */
-                if(s->bound_grammar->error_terminal_cb)
-                    s->bound_grammar->error_terminal_cb(s, term);
-                return GZL_STATUS_ERROR;
-            }
-            status = do_rtn_terminal_transition(s, t, rtn_term);
-        } else {
-            struct gzl_terminal *gla_term = &s->token_buffer[gla_term_offset++];
-            status = do_gla_transition(s, gla_term, &rtn_term_offset);
-        }
+    struct gzl_rtn_transition *t = &rtn_state->transitions[offset-1];
+    if(t->transition_type == GZL_TERMINAL_TRANSITION) {
+        (*rtn_term_offset)++;
+        return do_rtn_terminal_transition(s, t, term);
+    } else {
+        return push_rtn_frame_for_transition(s, t, &term->offset);
+    }
+}
 
-        /* Having taken a transition, push any new frames onto the stack. */
-        if(status == GZL_STATUS_OK) {
-            bool entered_gla;
-            if(rtn_term_offset < s->token_buffer_len)
-                status = descend_to_gla(
-                    s, &entered_gla, &s->token_buffer[rtn_term_offset].offset);
-            else
-                status = descend_to_gla(s, &entered_gla, &s->offset);
+/*
+ * With GCC and Clang, run_parser() goes from the code for one state straight
+ * to the code for the next by jumping through a table of label addresses
+ * ("computed goto"), so every kind of state ends in its own indirect branch
+ * and the CPU can learn which kind of state tends to follow it.  Elsewhere,
+ * or if GZL_NO_THREADED_DISPATCH is defined, every state goes back through
+ * one switch instead.
+ */
+#if defined(__GNUC__) && !defined(GZL_NO_THREADED_DISPATCH)
+#define GZL_THREADED_DISPATCH
+#endif
 
-            if(entered_gla)
-                gla_term_offset = rtn_term_offset;
-        }
+/*
+ * run_parser(): the parser's inner loop.  Takes every RTN and GLA transition
+ * it can from the frame on top of the stack: those that consume the
+ * terminals in the token buffer from *rtn_term_offset (in RTN frames) or
+ * *gla_term_offset (in GLA frames), and those that consume nothing.  Only
+ * RTN transitions leave a terminal consumed; GLA frames look ahead of
+ * *rtn_term_offset without moving it.
+ *
+ * Preconditions:
+ * - the current frame is an RTN frame or a GLA frame
+ *
+ * Postconditions:
+ * - if the status is GZL_STATUS_OK, the current frame is a GLA frame or an
+ *   RTN frame in a GZL_RTN_OP_TERMINAL or GZL_RTN_OP_LL1 state (or in a
+ *   GZL_RTN_OP_DESCEND or GZL_RTN_OP_CALL state with a descend_intfa), and
+ *   needs the terminal after the last one in the token buffer.
+ */
+static
+enum gzl_status run_parser(struct gzl_parse_state *s, int *rtn_term_offset,
+                           int *gla_term_offset)
+{
+    struct gzl_parse_stack_frame *frame;
+    struct gzl_rtn_state *rtn_state;
+    struct gzl_terminal *term;
+    enum gzl_status status;
 
-        if(status == GZL_STATUS_OK) {
-            assert(s->parse_stack_len > 0);
-            frame = DYNARRAY_GET_TOP(s->parse_stack);
-            frame_type = frame->frame_type;
+/* Frames that the parser pushes start at the next terminal that the RTN
+ * frames will consume, or at the current offset if it hasn't been lexed. */
+#define START_OFFSET() \
+    (*rtn_term_offset < s->token_buffer_len ? \
+     &buffered_terminal(s, *rtn_term_offset)->offset : &s->offset)
+
+/* Before descending, wait for that terminal to be lexed with the IntFA of
+ * the state the descent reaches, so that the new frames don't start at any
+ * whitespace or comments it skips first.  At EOF there is none to wait for,
+ * and a rule that can be empty is entered as soon as the parser gets to it.
+ * See descend_intfa in struct gzl_rtn_state. */
+#define WAIT_FOR_START() \
+    if(*rtn_term_offset == s->token_buffer_len && \
+       rtn_state->descend_intfa && !s->finishing) \
+        return GZL_STATUS_OK
+
+/* Every state ends by going to the code for the state on top of the stack,
+ * having checked that the stack hasn't grown too deep for an RTN frame. */
+#define GET_RTN_STATE() \
+    frame = DYNARRAY_GET_TOP(s->private_stack); \
+    if(frame->frame_type == GZL_FRAME_TYPE_GLA) goto gla_frame; \
+    if(s->shared_stack_len + s->private_stack_len >= s->max_stack_depth) \
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED; \
+    rtn_state = frame->f.rtn_frame.rtn_state
+
+#ifdef GZL_THREADED_DISPATCH
+    static void *const rtn_ops[] = {
+        [GZL_RTN_OP_TERMINAL] = &&op_terminal,
+        [GZL_RTN_OP_LL1]      = &&op_ll1,
+        [GZL_RTN_OP_GLA]      = &&op_gla,
+        [GZL_RTN_OP_DESCEND]  = &&op_descend,
+        [GZL_RTN_OP_CALL]     = &&op_call,
+        [GZL_RTN_OP_RETURN]   = &&op_return
+    };
+#define DISPATCH() \
+    do { GET_RTN_STATE(); goto *rtn_ops[rtn_state->op]; } while(0)
+
+    DISPATCH();
+#else
+#define DISPATCH() goto dispatch
+
+dispatch:
+    GET_RTN_STATE();
+    switch(rtn_state->op) {
+      case GZL_RTN_OP_TERMINAL: goto op_terminal;
+      case GZL_RTN_OP_LL1:      goto op_ll1;
+      case GZL_RTN_OP_GLA:      goto op_gla;
+      case GZL_RTN_OP_DESCEND:  goto op_descend;
+      case GZL_RTN_OP_CALL:     goto op_call;
+      case GZL_RTN_OP_RETURN:   goto op_return;
+    }
+#endif
+
+op_terminal:
+    if(*rtn_term_offset == s->token_buffer_len) return GZL_STATUS_OK;
+    term = buffered_terminal(s, (*rtn_term_offset)++);
+    /* Skip EOF: RTNs don't process EOF as a terminal, only GLAs do. */
+    if(term->id != GZL_EOF_TERMINAL_ID) {
+        struct gzl_rtn_transition *t =
+            find_rtn_terminal_transition(rtn_state, term);
+        if(!t) {
+            /* Parse error: terminal for which we had no RTN transition. */
+            if(s->bound_grammar->error_terminal_cb)
+                CALLBACK_AT(s, GZL_ERROR_CALLBACK,
+                            s->bound_grammar->error_terminal_cb(s, term));
+            return GZL_STATUS_ERROR;
         }
+        status = do_rtn_terminal_transition(s, t, term);
+        if(status != GZL_STATUS_OK) return status;
     }
-    while(status == GZL_STATUS_OK &&
-          ((frame_type == GZL_FRAME_TYPE_RTN &&
-            rtn_term_offset < s->token_buffer_len) ||
-           (frame_type == GZL_FRAME_TYPE_GLA &&
-            gla_term_offset < s->token_buffer_len)));
+    DISPATCH();
+
+op_ll1:
+    if(*rtn_term_offset == s->token_buffer_len) return GZL_STATUS_OK;
+    status = do_ll1_transition(s, rtn_state,
+                               buffered_terminal(s, *rtn_term_offset),
+                               rtn_term_offset);
+    if(status != GZL_STATUS_OK) return status;
+    DISPATCH();
+
+op_gla:
+    if(!push_gla_frame(s, rtn_state->d.state_gla))
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    *gla_term_offset = *rtn_term_offset;
+    DISPATCH();
+
+op_descend:
+    WAIT_FOR_START();
+    status = push_rtn_frames_for_descent(s, rtn_state, START_OFFSET());
+    if(status != GZL_STATUS_OK) return status;
+    DISPATCH();
+
+op_call:
+    WAIT_FOR_START();
+    status = push_rtn_frame_for_transition(s, &rtn_state->transitions[0],
+                                           START_OFFSET());
+    if(status != GZL_STATUS_OK) return status;
+    DISPATCH();
+
+op_return:
+    status = pop_rtn_frame(s);
+    if(status != GZL_STATUS_OK) return status;
+    DISPATCH();
+
+gla_frame:
+    if(*gla_term_offset == s->token_buffer_len) return GZL_STATUS_OK;
+    status = do_gla_transition(s, buffered_terminal(s, (*gla_term_offset)++),
+                               rtn_term_offset);
+    if(status != GZL_STATUS_OK) return status;
+    DISPATCH();
+
+#undef DISPATCH
+#undef GET_RTN_STATE
+#undef WAIT_FOR_START
+#undef START_OFFSET
+}
+
+/*
+ * run_token_buffer(): runs the parser on the terminals in the token buffer
+ * from s->rtn_term_offset and s->gla_term_offset, and then removes the ones
+ * it consumed.  The offsets are kept in s rather than here so that a state
+ * duplicated in a callback can carry on from where the parser was.
+ */
+static
+enum gzl_status run_token_buffer(struct gzl_parse_state *s)
+{
+    enum gzl_status status =
+        run_parser(s, &s->rtn_term_offset, &s->gla_term_offset);
+    int consumed = s->rtn_term_offset;
+    s->rtn_term_offset = -1;
 
     /* We can have an EOF left over in the token buffer if the EOF token led us
-     * to a hard EOF, thus terminating the above loop before our "skip" above
-     * could cover this EOF special case. */
-    if(rtn_term_offset < s->token_buffer_len &&
-       s->token_buffer[rtn_term_offset].name == NULL)
-        rtn_term_offset++;
+     * to a hard EOF, thus stopping run_parser() before its "skip" could
+     * cover this EOF special case. */
+    if(consumed < s->token_buffer_len &&
+       buffered_terminal(s, consumed)->name == NULL)
+        consumed++;
 
     /* At this point we have consumed some (but possibly not all) of the
      * terminals we have lexed.  We consider a token fully consumed when it
@@ -475,166 +935,914 @@ enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
      * later.
      *
      * We now remove the consumed terminals from token_buffer. */
-    int remaining_terminals = s->token_buffer_len - rtn_term_offset;
-    if(remaining_terminals > 0)
-        memmove(s->token_buffer, s->token_buffer + rtn_term_offset,
-                remaining_terminals * sizeof(*s->token_buffer));
-    RESIZE_DYNARRAY(s->token_buffer, remaining_terminals);
+    s->token_buffer_head = (s->token_buffer_head + consumed) &
+                           (s->token_buffer_size - 1);
+    s->token_buffer_len -= consumed;
 
     /* Update open_terminal_offset. */
-    if(remaining_terminals > 0)
-        s->open_terminal_offset = s->token_buffer[0].offset;
+    if(s->token_buffer_len > 0)
+        s->open_terminal_offset = buffered_terminal(s, 0)->offset;
     else
         s->open_terminal_offset = s->offset;
 
     return status;
 }
 
-
 /*
- * do_intfa_transition(): transitions an IntFA frame according to the given
- * char, performing the appropriate GLA/RTN transitions if this puts the IntFA
- * in a final state.
+ * process_terminal(): processes a terminal that was just lexed, possibly
+ * triggering a series of RTN and/or GLA transitions.
  *
  * Preconditions:
- * - the current stack frame is an IntFA frame
+ * - s->intfa is the IntFA that just produced this terminal
+ * - the given terminal can be recognized by the current GLA or RTN state
  *
  * Postconditions:
- * - the current stack frame is an IntFA frame unless we have hit a
- *   hard EOF in which case it is an RTN frame.  Note that it could be either
- *   same IntFA frame or a different one.
- *
- * Note: we currently implement longest-match, assuming that the first
- * non-matching character is only one longer than the longest match.
+ * - the current stack frame is an GLA or RTN frame representing the state after
+ *   all available GLA and RTN transitions have been taken.
  */
+
 static
-enum gzl_status do_intfa_transition(struct gzl_parse_state *s,
-                                    char ch)
+enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
+                                 int term_id, struct gzl_offset *start_offset,
+                                 int len)
 {
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_INTFA);
-    struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-    struct gzl_intfa_transition *t = find_intfa_transition(
-        intfa_frame->intfa_state, ch);
-    enum gzl_status status;
+    s->intfa = NULL;
 
-    /* If this character did not have any transition, but the state we're coming
-     * from is final, then longest-match semantics say that we should return
-     * the last character's final state as the token.  But if the state we're
-     * coming from is *not* final, it's just a parse error. */
-    if(!t) {
-        char *terminal = intfa_frame->intfa_state->final;
-        //assert(terminal); /* TODO: handle this case better. */
-        if (terminal) {
-            status = process_terminal(s, terminal, &frame->start_offset,
-                                      s->offset.byte -frame->start_offset.byte);
-            if(status != GZL_STATUS_OK) return status;
-            intfa_frame = push_intfa_frame_for_gla_or_rtn(s);
-            t = find_intfa_transition(intfa_frame->intfa_state, ch);
-        }
-        if(!t) {
-            /* Parse error: we encountered a character for which we have no
-             * transition. */
-            if(s->bound_grammar->error_char_cb)
-                s->bound_grammar->error_char_cb(s, ch);
-            return GZL_STATUS_ERROR;
-        }
-    }
+    if(s->token_buffer_len+1 >= s->max_lookahead)
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
 
-    /* We have finished processing transitions for the previous byte.
-     * Move on to the next byte. */
-    s->offset.byte++;
+    struct gzl_terminal *term = append_terminal(s);
+    if(!term)
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    term->name = term_name;
+    term->id = term_id;
+    term->offset = *start_offset;
+    term->len = len;
+
+    /* Feed tokens to RTNs and GLAs until we have processed all the tokens we
+     * have. */
+    s->rtn_term_offset = 0;
+    s->gla_term_offset = s->token_buffer_len - 1;
+    return run_token_buffer(s);
+}
+
+
+/*
+ * advance_offset(): moves an offset past one byte of input, counting lines
+ * and columns unless track_lines is false (in lazy_lines mode).  Logical
+ * newlines can span more than one byte, so a CR/LF pair only counts as one
+ * newline; last_char_was_newline tracks this.
+ *
+ * The lexing loop in gzl_parse() doesn't use this, and counts lines in bulk
+ * with count_lines() instead.
+ */
+static inline
+void advance_offset(struct gzl_offset *offset, bool *last_char_was_newline,
+                    char ch, bool track_lines)
+{
+    offset->byte++;
+    if(!track_lines)
+        return;
 
-    /* Deal with newlines.  This is all very single-byte-encoding specific for
-     * the moment. */
+    /* This is all very single-byte-encoding specific for the moment. */
     bool is_newline_char = (ch == 0x0A || ch == 0x0D);  /* LF and CR */
     if(is_newline_char) {
-        if(!s->last_char_was_newline) {
-            s->offset.line++;
-            s->offset.column = 1;
+        if(!*last_char_was_newline) {
+            offset->line++;
+            offset->column = 1;
         }
     }
     else
-        s->offset.column++;
-    s->last_char_was_newline = is_newline_char;
-
-    /* Do the transition. */
-    intfa_frame->intfa_state = t->dest_state;
-
-    /* If the current state is final and there are no outgoing transitions,
-     * we *know* we don't have to wait any longer for the longest match.
-     * Transition the RTN or GLA now, for more on-line behavior. */
-    if(intfa_frame->intfa_state->final &&
-       (intfa_frame->intfa_state->num_transitions == 0)) {
-        status = process_terminal(s, intfa_frame->intfa_state->final,
-                                  &frame->start_offset,
-                                  s->offset.byte - frame->start_offset.byte);
-        if(status != GZL_STATUS_OK)
-            return status;
-        push_intfa_frame_for_gla_or_rtn(s);
-    }
-    return GZL_STATUS_OK;
+        offset->column++;
+    *last_char_was_newline = is_newline_char;
 }
 
 /*
- * The rest of this file is the publicly-exposed API, documented in the
- * header file.
+ * gzl_scan_intfa_run(): returns how many bytes at the beginning of buf would
+ * leave the IntFA in the given state, which must loop on itself (run_type
+ * is not GZL_INTFA_RUN_NONE).  This tests a whole vector of input at a time
+ * where SSE2 or AVX2 are available, and falls back to a byte loop for the
+ * tail of the buffer and for other architectures.  Lexers generated by gzlc
+ * --emit-c call it too.
  */
-
-enum gzl_status gzl_parse(struct gzl_parse_state *s, const char *buf,
-                          size_t buf_len)
+size_t gzl_scan_intfa_run(struct gzl_intfa_state *state, const char *buf,
+                          size_t len)
+{
+    bool until_any = (state->run_type == GZL_INTFA_RUN_UNTIL_ANY);
+    int num_run_bytes = state->num_run_bytes;
+    const unsigned char *run_bytes = state->run_bytes;
+    size_t i = 0;
+
+    /* The state loops on every byte. */
+    if(until_any && num_run_bytes == 0)
+        return len;
+
+#if defined(__AVX2__)
+    __m256i run_bytes_256[GZL_MAX_RUN_BYTES];
+    for(int j = 0; j < num_run_bytes; j++)
+        run_bytes_256[j] = _mm256_set1_epi8((char)run_bytes[j]);
+    for(; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i match = _mm256_cmpeq_epi8(chunk, run_bytes_256[0]);
+        for(int j = 1; j < num_run_bytes; j++)
+            match = _mm256_or_si256(match,
+                                    _mm256_cmpeq_epi8(chunk, run_bytes_256[j]));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(match);
+        if(!until_any) mask = ~mask;
+        if(mask) return i + __builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    __m128i run_bytes_128[GZL_MAX_RUN_BYTES];
+    for(int j = 0; j < num_run_bytes; j++)
+        run_bytes_128[j] = _mm_set1_epi8((char)run_bytes[j]);
+    for(; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i match = _mm_cmpeq_epi8(chunk, run_bytes_128[0]);
+        for(int j = 1; j < num_run_bytes; j++)
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(chunk, run_bytes_128[j]));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(match);
+        if(!until_any) mask = ~mask & 0xFFFF;
+        if(mask) return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for(; i < len; i++) {
+        bool is_run_byte = false;
+        for(int j = 0; j < num_run_bytes; j++)
+            if((unsigned char)buf[i] == run_bytes[j])
+                is_run_byte = true;
+        if(is_run_byte == until_any)
+            return i;
+    }
+    return len;
+}
+
+/*
+ * newline_mask(): returns a bitmask of which bytes in the NEWLINE_BLOCK bytes
+ * starting at buf are newline bytes (CR or LF), bit 0 being buf[0].
+ */
+#if defined(__AVX2__)
+#define NEWLINE_BLOCK 32
+static inline
+uint32_t newline_mask(const char *buf)
+{
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)buf);
+    __m256i match = _mm256_or_si256(
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(0x0A)),
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(0x0D)));
+    return (uint32_t)_mm256_movemask_epi8(match);
+}
+#elif defined(__SSE2__)
+#define NEWLINE_BLOCK 16
+static inline
+uint32_t newline_mask(const char *buf)
+{
+    __m128i chunk = _mm_loadu_si128((const __m128i*)buf);
+    __m128i match = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(0x0A)),
+                                 _mm_cmpeq_epi8(chunk, _mm_set1_epi8(0x0D)));
+    return (uint32_t)_mm_movemask_epi8(match);
+}
+#endif
+
+/*
+ * count_lines(): updates the line and column of an offset for len bytes of
+ * input that the lexer has just consumed, exactly as advance_offset() would
+ * if it were called for each byte.  The lexer itself only counts bytes, and
+ * gzl_parse() calls this once for each span it lexes, before anything can
+ * look at the offset.
+ *
+ * A new line starts at each newline byte that doesn't follow another one,
+ * so with SSE2 or AVX2 we count those with a popcount over a whole vector of
+ * input at a time.  The column only depends on where the last newline byte
+ * in the span is.
+ */
+static
+void count_lines(const char *buf, size_t len, struct gzl_offset *offset,
+                 bool *last_char_was_newline)
+{
+    size_t i = 0;
+    size_t lines = 0;
+    size_t last_newline = len;  /* len means there wasn't one. */
+    bool prev_was_newline = *last_char_was_newline;
+
+#ifdef NEWLINE_BLOCK
+    for(; i + NEWLINE_BLOCK <= len; i += NEWLINE_BLOCK) {
+        uint32_t mask = newline_mask(buf + i);
+        if(!mask) {
+            prev_was_newline = false;
+            continue;
+        }
+        uint32_t starts = mask & ~((mask << 1) | prev_was_newline);
+        lines += __builtin_popcount(starts);
+        last_newline = i + (31 - __builtin_clz(mask));
+        prev_was_newline = (mask >> (NEWLINE_BLOCK - 1)) & 1;
+    }
+#endif
+
+    for(; i < len; i++) {
+        bool is_newline_char = (buf[i] == 0x0A || buf[i] == 0x0D);
+        if(is_newline_char) {
+            if(!prev_was_newline)
+                lines++;
+            last_newline = i;
+        }
+        prev_was_newline = is_newline_char;
+    }
+
+    if(len == 0)
+        return;
+    offset->line += lines;
+    if(last_newline == len)
+        offset->column += len;
+    else
+        offset->column = len - last_newline;
+    *last_char_was_newline = prev_was_newline;
+}
+
+/*
+ * lex_bytes(): transitions the IntFA for as many bytes of buf (starting at
+ * byte i) as it can without completing a terminal, and returns the index of
+ * the first byte it did not consume.  That byte either completes a terminal
+ * or has no transition, and is left for do_intfa_transition().
+ *
+ * The IntFA state is kept in a local here rather than in the parse stack,
+ * since only a byte that completes a terminal (or is an error) needs the
+ * stack.  The caller accounts for the offset of the bytes consumed.  An
+ * IntFA with a direct-coded lexer (see gzl_lex_func) runs that instead, and
+ * one the JIT has compiled runs its native code.
+ */
+static inline
+size_t lex_bytes(struct gzl_bound_grammar *bg, struct gzl_intfa *intfa,
+                 struct gzl_intfa_state **intfa_state,
+                 const char *buf, size_t i, size_t buf_len)
+{
+    if(intfa->lex)
+        return intfa->lex(intfa, intfa_state, buf, i, buf_len);
+    if(bg->jit) {
+        int state_num = *intfa_state - intfa->states;
+        i = bg->jit->intfas[intfa - bg->grammar->intfas](buf, i, buf_len,
+                                                         &state_num);
+        *intfa_state = &intfa->states[state_num];
+        return i;
+    }
+
+    struct gzl_intfa_state *state = *intfa_state;
+    while(i < buf_len) {
+        /* If this state loops on itself, skip ahead to the first byte
+         * that leaves the loop.  This is equivalent to (but much faster
+         * than) transitioning the IntFA once for each of those bytes. */
+        if(state->run_type != GZL_INTFA_RUN_NONE) {
+            i += gzl_scan_intfa_run(state, buf + i, buf_len - i);
+            if(i == buf_len) break;
+        }
+
+        struct gzl_intfa_state *dest_state =
+            find_intfa_dest_state(intfa, state, buf[i]);
+        if(!dest_state ||
+           (dest_state->final && dest_state->num_transitions == 0))
+            break;
+
+        state = dest_state;
+        i++;
+    }
+    *intfa_state = state;
+    return i;
+}
+
+/*
+ * input_byte(): returns the input byte at the given offset, which must be
+ * in the current buffer or in the bytes carried over from earlier ones.
+ */
+static inline
+char input_byte(struct gzl_parse_state *s, size_t byte)
+{
+    if(byte < s->buf_offset) {
+        assert(byte >= s->carry_offset);
+        return s->carry[byte - s->carry_offset];
+    }
+    assert(byte - s->buf_offset < s->buf_len);
+    return s->buf[byte - s->buf_offset];
+}
+
+/*
+ * process_intfa_terminal(): like process_terminal(), for the terminal that
+ * the lexer just lexed from s->intfa_start_offset up to s->offset, ending in
+ * the given final state of s->intfa.  If the terminal is one to skip, the
+ * lexer is stopped and nothing else happens.  If the IntFA has keywords and
+ * the terminal is their identifier, the terminal's text is looked up in the
+ * IntFA's keyword table first, and a keyword is processed in its place if
+ * the text matches one.
+ */
+static
+enum gzl_status process_intfa_terminal(struct gzl_parse_state *s,
+                                       struct gzl_intfa_state *final_state)
+{
+    struct gzl_intfa *intfa = s->intfa;
+    size_t start = s->intfa_start_offset.byte;
+    int len = s->offset.byte - start;
+    char *term_name = final_state->final;
+    int term_id = final_state->final_id;
+
+    if(final_state->skip) {
+        s->intfa = NULL;
+        return GZL_STATUS_OK;
+    }
+
+    if(intfa->keywords) {
+        uint32_t hash = 0;
+        for(int i = 0; i < len; i++)
+            hash = hash * intfa->keyword_multiplier +
+                   (unsigned char)input_byte(s, start + i);
+
+        struct gzl_intfa_keyword *keyword =
+            &intfa->keywords[hash % intfa->keyword_table_size];
+        if(keyword->text && keyword->identifier_id == term_id &&
+           keyword->len == (size_t)len) {
+            int i = 0;
+            while(i < len && input_byte(s, start + i) == keyword->text[i])
+                i++;
+            if(i == len) {
+                term_name = keyword->terminal;
+                term_id = keyword->terminal_id;
+            }
+        }
+    }
+
+    return process_terminal(s, term_name, term_id, &s->intfa_start_offset,
+                            len);
+}
+
+/*
+ * The munch memo is a set of (IntFA state, byte offset) pairs, kept in an
+ * open-addressed hash table.  See the comment on munch_memo in parse.h.
+ */
+static inline
+size_t munch_memo_slot(struct gzl_parse_state *s,
+                       struct gzl_intfa_state *state, size_t byte)
+{
+    size_t hash = ((uintptr_t)state >> 3) ^ (byte * 2654435761u);
+    size_t mask = s->munch_memo_size - 1;
+    size_t slot = hash & mask;
+    while(s->munch_memo[slot].state &&
+          (s->munch_memo[slot].state != state ||
+           s->munch_memo[slot].byte != byte))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+static
+bool in_munch_memo(struct gzl_parse_state *s, struct gzl_intfa_state *state,
+                   size_t byte)
+{
+    if(s->munch_memo_count == 0)
+        return false;
+    return s->munch_memo[munch_memo_slot(s, state, byte)].state != NULL;
+}
+
+static
+bool add_to_munch_memo(struct gzl_parse_state *s,
+                       struct gzl_intfa_state *state, size_t byte)
+{
+    /* Keep the table at most half full.  There is no going on without
+     * memory to grow it: lexing without the memo can take quadratic time. */
+    if((s->munch_memo_count + 1) * 2 > s->munch_memo_size) {
+        struct gzl_munch_memo_entry *old_memo = s->munch_memo;
+        int old_size = s->munch_memo_size;
+        int size = old_size ? old_size * 2 : 64;
+        struct gzl_munch_memo_entry *memo =
+            gzl_alloc(s->alloc, size * sizeof(*memo));
+        if(!memo)
+            return false;
+        memset(memo, 0, size * sizeof(*memo));
+        s->munch_memo = memo;
+        s->munch_memo_size = size;
+        for(int i = 0; i < old_size; i++)
+            if(old_memo[i].state)
+                s->munch_memo[munch_memo_slot(s, old_memo[i].state,
+                                              old_memo[i].byte)] = old_memo[i];
+        gzl_free(s->alloc, old_memo);
+    }
+
+    struct gzl_munch_memo_entry *entry =
+        &s->munch_memo[munch_memo_slot(s, state, byte)];
+    if(!entry->state) {
+        entry->state = state;
+        entry->byte = byte;
+        s->munch_memo_count++;
+    }
+    if(byte >= s->munch_memo_end)
+        s->munch_memo_end = byte + 1;
+    return true;
+}
+
+static
+void clear_munch_memo(struct gzl_parse_state *s)
+{
+    if(s->munch_memo_count > 0)
+        memset(s->munch_memo, 0, s->munch_memo_size * sizeof(*s->munch_memo));
+    s->munch_memo_count = 0;
+    s->munch_memo_end = 0;
+}
+
+/*
+ * back_up_to_longest_match(): when the IntFA is stuck in a nonfinal state,
+ * finds the longest terminal that the input since the IntFA started begins
+ * with, processes it, and leaves the offset just past it so that the
+ * rest of the input is lexed again.  Returns false (having done nothing) if
+ * no terminal matched.
+ *
+ * Every IntFA state the lexer passed through after the end of that terminal
+ * is a dead end at its offset, which we record in the munch memo so that
+ * lexing the same input again can stop there instead of re-scanning it.
+ *
+ * Preconditions:
+ * - the lexer is running and its IntFA is in a nonfinal state
+ *
+ * If the memo cannot grow, this returns true with *status set to
+ * GZL_STATUS_RESOURCE_LIMIT_EXCEEDED, before processing the terminal.
+ *
+ * Postconditions (if this returns true and *status is GZL_STATUS_OK):
+ * - the lexer has been restarted at s->offset
+ */
+static
+bool back_up_to_longest_match(struct gzl_parse_state *s,
+                              enum gzl_status *status)
+{
+    struct gzl_intfa *intfa = s->intfa;
+    size_t start = s->intfa_start_offset.byte;
+    size_t end = s->offset.byte;
+
+    /* Lex the terminal again, this time noting every final state. */
+    struct gzl_intfa_state *state = &intfa->states[0];
+    struct gzl_offset offset = s->intfa_start_offset;
+    bool last_char_was_newline = (start > 0 && offset.column == 1);
+    struct gzl_intfa_state *match = NULL;
+    struct gzl_offset match_offset;
+    bool match_last_char_was_newline = false;
+    for(size_t byte = start; byte < end; byte++) {
+        char ch = input_byte(s, byte);
+        state = find_intfa_dest_state(intfa, state, ch);
+        advance_offset(&offset, &last_char_was_newline, ch, !s->lazy_lines);
+        if(state->final) {
+            match = state;
+            match_offset = offset;
+            match_last_char_was_newline = last_char_was_newline;
+        }
+    }
+    if(!match)
+        return false;
+
+    state = &intfa->states[0];
+    for(size_t byte = start; byte < end; byte++) {
+        state = find_intfa_dest_state(intfa, state, input_byte(s, byte));
+        if(byte + 1 > match_offset.byte &&
+           !add_to_munch_memo(s, state, byte + 1)) {
+            *status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+            return true;
+        }
+    }
+
+    s->offset = match_offset;
+    s->last_char_was_newline = match_last_char_was_newline;
+    *status = process_intfa_terminal(s, match);
+    if(*status == GZL_STATUS_OK)
+        start_intfa_for_gla_or_rtn(s);
+    return true;
+}
+
+/*
+ * do_intfa_transition(): transitions the lexer's IntFA according to the given
+ * char, performing the appropriate GLA/RTN transitions if this puts the IntFA
+ * in a final state.  gzl_parse() only calls this for bytes that complete a
+ * terminal or have no transition (and for input it is lexing a second time
+ * after backing up); it handles all other bytes itself.
+ *
+ * Preconditions:
+ * - the lexer is running
+ *
+ * Postconditions:
+ * - the lexer is running unless we have hit a hard EOF.  Note that it could
+ *   be in the middle of the same terminal or starting a new one.  s->offset
+ *   is usually one byte further along, but is earlier if we had to back up.
+ */
+static
+enum gzl_status do_intfa_transition(struct gzl_parse_state *s,
+                                    char ch)
+{
+    enum gzl_status status;
+
+    /* A state the munch memo says is a dead end behaves as if it had no
+     * transition for this character. */
+    bool dead_end = in_munch_memo(s, s->intfa_state, s->offset.byte);
+    struct gzl_intfa_state *dest_state = dead_end ? NULL :
+        find_intfa_dest_state(s->intfa, s->intfa_state, ch);
+
+    /* If this character did not have any transition and the state we're
+     * coming from is not final, maximal munch says we should back up to the
+     * longest terminal we passed.  If there wasn't one, this is a parse
+     * error, which we find where it really is by lexing on regardless of the
+     * memo. */
+    if(!dest_state && !s->intfa_state->final) {
+        if(back_up_to_longest_match(s, &status))
+            return status;
+        if(dead_end) {
+            clear_munch_memo(s);
+            dest_state = find_intfa_dest_state(s->intfa, s->intfa_state, ch);
+        }
+    }
+
+    /* If this character did not have any transition, but the state we're coming
+     * from is final, then longest-match semantics say that we should return
+     * the last character's final state as the token. */
+    if(!dest_state) {
+        if (s->intfa_state->final) {
+            status = process_intfa_terminal(s, s->intfa_state);
+            if(status != GZL_STATUS_OK) return status;
+            start_intfa_for_gla_or_rtn(s);
+            dest_state = find_intfa_dest_state(s->intfa, s->intfa_state, ch);
+        }
+        if(!dest_state) {
+            /* Parse error: we encountered a character for which we have no
+             * transition. */
+            if(s->bound_grammar->error_char_cb)
+                CALLBACK_AT(s, GZL_ERROR_CALLBACK,
+                            s->bound_grammar->error_char_cb(s, ch));
+            return GZL_STATUS_ERROR;
+        }
+    }
+
+    /* We have finished processing transitions for the previous byte.
+     * Move on to the next byte. */
+    advance_offset(&s->offset, &s->last_char_was_newline, ch, !s->lazy_lines);
+
+    /* Do the transition. */
+    s->intfa_state = dest_state;
+
+    /* If the current state is final and there are no outgoing transitions,
+     * we *know* we don't have to wait any longer for the longest match.
+     * Transition the RTN or GLA now, for more on-line behavior. */
+    if(dest_state->final && dest_state->num_transitions == 0) {
+        status = process_intfa_terminal(s, dest_state);
+        if(status != GZL_STATUS_OK)
+            return status;
+        start_intfa_for_gla_or_rtn(s);
+    }
+    return GZL_STATUS_OK;
+}
+
+/*
+ * relex_carried_bytes(): lexes the bytes from earlier buffers that the lexer
+ * has backed up into, until s->offset reaches the current buffer.
+ */
+static
+enum gzl_status relex_carried_bytes(struct gzl_parse_state *s)
 {
-    assert(s != NULL);
     enum gzl_status status = GZL_STATUS_OK;
-    int offset = 0;
-    /* For the first call, we need to push the initial frame and
-     * descend from the starting frame until we hit an IntFA frame. */
-    if(s->offset.byte == 0 && s->parse_stack_len == 0) {
-        push_rtn_frame(s, &s->bound_grammar->grammar->rtns[0], &s->offset);
-        bool entered_gla;
-        status = descend_to_gla(s, &entered_gla, &s->offset);
-        if(status == GZL_STATUS_OK) push_intfa_frame_for_gla_or_rtn(s);
+    while(status == GZL_STATUS_OK && s->offset.byte < s->buf_offset)
+        status = do_intfa_transition(s, input_byte(s, s->offset.byte));
+    return status;
+}
+
+/*
+ * save_carry(): called when gzl_parse() returns, to copy the bytes of any
+ * terminal the lexer is in the middle of into s->carry, since the client
+ * may throw the buffer away.  Afterwards the carried bytes run up to
+ * s->offset, where the next buffer will begin.  Returns false if there is
+ * no memory for them.
+ */
+static
+bool save_carry(struct gzl_parse_state *s)
+{
+    size_t start = s->intfa ? s->intfa_start_offset.byte : s->offset.byte;
+    size_t end = s->offset.byte;
+
+    /* First the bytes we already had, then the ones from this buffer. */
+    size_t carried = 0;
+    if(start < s->buf_offset) {
+        carried = (end < s->buf_offset ? end : s->buf_offset) - start;
+        memmove(s->carry, s->carry + (start - s->carry_offset), carried);
+    }
+    bool ok;
+    RESIZE_DYNARRAY_IN(s->alloc, s->carry, (int)(end - start), ok);
+    if(!ok)
+        return false;
+    if(end > s->buf_offset) {
+        size_t from = start > s->buf_offset ? start : s->buf_offset;
+        memcpy(s->carry + carried, s->buf + (from - s->buf_offset), end - from);
+    }
+    s->carry_offset = start;
+    return true;
+}
+
+/*
+ * retain_newline_segment(), release_newline_segment(): the same as
+ * retain_stack_segment() and release_stack_segment(), for the newline index.
+ */
+static
+void retain_newline_segment(struct gzl_newline_segment *seg)
+{
+    add_to_refcount(&seg->refcount, 1);
+}
+
+static
+void release_newline_segment(struct gzl_newline_segment *seg)
+{
+    while(seg) {
+        if(add_to_refcount(&seg->refcount, -1) > 0)
+            return;
+        struct gzl_newline_segment *below = seg->below;
+        gzl_free(seg->alloc, seg->runs);
+        gzl_free(seg->alloc, seg);
+        seg = below;
+    }
+}
+
+/* How many of the first len runs start before byte. */
+static
+int runs_before(struct gzl_newline_run *runs, int len, size_t byte)
+{
+    int low = 0, high = len;
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(runs[mid].start < byte)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/*
+ * newline_runs_before(): returns how many runs in the newline index start
+ * before byte, and sets *run to the last of them (or NULL if there are
+ * none).  Looks in the shared segments only if all of newline_index comes
+ * after byte, from the top one down.
+ */
+static
+int newline_runs_before(struct gzl_parse_state *s, size_t byte,
+                        struct gzl_newline_run **run)
+{
+    int n = runs_before(s->newline_index, s->newline_index_len, byte);
+    if(n > 0) {
+        *run = &s->newline_index[n - 1];
+        return s->shared_newlines_len + n;
+    }
+    int len = s->shared_newlines_len;
+    for(struct gzl_newline_segment *seg = s->shared_newlines; len > 0;
+        seg = seg->below) {
+        n = runs_before(seg->runs, len - seg->below_len, byte);
+        if(n > 0) {
+            *run = &seg->runs[n - 1];
+            return seg->below_len + n;
+        }
+        len = seg->below_len;
+    }
+    *run = NULL;
+    return 0;
+}
+
+/*
+ * index_newline(): adds the newline byte at byte offset i to the newline
+ * index that lazy_lines mode keeps in place of counting lines as it lexes.
+ * Consecutive newline bytes are one run, just as they are one newline to
+ * advance_offset(), even when they straddle two buffers.  Returns false if
+ * there is no memory to grow the index.
+ */
+static inline
+bool index_newline(struct gzl_parse_state *s, size_t i)
+{
+    if(s->newline_index_len > 0 &&
+       DYNARRAY_GET_TOP(s->newline_index)->end == i) {
+        DYNARRAY_GET_TOP(s->newline_index)->end = i + 1;
     } else {
-        offset = s->offset.byte;
-        //push_rtn_frame(s, &s->bound_grammar->grammar->rtns[0], &s->offset);
-        //printf("parse. (s->offset.byte => %zu)\n", s->offset.byte);
-        bool entered_gla;
-        status = descend_to_gla(s, &entered_gla, &s->offset);
-        //printf("entered_gla: %d  (offset: %zu, s->offset.byte => %zu)\n",
-        //       entered_gla, offset, s->offset.byte);
-        if(status == GZL_STATUS_OK) push_intfa_frame_for_gla_or_rtn(s);
-    }
-    if(s->parse_stack_len == 0) {
+        bool ok;
+        RESIZE_DYNARRAY_IN(s->alloc, s->newline_index,
+                           s->newline_index_len+1, ok);
+        if(!ok)
+            return false;
+        struct gzl_newline_run *run = DYNARRAY_GET_TOP(s->newline_index);
+        run->start = i;
+        run->end = i + 1;
+    }
+    return true;
+}
+
+/*
+ * index_newlines(): adds the newlines in the current buffer up to byte "end"
+ * to the newline index, a vector of input at a time where we can.  Returns
+ * false if there is no memory to grow the index, in which case it is only
+ * complete up to the newline that would not fit.
+ */
+static
+bool index_newlines(struct gzl_parse_state *s, size_t end)
+{
+    size_t i = s->newline_index_end;
+
+#define INDEX_NEWLINE(byte) \
+    do { \
+        if(!index_newline(s, byte)) { \
+            s->newline_index_end = byte; \
+            return false; \
+        } \
+    } while(0)
+
+    /* The (rare) bytes we have only in s->carry. */
+    for(; i < end && i < s->buf_offset; i++) {
+        char ch = input_byte(s, i);
+        if(ch == 0x0A || ch == 0x0D)
+            INDEX_NEWLINE(i);
+    }
+
+#ifdef NEWLINE_BLOCK
+    for(; i + NEWLINE_BLOCK <= end; i += NEWLINE_BLOCK) {
+        uint32_t mask = newline_mask(s->buf + (i - s->buf_offset));
+        while(mask) {
+            INDEX_NEWLINE(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for(; i < end; i++) {
+        char ch = input_byte(s, i);
+        if(ch == 0x0A || ch == 0x0D)
+            INDEX_NEWLINE(i);
+    }
+
+#undef INDEX_NEWLINE
+
+    if(end > s->newline_index_end)
+        s->newline_index_end = end;
+    return true;
+}
+
+/*
+ * The rest of this file is the publicly-exposed API, documented in the
+ * header file.
+ */
+
+/*
+ * parse(), finish_parse(): the bodies of gzl_parse() and gzl_finish_parse(),
+ * the latter of which marks the state as finishing while it runs (see
+ * finishing in struct gzl_parse_state).
+ */
+static
+enum gzl_status parse(struct gzl_parse_state *s, const char *buf,
+                      size_t buf_len)
+{
+    enum gzl_status status = GZL_STATUS_OK;
+    /* A copy made in an error callback fails as orig did. */
+    if(s->callback == GZL_ERROR_CALLBACK)
+        return GZL_STATUS_ERROR;
+    if(s->lazy_lines) {
+        /* We never count lines in this mode; see gzl_resolve_offset(). */
+        s->offset.line = 0;
+        s->offset.column = 0;
+    }
+    /* For the first call, we need to push the initial frames.  Usually the
+     * grammar has them ready to copy; if not (or if they would go past
+     * max_stack_depth), we push the start rule and the parser takes it from
+     * there. */
+    if(s->offset.byte == 0 && s->private_stack_len == 0) {
+        struct gzl_grammar *g = s->bound_grammar->grammar;
+        if(g->num_start_frames > 0 &&
+           g->num_start_frames < s->max_stack_depth)
+            status = push_start_frames(s);
+        else
+            status = push_rtn_frame(s, &g->rtns[0], &s->offset);
+        if(status != GZL_STATUS_OK)
+            return status;
+    }
+    if(s->private_stack_len == 0) {
         /* This gzl_parse_state has already hit hard EOF previously. */
         return GZL_STATUS_HARD_EOF;
     }
+    if(s->tape && s->tape_len == s->tape_size)
+        return GZL_STATUS_TAPE_FULL;
+
+    /* Descend from the current frame until we reach a state with an IntFA,
+     * unless a previous call left us in the middle of lexing a terminal.  A
+     * state duplicated in a callback first finishes the parser's run on the
+     * terminals it was given. */
+    if(!s->intfa) {
+        if(s->rtn_term_offset < 0) {
+            s->rtn_term_offset = 0;
+            s->gla_term_offset = s->token_buffer_len;
+        }
+        status = run_token_buffer(s);
+        if(status == GZL_STATUS_OK) start_intfa_for_gla_or_rtn(s);
+    }
+
+    /* buf_offset is where the last call left off, unless we are a copy with
+     * some input of orig's carried over (see gzl_dup_parse_state()). */
+    s->buf = buf;
+    s->buf_len = buf_len;
+    size_t buf_end = s->buf_offset + buf_len;
+    while(s->offset.byte < buf_end && status == GZL_STATUS_OK) {
+        /* Backing up can take us into bytes from earlier buffers. */
+        if(s->offset.byte < s->buf_offset) {
+            status = relex_carried_bytes(s);
+            continue;
+        }
+
+        /* Input that we have backed up over goes a byte at a time, checking
+         * the munch memo.  Past that, lex_bytes() takes as many bytes as it
+         * can. */
+        size_t i = s->offset.byte - s->buf_offset;
+        if(s->offset.byte >= s->munch_memo_end) {
+            clear_munch_memo(s);
+            size_t lex_start = i;
+            i = lex_bytes(s->bound_grammar, s->intfa, &s->intfa_state,
+                          buf, i, buf_len);
+
+            s->offset.byte += i - lex_start;
+            if(!s->lazy_lines)
+                count_lines(buf + lex_start, i - lex_start, &s->offset,
+                            &s->last_char_was_newline);
+        }
 
-    for(int i = offset; i < buf_len && status == GZL_STATUS_OK; i++)
-        status = do_intfa_transition(s, buf[i]);
+        if(i < buf_len)
+            status = do_intfa_transition(s, buf[i]);
+
+        /* If the event tape is full, stop here as if the buffer ended here,
+         * unless we have backed up into a previous buffer (which the client
+         * could not give us the rest of). */
+        if(s->tape && s->tape_len == s->tape_size &&
+           status == GZL_STATUS_OK && s->offset.byte < buf_end &&
+           s->offset.byte >= s->buf_offset) {
+            status = GZL_STATUS_TAPE_FULL;
+            break;
+        }
+    }
+
+    /* The client may throw this buffer away once we return, so index any
+     * newlines in it that we haven't already, and keep our own copy of any
+     * terminal we are in the middle of. */
+    if(s->lazy_lines && !index_newlines(s, s->offset.byte))
+        status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    if(!save_carry(s))
+        status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    s->buf = NULL;
+    s->buf_len = 0;
+    s->buf_offset = s->offset.byte;
     return status;
 }
 
-bool gzl_finish_parse(struct gzl_parse_state *s)
+/* Whether an RTN frame below the top of the stack can return once the frame
+ * above it does, which it must for EOF to be valid. */
+static
+bool rtn_frame_can_end(struct gzl_parse_stack_frame *frame)
+{
+    assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
+    struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
+    assert(rtn_frame->rtn_transition);
+    return rtn_frame->rtn_transition->dest_state->is_final;
+}
+
+static
+bool finish_parse(struct gzl_parse_state *s)
 {
-    /* First deal with an open IntFA frame if there is one.  The frame must
-     * be in a start state (in which case we back it out), a final state
-     * (in which case we recognize and process the terminal), or both (in
-     * which case we back out iff. we are in a GLA state with an EOF transition
-     * out).  */
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    if(frame->frame_type == GZL_FRAME_TYPE_INTFA) {
-        struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-        if(intfa_frame->intfa_state->final &&
-           intfa_frame->intfa_state == &intfa_frame->intfa->states[0]) {
+    /* A state duplicated in a callback may not have been given any input
+     * since, and must first get to where orig was. */
+    if(s->callback == GZL_ERROR_CALLBACK)
+        return false;
+    if(s->rtn_term_offset >= 0 || s->offset.byte < s->buf_offset) {
+        enum gzl_status status = parse(s, NULL, 0);
+        if(status != GZL_STATUS_OK && status != GZL_STATUS_HARD_EOF)
+            return false;
+    }
+
+    /* First deal with the lexer if it is running.  Its IntFA must be in a
+     * start state (in which case we back it out), a final state (in which
+     * case we recognize and process the terminal), or both (in which case we
+     * back out iff. we are in a GLA state with an EOF transition out).
+     *
+     * If it is in neither, but passed a final state earlier on, we back up
+     * to there and lex the rest of the input again. */
+    while(s->intfa && !s->intfa_state->final &&
+          s->intfa_state != &s->intfa->states[0]) {
+        enum gzl_status status;
+        if(!back_up_to_longest_match(s, &status))
+            return false;
+        if(status == GZL_STATUS_OK)
+            status = relex_carried_bytes(s);
+        if(status != GZL_STATUS_OK)
+            return false;
+    }
+    if(s->intfa) {
+        if(s->intfa_state->final &&
+           s->intfa_state == &s->intfa->states[0]) {
             /* TODO: handle this case. */
             assert(false);
-        } else if(intfa_frame->intfa_state->final) {
-            process_terminal(s, intfa_frame->intfa_state->final,
-                             &frame->start_offset,
-                             s->offset.byte - frame->start_offset.byte);
-        } else if(intfa_frame->intfa_state == &intfa_frame->intfa->states[0]) {
-            /* Pop the frame like it never happened. */
-            pop_intfa_frame(s);
+        } else if(s->intfa_state->final) {
+            if(process_intfa_terminal(s, s->intfa_state) ==
+               GZL_STATUS_RESOURCE_LIMIT_EXCEEDED)
+                return false;
+        } else if(s->intfa_state == &s->intfa->states[0]) {
+            /* Stop the lexer like it never started. */
+            s->intfa = NULL;
         } else {
             /* IntFA is in neither a start nor a final state.
              * This cannot be EOF. */
@@ -642,11 +1850,29 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
         }
     }
 
+    /* If the parser is waiting for a terminal to descend at (see
+     * run_parser()), there won't be one, so it descends now, pushing any
+     * GLA frame the descent reaches for below. */
+    if(!s->intfa && s->private_stack_len > 0 &&
+       DYNARRAY_GET_TOP(s->private_stack)->frame_type == GZL_FRAME_TYPE_RTN) {
+        struct gzl_rtn_state *rtn_state =
+            DYNARRAY_GET_TOP(s->private_stack)->f.rtn_frame.rtn_state;
+        if((rtn_state->op == GZL_RTN_OP_DESCEND ||
+            rtn_state->op == GZL_RTN_OP_CALL) && rtn_state->descend_intfa) {
+            s->rtn_term_offset = 0;
+            s->gla_term_offset = s->token_buffer_len;
+            if(run_token_buffer(s) == GZL_STATUS_RESOURCE_LIMIT_EXCEEDED)
+                return false;
+        }
+    }
+
     /* Next deal with an open GLA frame if there is one.  The frame must be in
      * a start state or have an outgoing EOF transition, else we are not at
      * valid EOF. */
-    frame = DYNARRAY_GET_TOP(s->parse_stack);
-    if(frame->frame_type == GZL_FRAME_TYPE_GLA) {
+    struct gzl_parse_stack_frame *frame = NULL;
+    if(s->private_stack_len > 0)
+        frame = DYNARRAY_GET_TOP(s->private_stack);
+    if(frame && frame->frame_type == GZL_FRAME_TYPE_GLA) {
         struct gzl_gla_frame *gla_frame = &frame->f.gla_frame;
         if(gla_frame->gla_state == &gla_frame->gla->states[0]) {
             /* GLA is in a start state -- fine, we can just pop it as
@@ -656,16 +1882,16 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
             /* For this to still be valid EOF, this GLA state must have an
              * outgoing EOF transition, and we must take it now. */
             struct gzl_gla_transition *t =
-                find_gla_transition(gla_frame->gla_state, NULL);
+                find_gla_transition(gla_frame->gla_state, GZL_EOF_TERMINAL_ID);
             if(!t) return false;
 
-            /* process_terminal() wants an IntFA frame to pop. */
-            push_empty_frame(s, GZL_FRAME_TYPE_INTFA, &s->offset);
-            process_terminal(s, NULL, &s->offset, 0);
+            if(process_terminal(s, NULL, GZL_EOF_TERMINAL_ID, &s->offset, 0) ==
+               GZL_STATUS_RESOURCE_LIMIT_EXCEEDED)
+                return false;
 
             /* Pop any GLA states that the previous may have pushed. */
-            while(s->parse_stack_len > 0 &&
-                  DYNARRAY_GET_TOP(s->parse_stack)->frame_type !=
+            while(s->private_stack_len > 0 &&
+                  DYNARRAY_GET_TOP(s->private_stack)->frame_type !=
                   GZL_FRAME_TYPE_RTN)
                 pop_frame(s);
         }
@@ -674,79 +1900,432 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
     /* Now we should have only RTN frames open.  Starting from the top, check
      * that each frame's dest_state is a final state (or the actual current
      * state in the bottommost frame). */
-    if(s->parse_stack_len > 0) { /* will be 0 if we already hit hard EOF. */
-        for(int i = 0; i < s->parse_stack_len - 1; i++) {
-            frame = &s->parse_stack[i];
-            assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
-            struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-            assert(rtn_frame->rtn_transition);
-            if(!rtn_frame->rtn_transition->dest_state->is_final) return false;
+    if(s->private_stack_len > 0) { /* will be 0 if we already hit hard EOF. */
+        for(int i = 0; i < s->private_stack_len - 1; i++)
+            if(!rtn_frame_can_end(&s->private_stack[i])) return false;
+        int len = s->shared_stack_len;
+        for(struct gzl_stack_segment *seg = s->shared_stack; len > 0;
+            seg = seg->below) {
+            for(int i = 0; i < len - seg->below_len; i++)
+                if(!rtn_frame_can_end(&seg->frames[i])) return false;
+            len = seg->below_len;
         }
 
-        frame = DYNARRAY_GET_TOP(s->parse_stack);
+        frame = DYNARRAY_GET_TOP(s->private_stack);
         struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
         if(!rtn_frame->rtn_state->is_final) return false;
 
         /* We are truly in a state where EOF is ok.  Pop remaining RTN frames to
          * call callbacks appropriately. */
-        while(s->parse_stack_len > 0)
+        while(s->private_stack_len > 0)
         {
             /* What should we do if the user cancels while the final RTN frames
              * are being popped?  It's kind of a weird thing to do.  Options
              * are to ignore it (we're finishing the parse anyway) or to stop.
              * For now we ignore. */
-            pop_rtn_frame(s);
+            if(pop_rtn_frame(s) == GZL_STATUS_RESOURCE_LIMIT_EXCEEDED)
+                return false;
         }
     }
 
     return true;
 }
 
+enum gzl_status gzl_parse(struct gzl_parse_state *s, const char *buf,
+                          size_t buf_len)
+{
+    assert(s != NULL);
+    return parse(s, buf, buf_len);
+}
+
+bool gzl_finish_parse(struct gzl_parse_state *s)
+{
+    s->finishing = true;
+    bool ok = finish_parse(s);
+    s->finishing = false;
+    return ok;
+}
+
+bool gzl_resolve_offset(struct gzl_parse_state *s, struct gzl_offset *offset)
+{
+    /* Outside of lazy_lines mode the parser already filled these in. */
+    if(!s->lazy_lines)
+        return true;
+
+    size_t byte = offset->byte;
+    if(byte > s->newline_index_end) {
+        if(!s->buf || byte > s->buf_offset + s->buf_len)
+            return false;
+        if(!index_newlines(s, byte))
+            return false;
+    }
+
+    /* Find how many newline runs start before this byte. */
+    struct gzl_newline_run *run;
+    offset->line = newline_runs_before(s, byte, &run) + 1;
+    if(!run) {
+        offset->column = byte + 1;
+    } else {
+        /* Columns count from the end of the last newline run, or are 1 in
+         * the middle of one (eg. between a CR and an LF). */
+        size_t line_start = run->end;
+        if(line_start > byte)
+            line_start = byte;
+        offset->column = byte - line_start + 1;
+    }
+    return true;
+}
+
+int gzl_stack_depth(struct gzl_parse_state *s)
+{
+    return s->shared_stack_len + s->private_stack_len;
+}
+
+struct gzl_parse_stack_frame *gzl_stack_frame_at(struct gzl_parse_state *s,
+                                                 int i)
+{
+    assert(i >= 0 && i < gzl_stack_depth(s));
+    if(i >= s->shared_stack_len)
+        return &s->private_stack[i - s->shared_stack_len];
+    struct gzl_stack_segment *seg = find_stack_segment(s, i);
+    return &seg->frames[i - seg->below_len];
+}
+
+struct gzl_offset *gzl_stack_frame_start_offset_at(struct gzl_parse_state *s,
+                                                   int i)
+{
+    assert(i >= 0 && i < gzl_stack_depth(s));
+    if(i >= s->shared_stack_len)
+        return &s->private_start_offsets[i - s->shared_stack_len];
+    struct gzl_stack_segment *seg = find_stack_segment(s, i);
+    return &seg->frame_start_offsets[i - seg->below_len];
+}
+
 struct gzl_parse_state *gzl_alloc_parse_state()
 {
-    struct gzl_parse_state *state = malloc(sizeof(*state));
-    INIT_DYNARRAY(state->parse_stack, 0, 16);
-    INIT_DYNARRAY(state->token_buffer, 0, 2);
+    return gzl_alloc_parse_state_with(NULL);
+}
+
+struct gzl_parse_state *gzl_alloc_parse_state_with(struct gzl_allocator *alloc)
+{
+    struct gzl_parse_state *state = gzl_alloc(alloc, sizeof(*state));
+    if(!state)
+        return NULL;
+    state->alloc = alloc;
+    INIT_DYNARRAY_IN(alloc, state->private_stack, 0, 16);
+    state->private_start_offsets =
+        gzl_alloc(alloc, state->private_stack_size *
+                         sizeof(*state->private_start_offsets));
+    state->shared_stack = NULL;
+    state->shared_stack_len = 0;
+    state->token_buffer_head = 0;
+    state->token_buffer_len = 0;
+    state->token_buffer_size = 2;
+    state->token_buffer =
+        gzl_alloc(alloc, state->token_buffer_size *
+                         sizeof(*state->token_buffer));
+    INIT_DYNARRAY_IN(alloc, state->newline_index, 0, 16);
+    state->shared_newlines = NULL;
+    state->shared_newlines_len = 0;
+    INIT_DYNARRAY_IN(alloc, state->carry, 0, 64);
+    state->munch_memo = NULL;
+    state->munch_memo_size = 0;
+    state->munch_memo_count = 0;
+    INIT_DYNARRAY_IN(alloc, state->tape_overflow, 0, 16);
+
+    if(!state->private_stack || !state->private_start_offsets ||
+       !state->token_buffer || !state->newline_index || !state->carry ||
+       !state->tape_overflow) {
+        gzl_free_parse_state(state);
+        return NULL;
+    }
     return state;
 }
 
-struct gzl_parse_state *gzl_dup_parse_state(struct gzl_parse_state *orig)
+static
+void *dup_memory(struct gzl_allocator *alloc, const void *ptr, size_t size)
 {
-    struct gzl_parse_state *copy = malloc(sizeof(*copy));
-    /* This erroneously copies pointers to dynarrays, but we'll fix in a sec. */
-    *copy = *orig;
+    void *copy = gzl_alloc(alloc, size);
+    if(copy)
+        memcpy(copy, ptr, size);
+    return copy;
+}
 
-    INIT_DYNARRAY(copy->parse_stack, 0, 16);
-    RESIZE_DYNARRAY(copy->parse_stack, orig->parse_stack_len);
-    for(int i = 0; i < orig->parse_stack_len; i++)
-        copy->parse_stack[i] = orig->parse_stack[i];
+/*
+ * share_stack(): gives copy (a new duplicate of orig) a parse stack of its
+ * own with just orig's top frame in it, and has the two of them share the
+ * frames below.  If orig has frames below the top in its private_stack, they
+ * become a new shared segment, which takes over orig's private_stack (so that
+ * none of them are copied), and orig gets a new one as big as the old one.
+ * Returns false, having changed nothing, if there is no memory.
+ */
+static
+bool share_stack(struct gzl_parse_state *orig, struct gzl_parse_state *copy)
+{
+    struct gzl_allocator *alloc = orig->alloc;
+    int len = orig->private_stack_len;
+    struct gzl_stack_segment *seg = NULL;
+    struct gzl_parse_stack_frame *frames = NULL;
+    struct gzl_offset *offsets = NULL;
+
+    INIT_DYNARRAY_IN(alloc, copy->private_stack, 0, 16);
+    copy->private_start_offsets =
+        gzl_alloc(alloc, copy->private_stack_size *
+                         sizeof(*copy->private_start_offsets));
+    if(len > 1) {
+        seg = gzl_alloc(alloc, sizeof(*seg));
+        frames = gzl_alloc(alloc, orig->private_stack_size * sizeof(*frames));
+        offsets = gzl_alloc(alloc,
+                            orig->private_stack_size * sizeof(*offsets));
+    }
+    if(!copy->private_stack || !copy->private_start_offsets ||
+       (len > 1 && (!seg || !frames || !offsets))) {
+        gzl_free(alloc, offsets);
+        gzl_free(alloc, frames);
+        gzl_free(alloc, seg);
+        gzl_free(alloc, copy->private_start_offsets);
+        FREE_DYNARRAY_IN(alloc, copy->private_stack);
+        copy->private_stack = NULL;
+        copy->private_start_offsets = NULL;
+        return false;
+    }
+
+    if(len > 1) {
+        /* The new segment takes over orig's reference to the one below. */
+        seg->refcount = 1;
+        seg->len = len - 1;
+        seg->frames = orig->private_stack;
+        seg->frame_start_offsets = orig->private_start_offsets;
+        seg->below = orig->shared_stack;
+        seg->below_len = orig->shared_stack_len;
+        seg->alloc = alloc;
+
+        frames[0] = orig->private_stack[len - 1];
+        offsets[0] = orig->private_start_offsets[len - 1];
+        orig->private_stack = frames;
+        orig->private_start_offsets = offsets;
+        orig->private_stack_len = 1;
+        orig->shared_stack = seg;
+        orig->shared_stack_len += len - 1;
+    }
+
+    if(orig->private_stack_len > 0) {
+        copy->private_stack[0] = orig->private_stack[0];
+        copy->private_start_offsets[0] = orig->private_start_offsets[0];
+        copy->private_stack_len = 1;
+    }
+    copy->shared_stack = orig->shared_stack;
+    copy->shared_stack_len = orig->shared_stack_len;
+    if(copy->shared_stack)
+        retain_stack_segment(copy->shared_stack);
+    return true;
+}
+
+/*
+ * copy_stack(): like share_stack(), but for when orig's frames must stay
+ * where they are: copy gets its own copy of orig's private_stack, and only
+ * the frames below it are shared.
+ */
+static
+bool copy_stack(struct gzl_parse_state *orig, struct gzl_parse_state *copy)
+{
+    struct gzl_allocator *alloc = orig->alloc;
+    int len = orig->private_stack_len;
+
+    INIT_DYNARRAY_IN(alloc, copy->private_stack, len,
+                     orig->private_stack_size);
+    copy->private_start_offsets =
+        gzl_alloc(alloc, copy->private_stack_size *
+                         sizeof(*copy->private_start_offsets));
+    if(!copy->private_stack || !copy->private_start_offsets) {
+        gzl_free(alloc, copy->private_start_offsets);
+        FREE_DYNARRAY_IN(alloc, copy->private_stack);
+        copy->private_stack = NULL;
+        copy->private_start_offsets = NULL;
+        return false;
+    }
+
+    memcpy(copy->private_stack, orig->private_stack,
+           len * sizeof(*copy->private_stack));
+    memcpy(copy->private_start_offsets, orig->private_start_offsets,
+           len * sizeof(*copy->private_start_offsets));
+    copy->shared_stack = orig->shared_stack;
+    copy->shared_stack_len = orig->shared_stack_len;
+    if(copy->shared_stack)
+        retain_stack_segment(copy->shared_stack);
+    return true;
+}
+
+/*
+ * share_newline_index(): like share_stack(), for the newline index.  The
+ * last run stays private to both orig and copy, since index_newline() may
+ * make it longer, and orig's new newline_index starts small again.  Returns
+ * false, having changed nothing, if there is no memory.
+ */
+static
+bool share_newline_index(struct gzl_parse_state *orig,
+                         struct gzl_parse_state *copy)
+{
+    struct gzl_allocator *alloc = orig->alloc;
+    int len = orig->newline_index_len;
+    struct gzl_newline_segment *seg = NULL;
+    struct gzl_newline_run *runs = NULL;
+
+    INIT_DYNARRAY_IN(alloc, copy->newline_index, 0, 16);
+    if(len > 1) {
+        seg = gzl_alloc(alloc, sizeof(*seg));
+        runs = gzl_alloc(alloc, copy->newline_index_size * sizeof(*runs));
+    }
+    if(!copy->newline_index || (len > 1 && (!seg || !runs))) {
+        gzl_free(alloc, runs);
+        gzl_free(alloc, seg);
+        FREE_DYNARRAY_IN(alloc, copy->newline_index);
+        copy->newline_index = NULL;
+        return false;
+    }
+
+    if(len > 1) {
+        /* The new segment takes over orig's reference to the one below. */
+        seg->refcount = 1;
+        seg->len = len - 1;
+        seg->runs = orig->newline_index;
+        seg->below = orig->shared_newlines;
+        seg->below_len = orig->shared_newlines_len;
+        seg->alloc = alloc;
+
+        runs[0] = orig->newline_index[len - 1];
+        orig->newline_index = runs;
+        orig->newline_index_len = 1;
+        orig->newline_index_size = copy->newline_index_size;
+        orig->shared_newlines = seg;
+        orig->shared_newlines_len += len - 1;
+    }
+
+    if(orig->newline_index_len > 0) {
+        copy->newline_index[0] = orig->newline_index[0];
+        copy->newline_index_len = 1;
+    }
+    copy->shared_newlines = orig->shared_newlines;
+    copy->shared_newlines_len = orig->shared_newlines_len;
+    if(copy->shared_newlines)
+        retain_newline_segment(copy->shared_newlines);
+    return true;
+}
 
-    INIT_DYNARRAY(copy->token_buffer, 0, 2);
-    RESIZE_DYNARRAY(copy->token_buffer, orig->token_buffer_len);
-    for(int i = 0; i < orig->token_buffer_len; i++)
-        copy->token_buffer[i] = orig->token_buffer[i];
+/*
+ * carry_rest_of_buffer(): for a copy made in a callback from gzl_parse(),
+ * carries the input from where orig's lexer is up to byte resume, where the
+ * client will start giving the copy input.  Leaves copy->carry NULL if there
+ * is no memory for it.
+ */
+static
+void carry_rest_of_buffer(struct gzl_parse_state *orig,
+                          struct gzl_parse_state *copy, size_t resume)
+{
+    size_t start = orig->intfa ? orig->intfa_start_offset.byte :
+                                 orig->offset.byte;
+    int len = (int)(resume - start);
+    int size = orig->carry_size;
+    while(size < len)
+        size *= 2;
+
+    INIT_DYNARRAY_IN(orig->alloc, copy->carry, len, size);
+    if(!copy->carry)
+        return;
+    for(int i = 0; i < len; i++)
+        copy->carry[i] = input_byte(orig, start + i);
+    copy->carry_offset = start;
+    copy->buf = NULL;
+    copy->buf_len = 0;
+    copy->buf_offset = resume;
+}
 
+struct gzl_parse_state *gzl_dup_parse_state(struct gzl_parse_state *orig)
+{
+    /* gzl_finish_parse() cannot stop partway for a copy to carry on from. */
+    if(orig->finishing)
+        return NULL;
+    struct gzl_allocator *alloc = orig->alloc;
+
+    /* From a callback, the copy has to be told about the newlines in the
+     * input that the client has already given orig. */
+    size_t resume = orig->offset.byte > orig->buf_offset ?
+                    orig->offset.byte : orig->buf_offset;
+    if(orig->buf && orig->lazy_lines && !index_newlines(orig, resume))
+        return NULL;
+    struct gzl_parse_state *copy = gzl_alloc(alloc, sizeof(*copy));
+    if(!copy)
+        return NULL;
+    /* This erroneously copies pointers to dynarrays, but we'll fix in a sec. */
+    *copy = *orig;
+    copy->private_stack = NULL;
+    copy->private_start_offsets = NULL;
+    copy->shared_stack = NULL;
+    copy->shared_stack_len = 0;
+    copy->newline_index = NULL;
+    copy->shared_newlines = NULL;
+    copy->shared_newlines_len = 0;
+    copy->carry = NULL;
+    if(copy->callback == GZL_DID_END_RULE_CALLBACK)
+        copy->callback = GZL_NO_CALLBACK;
+
+    copy->token_buffer =
+        dup_memory(alloc, orig->token_buffer,
+                   orig->token_buffer_size * sizeof(*orig->token_buffer));
+    if(orig->buf)
+        carry_rest_of_buffer(orig, copy, resume);
+    else
+        copy->carry = dup_memory(alloc, orig->carry, orig->carry_size);
+
+    /* The munch memo only saves lexing input again, and can be big. */
+    copy->munch_memo = NULL;
+    copy->munch_memo_size = 0;
+    copy->munch_memo_count = 0;
+    copy->munch_memo_end = 0;
+
+    /* The client's event tape belongs to orig; the copy gets none until the
+     * client sets it one.  Events waiting for orig's next tape will also go
+     * on the copy's first one. */
+    copy->tape = NULL;
+    copy->tape_size = 0;
+    copy->tape_len = 0;
+    copy->tape_overflow =
+        dup_memory(alloc, orig->tape_overflow,
+                   orig->tape_overflow_size * sizeof(*orig->tape_overflow));
+
+    if(!copy->token_buffer || !copy->carry || !copy->tape_overflow ||
+       !share_newline_index(orig, copy) ||
+       /* did_end_rule_cb has a pointer to orig's frame that ended. */
+       !(orig->callback == GZL_DID_END_RULE_CALLBACK ?
+         copy_stack(orig, copy) : share_stack(orig, copy))) {
+        gzl_free_parse_state(copy);
+        return NULL;
+    }
     return copy;
 }
 
 void gzl_free_parse_state(struct gzl_parse_state *s)
 {
-    FREE_DYNARRAY(s->parse_stack);
-    FREE_DYNARRAY(s->token_buffer);
-    free(s);
+    struct gzl_allocator *alloc = s->alloc;
+    FREE_DYNARRAY_IN(alloc, s->private_stack);
+    gzl_free(alloc, s->private_start_offsets);
+    release_stack_segment(s->shared_stack);
+    gzl_free(alloc, s->token_buffer);
+    FREE_DYNARRAY_IN(alloc, s->newline_index);
+    release_newline_segment(s->shared_newlines);
+    FREE_DYNARRAY_IN(alloc, s->carry);
+    gzl_free(alloc, s->munch_memo);
+    FREE_DYNARRAY_IN(alloc, s->tape_overflow);
+    gzl_free(alloc, s);
 }
 
 void gzl_init_parse_state(struct gzl_parse_state *s,
                           struct gzl_bound_grammar *bg)
 {
-    s->offset.byte = 0;
-    s->offset.line = 1;
-    s->offset.column = 1;
-    s->open_terminal_offset = s->offset;
-    s->last_char_was_newline = false;
     s->bound_grammar = bg;
-    RESIZE_DYNARRAY(s->parse_stack, 0);
-    RESIZE_DYNARRAY(s->token_buffer, 0);
+    s->lazy_lines = false;
+    s->tape = NULL;
+    s->tape_size = 0;
 
     /* Currently each stack frame takes 28 bytes on a 32-bit machine, so a
      * stack depth of 500 is a modest 14kb of RAM.  500 frames of recursion is
@@ -757,14 +2336,187 @@ void gzl_init_parse_state(struct gzl_parse_state *s,
      * a lookahead depth of 500 is 10kb of RAM.  Input text would have to be
      * truly pathological to require this much lookahead. */
     s->max_lookahead = 500;
+
+    gzl_reset_parse_state(s);
+}
+
+void gzl_reset_parse_state(struct gzl_parse_state *s)
+{
+    s->offset.byte = 0;
+    s->offset.line = 1;
+    s->offset.column = 1;
+    s->open_terminal_offset = s->offset;
+    s->last_char_was_newline = false;
+    SHRINK_DYNARRAY(s->private_stack, 0);
+    release_stack_segment(s->shared_stack);
+    s->shared_stack = NULL;
+    s->shared_stack_len = 0;
+    s->intfa = NULL;
+    s->token_buffer_head = 0;
+    s->token_buffer_len = 0;
+
+    SHRINK_DYNARRAY(s->newline_index, 0);
+    release_newline_segment(s->shared_newlines);
+    s->shared_newlines = NULL;
+    s->shared_newlines_len = 0;
+    s->newline_index_end = 0;
+    s->buf = NULL;
+    s->buf_len = 0;
+    s->buf_offset = 0;
+    s->finishing = false;
+    s->callback = GZL_NO_CALLBACK;
+    s->rtn_term_offset = -1;
+
+    SHRINK_DYNARRAY(s->carry, 0);
+    s->carry_offset = 0;
+    clear_munch_memo(s);
+
+    s->tape_len = 0;
+    SHRINK_DYNARRAY(s->tape_overflow, 0);
+}
+
+/* The calling thread's pool of parse states for gzl_acquire_parse_state().
+ * Without thread-local storage there is no pool, and acquiring and releasing
+ * a state just allocates and frees it. */
+#define PARSE_STATE_POOL_SIZE 8
+#if defined(__GNUC__)
+#define GZL_PARSE_STATE_POOL
+static __thread struct gzl_parse_state *parse_state_pool[PARSE_STATE_POOL_SIZE];
+static __thread int parse_state_pool_len;
+#endif
+
+struct gzl_parse_state *gzl_acquire_parse_state(struct gzl_bound_grammar *bg)
+{
+    struct gzl_parse_state *s = NULL;
+#ifdef GZL_PARSE_STATE_POOL
+    if(parse_state_pool_len > 0)
+        s = parse_state_pool[--parse_state_pool_len];
+#endif
+    if(!s && !(s = gzl_alloc_parse_state()))
+        return NULL;
+    s->user_data = NULL;
+    gzl_init_parse_state(s, bg);
+    return s;
+}
+
+void gzl_release_parse_state(struct gzl_parse_state *s)
+{
+#ifdef GZL_PARSE_STATE_POOL
+    if(s->alloc == NULL && parse_state_pool_len < PARSE_STATE_POOL_SIZE) {
+        /* A pooled state must not keep the client's pointers, or hold on to
+         * stack or newline segments that its copies would free. */
+        gzl_reset_parse_state(s);
+        s->user_data = NULL;
+        s->tape = NULL;
+        s->tape_size = 0;
+        parse_state_pool[parse_state_pool_len++] = s;
+        return;
+    }
+#endif
+    gzl_free_parse_state(s);
+}
+
+void gzl_drain_parse_state_pool()
+{
+#ifdef GZL_PARSE_STATE_POOL
+    while(parse_state_pool_len > 0)
+        gzl_free_parse_state(parse_state_pool[--parse_state_pool_len]);
+#endif
+}
+
+void gzl_set_event_tape(struct gzl_parse_state *s,
+                        struct gzl_event *tape, size_t tape_size)
+{
+    assert(tape == NULL || tape_size > 0);
+    s->tape = tape;
+    s->tape_size = tape ? tape_size : 0;
+    s->tape_len = 0;
+
+    /* Events that did not fit on the last tape go first. */
+    size_t n = s->tape_overflow_len;
+    if(n > s->tape_size)
+        n = s->tape_size;
+    if(n > 0) {
+        memcpy(s->tape, s->tape_overflow, n * sizeof(*s->tape));
+        memmove(s->tape_overflow, s->tape_overflow + n,
+                (s->tape_overflow_len - n) * sizeof(*s->tape));
+        SHRINK_DYNARRAY(s->tape_overflow, s->tape_overflow_len - (int)n);
+        s->tape_len = n;
+    }
+}
+
+/*
+ * alloc_subscriptions(): allocates a subscription array of n entries, all
+ * false, from the grammar's allocator, which bg remembers so that
+ * gzl_clear_subscriptions() does not need the grammar.  Returns NULL if there
+ * is no memory.
+ */
+static
+bool *alloc_subscriptions(struct gzl_bound_grammar *bg, int n)
+{
+    /* Both arrays have to come from the same allocator. */
+    if(!bg->rule_subscribed && !bg->terminal_subscribed)
+        bg->subscriptions_alloc = bg->grammar->alloc;
+    bool *subscribed = gzl_alloc(bg->subscriptions_alloc, n * sizeof(bool));
+    if(subscribed)
+        memset(subscribed, 0, n * sizeof(bool));
+    return subscribed;
+}
+
+bool gzl_subscribe_rule(struct gzl_bound_grammar *bg, const char *rule_name)
+{
+    struct gzl_grammar *g = bg->grammar;
+    for(int i = 0; i < g->num_rtns; i++) {
+        if(strcmp(g->rtns[i].name, rule_name) != 0)
+            continue;
+        if(!bg->rule_subscribed &&
+           !(bg->rule_subscribed = alloc_subscriptions(bg, g->num_rtns)))
+            return false;
+        bg->rule_subscribed[i] = true;
+        return true;
+    }
+    return false;
+}
+
+bool gzl_subscribe_terminal(struct gzl_bound_grammar *bg,
+                            const char *terminal_name)
+{
+    struct gzl_grammar *g = bg->grammar;
+    /* Terminal 0 is EOF, which has no name. */
+    for(int i = 1; i <= g->num_terminals; i++) {
+        if(strcmp(g->terminal_names[i], terminal_name) != 0)
+            continue;
+        if(!bg->terminal_subscribed &&
+           !(bg->terminal_subscribed =
+                 alloc_subscriptions(bg, g->num_terminals + 1)))
+            return false;
+        bg->terminal_subscribed[i] = true;
+        return true;
+    }
+    return false;
+}
+
+void gzl_clear_subscriptions(struct gzl_bound_grammar *bg)
+{
+    gzl_free(bg->subscriptions_alloc, bg->rule_subscribed);
+    gzl_free(bg->subscriptions_alloc, bg->terminal_subscribed);
+    bg->rule_subscribed = NULL;
+    bg->terminal_subscribed = NULL;
+    bg->subscriptions_alloc = NULL;
 }
 
 enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
                                FILE *file, void *user_data,
                                int max_buffer_size)
 {
-    struct gzl_buffer *buffer = malloc(sizeof(*buffer));
-    INIT_DYNARRAY(buffer->buf, 0, 4096);
+    struct gzl_buffer *buffer = gzl_alloc(state->alloc, sizeof(*buffer));
+    if(!buffer)
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    INIT_DYNARRAY_IN(state->alloc, buffer->buf, 0, 4096);
+    if(!buffer->buf) {
+        gzl_free(state->alloc, buffer);
+        return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+    }
     buffer->buf_offset = 0;
     buffer->bytes_parsed = 0;
     buffer->user_data = user_data;
@@ -782,14 +2534,20 @@ enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
         /* Make sure we have space for at least min_new_data new data. */
         size_t new_buf_size = buffer->buf_size;
         while(buffer->buf_len + min_new_data > new_buf_size)
-          buffer->buf_size *= 2;
+          new_buf_size *= 2;
         if(new_buf_size > max_buffer_size) {
             status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
             break;
         }
         if(new_buf_size != buffer->buf_size) {
+            char *new_buf = gzl_realloc(state->alloc, buffer->buf,
+                                        buffer->buf_size, new_buf_size);
+            if(!new_buf) {
+                status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+                break;
+            }
+            buffer->buf = new_buf;
             buffer->buf_size = new_buf_size;
-            buffer->buf = realloc(buffer->buf, new_buf_size);
         }
         size_t bytes_to_read = buffer->buf_size - buffer->buf_len;
 
@@ -851,8 +2609,8 @@ enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
             status = GZL_STATUS_PREMATURE_EOF_ERROR;
     }
 
-    FREE_DYNARRAY(buffer->buf);
-    free(buffer);
+    FREE_DYNARRAY_IN(state->alloc, buffer->buf);
+    gzl_free(state->alloc, buffer);
     return status;
 }
 
@@ -0,0 +1,708 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  gzltrace.c
+
+  A driver for tests/test_runtime.sh.  It parses a file a few bytes
+  at a time and prints every callback it gets (or event it reads off
+  the event tape), one per line, so that the script can compare the
+  runtime's output for one way of feeding it input against another.
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include <gazelle/parse.h>
+
+void usage()
+{
+    fprintf(stderr, "gzltrace -- Prints the callbacks the parser makes.\n");
+    fprintf(stderr, "Gazelle %s  %s.\n", GAZELLE_VERSION, GAZELLE_WEBPAGE);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: gzltrace [OPTIONS] GRAMMAR.gzc INFILE\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --chunk-size N  Pass the input to gzl_parse() N bytes at a time\n");
+    fprintf(stderr, "                  (default: all at once).\n");
+    fprintf(stderr, "  --jit           Compile the grammar to native code where supported.\n");
+    fprintf(stderr, "  --fork          At every chunk boundary, duplicate the parse state and\n");
+    fprintf(stderr, "                  check that the copies print what an unforked parse does.\n");
+    fprintf(stderr, "  --fork-in-callbacks N  Like --fork, in every Nth callback instead.\n");
+    fprintf(stderr, "  --lazy-lines    Parse in lazy_lines mode, and resolve the offsets printed.\n");
+    fprintf(stderr, "  --events        Print rules and terminals as the event tape records them.\n");
+    fprintf(stderr, "  --tape N        Like --events, but read them off an event tape of N events.\n");
+    fprintf(stderr, "  --subscribe NAME  Subscribe to the rule or terminal NAME (may be repeated).\n");
+    fprintf(stderr, "  --reset         Parse half the input, reset the state and parse it all.\n");
+    fprintf(stderr, "  --pool          Like --reset, but release the state to the pool and\n");
+    fprintf(stderr, "                  acquire it again instead.\n");
+    fprintf(stderr, "  --arena N       Allocate parse states from a heap arena with N-byte blocks.\n");
+    fprintf(stderr, "  --fixed-arena N Allocate parse states from a fixed arena of N bytes.\n");
+    fprintf(stderr, "  --fail-alloc N  Make the grammar's Nth allocation fail, and check\n");
+    fprintf(stderr, "                  that the loader gives back the ones before it.\n");
+    fprintf(stderr, "  --help          You're looking at it.\n");
+    fprintf(stderr, "\n");
+}
+
+/* The input, which the terminal callback prints the text of terminals
+ * from. */
+char *input;
+size_t input_len;
+
+/* The grammar's allocator: it counts the allocations that are live, and
+ * fails the fail_at'th one (counting from 1) if fail_at is not 0. */
+struct counting_allocator
+{
+    struct gzl_allocator allocator;
+    int count;
+    int fail_at;
+    int live;
+};
+
+void *counting_alloc(void *ctx, size_t size)
+{
+    struct counting_allocator *a = ctx;
+    if(++a->count == a->fail_at)
+        return NULL;
+    void *ptr = malloc(size);
+    if(ptr)
+        a->live++;
+    return ptr;
+}
+
+void *counting_realloc(void *ctx, void *ptr, size_t old_size,
+                       size_t new_size)
+{
+    (void)old_size;
+    if(!ptr)
+        return counting_alloc(ctx, new_size);
+    return realloc(ptr, new_size);
+}
+
+void counting_free(void *ctx, void *ptr)
+{
+    struct counting_allocator *a = ctx;
+    if(ptr)
+        a->live--;
+    free(ptr);
+}
+
+/* What the callbacks print goes into the trace of the parse state they are
+ * called for, its user_data. */
+struct trace
+{
+    DEFINE_DYNARRAY(text, char);
+};
+
+void trace_printf(struct gzl_parse_state *state, const char *fmt, ...)
+{
+    struct trace *trace = state->user_data;
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    int start = trace->text_len;
+    RESIZE_DYNARRAY(trace->text, start + len + 1);
+    va_start(args, fmt);
+    vsnprintf(trace->text + start, len + 1, fmt, args);
+    va_end(args);
+    trace->text_len--;  /* the NULL */
+}
+
+/* In lazy_lines mode the line and column come from the newline index, so
+ * the trace is the same either way. */
+void trace_offset(struct gzl_parse_state *state, struct gzl_offset *offset)
+{
+    struct gzl_offset resolved = *offset;
+    if(!gzl_resolve_offset(state, &resolved))
+        trace_printf(state, "unresolved ");
+    trace_printf(state, "%zu:%zu:%zu", resolved.byte, resolved.line,
+                 resolved.column);
+}
+
+/* With --events or --tape, rules and terminals are printed the way the event
+ * tape records them, which the callbacks can do too: the rule or terminal,
+ * and the byte offset and length of its text. */
+bool events;
+size_t tape_size;
+
+void trace_event(struct gzl_parse_state *state, struct gzl_event *event)
+{
+    struct gzl_grammar *g = state->bound_grammar->grammar;
+    switch(event->kind)
+    {
+      case GZL_EVENT_START_RULE:
+        trace_printf(state, "start %s %zu\n", g->rtns[event->id].name,
+                     event->offset);
+        break;
+
+      case GZL_EVENT_END_RULE:
+        trace_printf(state, "end %s %zu %zu\n", g->rtns[event->id].name,
+                     event->offset, event->len);
+        break;
+
+      case GZL_EVENT_TERMINAL:
+        /* One line per event, so that the script can pick some out. */
+        trace_printf(state, "terminal %s %zu \"", g->terminal_names[event->id],
+                     event->offset);
+        for(size_t i = event->offset; i < event->offset + event->len; i++)
+        {
+            if(input[i] == '\n')
+                trace_printf(state, "\\n");
+            else
+                trace_printf(state, "%c", input[i]);
+        }
+        trace_printf(state, "\"\n");
+        break;
+    }
+}
+
+/* Prints the events on state's tape, and those waiting for the next one,
+ * leaving the tape empty. */
+void drain_tape(struct gzl_parse_state *state)
+{
+    while(state->tape && state->tape_len > 0)
+    {
+        for(size_t i = 0; i < state->tape_len; i++)
+            trace_event(state, &state->tape[i]);
+        gzl_set_event_tape(state, state->tape, state->tape_size);
+    }
+}
+
+/* Gives state a tape of its own if there is to be one, and frees it with
+ * the state. */
+void give_tape(struct gzl_parse_state *state)
+{
+    if(tape_size > 0)
+        gzl_set_event_tape(state, malloc(tape_size * sizeof(struct gzl_event)),
+                           tape_size);
+}
+
+/* With --pool, states are acquired from the pool and released to it, and
+ * with --arena or --fixed-arena they are allocated from arena. */
+bool reset;
+bool pool;
+bool lazy_lines;
+struct gzl_arena arena;
+bool use_arena;
+void *fixed_arena_mem;
+
+struct gzl_parse_state *new_state(struct gzl_bound_grammar *bg,
+                                  struct trace *trace)
+{
+    struct gzl_parse_state *state;
+    if(pool)
+        state = gzl_acquire_parse_state(bg);
+    else
+        state = gzl_alloc_parse_state_with(use_arena ? &arena.allocator
+                                                     : NULL);
+    if(!state)
+    {
+        fprintf(stderr, "No memory for the parse state.\n");
+        exit(1);
+    }
+    if(!pool)
+        gzl_init_parse_state(state, bg);
+    state->lazy_lines = lazy_lines;
+    state->user_data = trace;
+    give_tape(state);
+    return state;
+}
+
+void free_state(struct gzl_parse_state *state)
+{
+    free(state->tape);
+    if(pool)
+        gzl_release_parse_state(state);
+    else
+        gzl_free_parse_state(state);
+}
+
+void check_forks(struct gzl_parse_state *state, size_t chunk_size,
+                 struct trace *reference);
+
+/* With --fork-in-callbacks, the parse state that forks in its callbacks (but
+ * not its copies, which would take quadratically longer), how often it does,
+ * and what it passes check_forks().  Forking in fewer than all of them lets
+ * its stack grow between forks. */
+struct gzl_parse_state *forking_state;
+int fork_every;
+int callbacks_since_fork;
+size_t fork_chunk_size;
+struct trace *fork_reference;
+
+void fork_in_callback(struct gzl_parse_state *state)
+{
+    /* gzl_finish_parse() has no way of carrying on in a copy. */
+    if(state != forking_state || state->finishing ||
+       ++callbacks_since_fork < fork_every)
+        return;
+    callbacks_since_fork = 0;
+    check_forks(state, fork_chunk_size, fork_reference);
+}
+
+void terminal_callback(struct gzl_parse_state *state,
+                       struct gzl_terminal *terminal)
+{
+    struct gzl_rtn_frame *rtn_frame = &GZL_STACK_TOP(state)->f.rtn_frame;
+    trace_printf(state, "terminal %s slot %s ", terminal->name,
+                 rtn_frame->rtn_transition->slotname);
+    trace_offset(state, &terminal->offset);
+    trace_printf(state, " \"%.*s\"\n", (int)terminal->len,
+                 input + terminal->offset.byte);
+    fork_in_callback(state);
+}
+
+/* The callbacks that print nothing are only there to fork in. */
+void will_start_rule_callback(struct gzl_parse_state *state,
+                              struct gzl_rtn *rtn, struct gzl_offset *offset)
+{
+    (void)rtn;
+    (void)offset;
+    fork_in_callback(state);
+}
+
+void start_rule_callback(struct gzl_parse_state *state)
+{
+    /* Walks down the stack, which sees frames that are not on top. */
+    int depth = gzl_stack_depth(state);
+    struct gzl_parse_stack_frame *frame =
+        gzl_stack_frame_at(state, depth - 1);
+    trace_printf(state, "start %s depth %d ", frame->f.rtn_frame.rtn->name,
+                 depth);
+    trace_offset(state, gzl_stack_frame_start_offset_at(state, depth - 1));
+    if(depth > 1)
+    {
+        frame = gzl_stack_frame_at(state, depth - 2);
+        trace_printf(state, " slot %s",
+                     frame->f.rtn_frame.rtn_transition->slotname);
+    }
+    trace_printf(state, "\n");
+    fork_in_callback(state);
+}
+
+void end_rule_callback(struct gzl_parse_state *state)
+{
+    int depth = gzl_stack_depth(state);
+    struct gzl_parse_stack_frame *frame = GZL_STACK_TOP(state);
+    trace_printf(state, "end %s ", frame->f.rtn_frame.rtn->name);
+    trace_offset(state, gzl_stack_frame_start_offset_at(state, depth - 1));
+    trace_printf(state, " ");
+    trace_offset(state, &state->offset);
+    trace_printf(state, "\n");
+    fork_in_callback(state);
+}
+
+/* Forking must leave the frame that ended where it was. */
+void did_end_rule_callback(struct gzl_parse_state *state,
+                           struct gzl_parse_stack_frame *frame)
+{
+    struct gzl_offset start = *GZL_FRAME_START_OFFSET(state, frame);
+    struct gzl_rtn *rtn = frame->f.rtn_frame.rtn;
+    fork_in_callback(state);
+    if(frame->f.rtn_frame.rtn != rtn ||
+       GZL_FRAME_START_OFFSET(state, frame)->byte != start.byte)
+        trace_printf(state, "end frame moved at %zu\n", state->offset.byte);
+}
+
+void event_terminal_callback(struct gzl_parse_state *state,
+                             struct gzl_terminal *terminal)
+{
+    struct gzl_event event = {GZL_EVENT_TERMINAL, terminal->id,
+                              terminal->offset.byte, terminal->len};
+    trace_event(state, &event);
+}
+
+void event_start_rule_callback(struct gzl_parse_state *state)
+{
+    struct gzl_parse_stack_frame *frame = GZL_STACK_TOP(state);
+    struct gzl_event event = {
+        GZL_EVENT_START_RULE,
+        frame->f.rtn_frame.rtn - state->bound_grammar->grammar->rtns,
+        GZL_FRAME_START_OFFSET(state, frame)->byte, 0
+    };
+    trace_event(state, &event);
+}
+
+void event_end_rule_callback(struct gzl_parse_state *state)
+{
+    struct gzl_parse_stack_frame *frame = GZL_STACK_TOP(state);
+    size_t start = GZL_FRAME_START_OFFSET(state, frame)->byte;
+    struct gzl_event event = {
+        GZL_EVENT_END_RULE,
+        frame->f.rtn_frame.rtn - state->bound_grammar->grammar->rtns,
+        start, state->offset.byte - start
+    };
+    trace_event(state, &event);
+}
+
+/* The error callbacks are called even with a tape, so they print the events
+ * before them first. */
+void error_char_callback(struct gzl_parse_state *state, int ch)
+{
+    drain_tape(state);
+    trace_printf(state, "error char 0x%02x ", ch);
+    trace_offset(state, &state->offset);
+    trace_printf(state, "\n");
+    fork_in_callback(state);
+}
+
+void error_terminal_callback(struct gzl_parse_state *state,
+                             struct gzl_terminal *terminal)
+{
+    drain_tape(state);
+    trace_printf(state, "error terminal %s ", terminal->name);
+    trace_offset(state, &terminal->offset);
+    trace_printf(state, "\n");
+    fork_in_callback(state);
+}
+
+void parse(struct gzl_parse_state *state, size_t chunk_size,
+           struct trace *reference);
+
+/* Duplicates state, and the copy again, and runs both copies to the end of
+ * the input, each with its own copy of the trace so far.  Their traces must
+ * match reference; if either does not, says so in state's trace.  With
+ * --tape, the events on state's tape go into the copies' traces, and the
+ * copies get tapes of their own for the events still waiting for state's
+ * next one. */
+void check_forks(struct gzl_parse_state *state, size_t chunk_size,
+                 struct trace *reference)
+{
+    struct gzl_parse_state *forks[2];
+    struct trace traces[2];
+    forks[0] = gzl_dup_parse_state(state);
+    forks[1] = forks[0] ? gzl_dup_parse_state(forks[0]) : NULL;
+    if(!forks[1])
+    {
+        trace_printf(state, "dup failed at %zu\n", state->offset.byte);
+        return;
+    }
+
+    struct trace *trace = state->user_data;
+    for(int i = 0; i < 2; i++)
+    {
+        INIT_DYNARRAY(traces[i].text, trace->text_len, trace->text_len + 1);
+        memcpy(traces[i].text, trace->text, trace->text_len);
+        forks[i]->user_data = &traces[i];
+        for(size_t j = 0; j < state->tape_len; j++)
+            trace_event(forks[i], &state->tape[j]);
+        give_tape(forks[i]);
+    }
+
+    /* The first copy finishes and is freed while the second still shares
+     * its stack. */
+    for(int i = 0; i < 2; i++)
+    {
+        parse(forks[i], chunk_size, NULL);
+        free_state(forks[i]);
+        if(traces[i].text_len != reference->text_len ||
+           memcmp(traces[i].text, reference->text, reference->text_len) != 0)
+            trace_printf(state, "fork %d at %zu differs\n", i,
+                         state->offset.byte);
+        FREE_DYNARRAY(traces[i].text);
+    }
+}
+
+/* Parses from state->buf_offset (which is state->offset unless state is a
+ * copy made in a callback) to the end of the input, chunk_size bytes at a
+ * time, and finishes the parse if it gets that far.  If reference is not
+ * NULL, calls check_forks() before every chunk, and before reading the
+ * tape, so that copies are made with events waiting for it. */
+void parse(struct gzl_parse_state *state, size_t chunk_size,
+           struct trace *reference)
+{
+    enum gzl_status status = GZL_STATUS_OK;
+    while(state->buf_offset < input_len &&
+          (status == GZL_STATUS_OK || status == GZL_STATUS_TAPE_FULL))
+    {
+        if(reference)
+            check_forks(state, chunk_size, reference);
+        drain_tape(state);
+        size_t len = input_len - state->buf_offset;
+        if(len > chunk_size)
+            len = chunk_size;
+        status = gzl_parse(state, input + state->buf_offset, len);
+    }
+    drain_tape(state);
+
+    if(status == GZL_STATUS_OK || status == GZL_STATUS_TAPE_FULL ||
+       status == GZL_STATUS_HARD_EOF)
+    {
+        bool finished = gzl_finish_parse(state);
+        drain_tape(state);
+        trace_printf(state, "finish %s ", finished ? "ok" : "failed");
+    }
+    else
+        trace_printf(state, "status %d ", status);
+    trace_offset(state, &state->offset);
+    trace_printf(state, "\n");
+}
+
+/* With --reset or --pool, leaves state partway through a parse, sharing its
+ * stack and newline index with a copy, and resets it or releases it and
+ * acquires it again.  Returns the state, which must then print what a fresh
+ * one does into trace, and must no longer share anything with the copy. */
+struct gzl_parse_state *start_again(struct gzl_parse_state *state,
+                                    struct trace *trace)
+{
+    struct gzl_bound_grammar *bg = state->bound_grammar;
+    struct trace scratch;
+    INIT_DYNARRAY(scratch.text, 0, 1024);
+    state->user_data = &scratch;
+    gzl_parse(state, input, input_len / 2);
+    drain_tape(state);
+    struct gzl_parse_state *copy = gzl_dup_parse_state(state);
+
+    bool shared = false;
+    if(reset)
+        gzl_reset_parse_state(state);
+    else
+        free_state(state);
+    if(copy)
+    {
+        shared = (copy->shared_stack && copy->shared_stack->refcount != 1) ||
+                 (copy->shared_newlines &&
+                  copy->shared_newlines->refcount != 1);
+        /* Not released, so that the state acquired next is the one that
+         * was. */
+        gzl_free_parse_state(copy);
+    }
+
+    if(reset)
+        state->user_data = trace;
+    else
+        state = new_state(bg, trace);
+    if(shared)
+        trace_printf(state, "still shared after starting again\n");
+    FREE_DYNARRAY(scratch.text);
+    return state;
+}
+
+char *read_file(const char *filename, size_t *len)
+{
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+        return NULL;
+
+    size_t size = 64 * 1024;
+    char *buf = malloc(size);
+    *len = 0;
+    while(true)
+    {
+        *len += fread(buf + *len, 1, size - *len, file);
+        if(*len < size)
+            break;
+        size *= 2;
+        buf = realloc(buf, size);
+    }
+    fclose(file);
+    return buf;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && strcmp(argv[1], "--help") == 0)
+    {
+        usage();
+        exit(0);
+    }
+
+    int arg_offset = 1;
+    size_t chunk_size = 0;
+    bool jit = false;
+    bool fork = false;
+    const char *subscriptions[64];
+    int num_subscriptions = 0;
+    struct counting_allocator alloc = {
+        {counting_alloc, counting_realloc, counting_free, &alloc}, 0, 0, 0
+    };
+    while(arg_offset < argc && argv[arg_offset][0] == '-')
+    {
+        if(strcmp(argv[arg_offset], "--chunk-size") == 0 &&
+           arg_offset + 1 < argc)
+            chunk_size = atoi(argv[++arg_offset]);
+        else if(strcmp(argv[arg_offset], "--jit") == 0)
+            jit = true;
+        else if(strcmp(argv[arg_offset], "--fork") == 0)
+            fork = true;
+        else if(strcmp(argv[arg_offset], "--fork-in-callbacks") == 0 &&
+                arg_offset + 1 < argc)
+            fork_every = atoi(argv[++arg_offset]);
+        else if(strcmp(argv[arg_offset], "--lazy-lines") == 0)
+            lazy_lines = true;
+        else if(strcmp(argv[arg_offset], "--events") == 0)
+            events = true;
+        else if(strcmp(argv[arg_offset], "--tape") == 0 &&
+                arg_offset + 1 < argc && atoi(argv[arg_offset + 1]) > 0)
+        {
+            events = true;
+            tape_size = atoi(argv[++arg_offset]);
+        }
+        else if(strcmp(argv[arg_offset], "--reset") == 0)
+            reset = true;
+        else if(strcmp(argv[arg_offset], "--pool") == 0)
+            pool = true;
+        else if(strcmp(argv[arg_offset], "--subscribe") == 0 &&
+                arg_offset + 1 < argc && num_subscriptions < 64)
+            subscriptions[num_subscriptions++] = argv[++arg_offset];
+        else if(strcmp(argv[arg_offset], "--arena") == 0 &&
+                arg_offset + 1 < argc)
+        {
+            gzl_init_arena(&arena, atoi(argv[++arg_offset]));
+            use_arena = true;
+        }
+        else if(strcmp(argv[arg_offset], "--fixed-arena") == 0 &&
+                arg_offset + 1 < argc)
+        {
+            size_t size = atoi(argv[++arg_offset]);
+            fixed_arena_mem = malloc(size);
+            gzl_init_fixed_arena(&arena, fixed_arena_mem, size);
+            use_arena = true;
+        }
+        else if(strcmp(argv[arg_offset], "--fail-alloc") == 0 &&
+                arg_offset + 1 < argc)
+            alloc.fail_at = atoi(argv[++arg_offset]);
+        else
+        {
+            fprintf(stderr, "Unrecognized option '%s'.\n", argv[arg_offset]);
+            usage();
+            exit(1);
+        }
+        arg_offset++;
+    }
+
+    if(arg_offset + 2 != argc)
+    {
+        fprintf(stderr, "Must specify grammar file and input file.\n");
+        usage();
+        return 1;
+    }
+
+#ifdef GZLTRACE_GRAMMAR
+    /* Built with the C that gzlc --emit-c generated from GRAMMAR.gzc, which
+     * defines the function GZLTRACE_GRAMMAR names (test_runtime.sh builds
+     * gzltrace this way too): the grammar comes from there instead. */
+    struct gzl_grammar *GZLTRACE_GRAMMAR();
+    struct gzl_grammar *g = GZLTRACE_GRAMMAR();
+#else
+    struct bc_read_stream *s = bc_rs_open_file(argv[arg_offset]);
+    if(!s)
+    {
+        fprintf(stderr, "Couldn't open bitcode file '%s'!\n",
+                argv[arg_offset]);
+        return 1;
+    }
+    struct gzl_grammar *g = gzl_load_grammar_with(s, &alloc.allocator);
+    bc_rs_close_stream(s);
+#endif
+    if(!g)
+    {
+        fprintf(stderr, "Couldn't load grammar '%s'.\n", argv[arg_offset]);
+        if(alloc.live != 0)
+        {
+            fprintf(stderr, "The loader leaked %d allocations.\n", alloc.live);
+            return 2;
+        }
+        return 1;
+    }
+
+    input = read_file(argv[arg_offset + 1], &input_len);
+    if(!input)
+    {
+        fprintf(stderr, "Couldn't open file '%s' for reading: %s\n",
+                argv[arg_offset + 1], strerror(errno));
+        return 1;
+    }
+    if(chunk_size == 0)
+        chunk_size = input_len;
+
+    struct gzl_bound_grammar bg = {
+        .grammar = g,
+        .terminal_cb = terminal_callback,
+        .did_start_rule_cb = start_rule_callback,
+        .will_end_rule_cb = end_rule_callback,
+        .error_char_cb = error_char_callback,
+        .error_terminal_cb = error_terminal_callback,
+    };
+    if(events)
+    {
+        bg.terminal_cb = event_terminal_callback;
+        bg.did_start_rule_cb = event_start_rule_callback;
+        bg.will_end_rule_cb = event_end_rule_callback;
+    }
+    if(fork_every > 0)
+    {
+        bg.will_start_rule_cb = will_start_rule_callback;
+        bg.did_end_rule_cb = did_end_rule_callback;
+    }
+    for(int i = 0; i < num_subscriptions; i++)
+    {
+        if(!gzl_subscribe_rule(&bg, subscriptions[i]) &&
+           !gzl_subscribe_terminal(&bg, subscriptions[i]))
+        {
+            fprintf(stderr, "No rule or terminal named '%s'.\n",
+                    subscriptions[i]);
+            return 1;
+        }
+    }
+    if(jit && !gzl_bind_grammar_jit(&bg))
+        fprintf(stderr, "No JIT on this platform; interpreting.\n");
+
+    /* Forked parses are checked against an unforked one. */
+    struct trace reference;
+    INIT_DYNARRAY(reference.text, 0, 1024);
+    if(fork || fork_every > 0)
+    {
+        struct gzl_parse_state *state = new_state(&bg, &reference);
+        parse(state, chunk_size, NULL);
+        free_state(state);
+    }
+
+    struct trace trace;
+    INIT_DYNARRAY(trace.text, 0, 1024);
+    struct gzl_parse_state *state = new_state(&bg, &trace);
+    if(reset || pool)
+        state = start_again(state, &trace);
+    if(fork_every > 0)
+    {
+        forking_state = state;
+        fork_chunk_size = chunk_size;
+        fork_reference = &reference;
+    }
+    parse(state, chunk_size, fork ? &reference : NULL);
+    fwrite(trace.text, 1, trace.text_len, stdout);
+
+    free_state(state);
+    gzl_drain_parse_state_pool();
+    if(use_arena && !arena.fixed)
+        gzl_free_arena(&arena);
+    free(fixed_arena_mem);
+    FREE_DYNARRAY(trace.text);
+    FREE_DYNARRAY(reference.text);
+    gzl_unbind_grammar_jit(&bg);
+    gzl_clear_subscriptions(&bg);
+    gzl_free_grammar(g);
+    free(input);
+    if(alloc.live != 0)
+    {
+        fprintf(stderr, "The grammar leaked %d allocations.\n", alloc.live);
+        return 2;
+    }
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
@@ -6,5 +6,6 @@ require "test_intfa"
 require "test_ll"
 require "test_minimize"
 require "test_misc"
+require "test_utf8"
 
 LuaUnit:run(unpack(arg))
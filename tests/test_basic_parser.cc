@@ -0,0 +1,157 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  test_basic_parser.cc
+
+  Checks that BasicParser<Handler> binds the callbacks for the hooks
+  Handler defines and no others, and that gazelle::Parser subclasses
+  still get every event, and that parseFile() parses what parse() does.
+  tests/test_runtime.sh runs it on a compiled grammar and an input that
+  parses.
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gazelle/BasicParser.hh>
+#include <gazelle/Parser.hh>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Defines only onTerminal, so only terminal_cb may be bound.
+class TerminalCounter : public gazelle::BasicParser<TerminalCounter> {
+ public:
+  TerminalCounter() : terminals(0) {}
+  void onTerminal(gzl_terminal *terminal) { terminals++; }
+  const gzl_bound_grammar &boundGrammar() { return boundGrammar_; }
+  int terminals;
+};
+
+// Overrides every hook of gazelle::Parser.
+class EventCounter : public gazelle::Parser {
+ public:
+  EventCounter() : willStart(0), didStart(0), willEnd(0), didEnd(0),
+                   terminals(0), errors(0) {}
+  virtual void onWillStartRule(gzl_rtn *rtn, const char *name,
+                               gzl_offset *offset) { willStart++; }
+  virtual void onDidStartRule(gzl_rtn_frame *frame, const char *name) {
+    didStart++;
+  }
+  virtual void onWillEndRule(gzl_rtn_frame *frame, const char *name) {
+    willEnd++;
+  }
+  virtual void onDidEndRule(gzl_rtn_frame *frame, const char *name) {
+    didEnd++;
+  }
+  virtual void onTerminal(gzl_terminal *terminal) { terminals++; }
+  virtual void onUnknownTransitionError(int ch) { errors++; }
+  virtual void onUnexpectedTerminalError(gzl_terminal *terminal) {
+    errors++;
+  }
+  const gzl_bound_grammar &boundGrammar() { return boundGrammar_; }
+  int willStart, didStart, willEnd, didEnd, terminals, errors;
+};
+
+// Overrides one hook of gazelle::Parser: the others are still bound, since
+// a subclass could override them at any time.
+class OneHookParser : public gazelle::Parser {
+ public:
+  virtual void onTerminal(gzl_terminal *terminal) {}
+  const gzl_bound_grammar &boundGrammar() { return boundGrammar_; }
+};
+
+bool allBound(const gzl_bound_grammar &bg) {
+  return bg.terminal_cb && bg.will_start_rule_cb && bg.did_start_rule_cb &&
+         bg.will_end_rule_cb && bg.did_end_rule_cb && bg.error_char_cb &&
+         bg.error_terminal_cb;
+}
+
+char *readFile(const char *filename, size_t *len) {
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  *len = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *buf = (char*)malloc(*len + 1);
+  *len = fread(buf, 1, *len, file);
+  fclose(file);
+  return buf;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: test_basic_parser GRAMMAR.gzc INFILE\n");
+    return 1;
+  }
+  gazelle::Grammar grammar;
+  if (!grammar.loadFile(argv[1])) {
+    fprintf(stderr, "Couldn't load grammar '%s'.\n", argv[1]);
+    return 1;
+  }
+  size_t len;
+  char *input = readFile(argv[2], &len);
+  if (!input || len == 0) {
+    fprintf(stderr, "Couldn't read '%s'.\n", argv[2]);
+    return 1;
+  }
+
+  TerminalCounter terminalCounter;
+  terminalCounter.setGrammar(&grammar);
+  const gzl_bound_grammar &bg = terminalCounter.boundGrammar();
+  check(bg.terminal_cb != NULL, "BasicParser binds the hook it defines");
+  check(!bg.will_start_rule_cb && !bg.did_start_rule_cb &&
+        !bg.will_end_rule_cb && !bg.did_end_rule_cb &&
+        !bg.error_char_cb && !bg.error_terminal_cb,
+        "BasicParser binds no hooks it does not define");
+  check(terminalCounter.parse(input, len, true) == GZL_STATUS_OK,
+        "BasicParser parses the input");
+
+  TerminalCounter fileCounter;
+  fileCounter.setGrammar(&grammar);
+  FILE *file = fopen(argv[2], "rb");
+  check(file && fileCounter.parseFile(file) == GZL_STATUS_OK,
+        "BasicParser parses the input file");
+  if (file)
+    fclose(file);
+  check(fileCounter.terminals == terminalCounter.terminals,
+        "parseFile() sees the terminals that parse() does");
+
+  EventCounter eventCounter;
+  eventCounter.setGrammar(&grammar);
+  check(allBound(eventCounter.boundGrammar()),
+        "Parser binds every hook");
+  check(eventCounter.parse(input, len, true) == GZL_STATUS_OK,
+        "Parser parses the input");
+  check(eventCounter.terminals == terminalCounter.terminals,
+        "Parser and BasicParser see the same terminals");
+  check(eventCounter.didStart > 0 &&
+        eventCounter.willStart == eventCounter.didStart &&
+        eventCounter.willEnd == eventCounter.didStart &&
+        eventCounter.didEnd == eventCounter.didStart,
+        "Parser gets every rule event");
+  check(eventCounter.errors == 0, "Parser gets no errors");
+
+  OneHookParser oneHookParser;
+  oneHookParser.setGrammar(&grammar);
+  check(allBound(oneHookParser.boundGrammar()),
+        "Parser binds every hook when a subclass overrides one");
+
+  free(input);
+  return failures == 0 ? 0 : 1;
+}
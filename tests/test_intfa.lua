@@ -112,3 +112,146 @@ function TestIntFA:test2()
   ]]
   )
 end
+
+function get_grammar(grammar_str)
+  local grammar = Grammar:new()
+  grammar:parse_source_string(grammar_str)
+  grammar:process()
+  grammar:minimize_rtns()
+  grammar:compute_lookahead()
+  grammar:generate_intfas()
+  return grammar
+end
+
+function get_intfas(grammar_str)
+  return get_grammar(grammar_str).master_intfas
+end
+
+TestKeywords = {}
+function TestKeywords:test_keyword_in_table()
+  -- "ab" is also an identifier, so only the identifier is in the DFA.
+  local intfas = get_intfas([[ s -> "ab" | .id=/[ab]+/; ]])
+  assert_equals(1, intfas:count())
+  local intfa = intfas:element_at(1)
+  for state in each(intfa:states()) do
+    assert_equals(false, state.final == "ab")
+  end
+
+  local keywords = intfa.keywords
+  assert_equals(1, #keywords)
+  local name, text, identifier, slot = unpack(keywords[1])
+  assert_equals("ab", name)
+  assert_equals("ab", text)
+  assert_equals("id", identifier)
+  assert_equals(keyword_hash("ab", keywords.multiplier) % keywords.size, slot)
+end
+
+function TestKeywords:test_keyword_without_identifier()
+  -- A state that only expects the keyword lexes it with the DFA, and one that
+  -- only expects the identifier never sees the keyword.
+  local intfas = get_intfas([[ s -> "ab" .id=/[ab]+/; ]])
+  assert_equals(2, intfas:count())
+  assert_equals(nil, intfas:element_at(1).keywords)
+  assert_equals(nil, intfas:element_at(2).keywords)
+end
+
+function TestKeywords:test_perfect_hash()
+  local keywords = {"and", "break", "do", "else", "elseif", "end", "false",
+                    "for", "function", "if", "in", "local", "nil", "not",
+                    "or", "repeat", "return", "then", "true", "until", "while"}
+  local multiplier, size, slots = perfect_hash(keywords)
+  local used = {}
+  for keyword in each(keywords) do
+    local slot = slots[keyword]
+    assert_equals(keyword_hash(keyword, multiplier) % size, slot)
+    assert_equals(nil, used[slot])
+    used[slot] = true
+  end
+end
+
+function TestKeywords:test_hash()
+  -- The runtime computes the same hash with 32-bit arithmetic.
+  assert_equals(105 * 31 + 102, keyword_hash("if", 31))
+  assert_equals(2174216192, keyword_hash(string.rep("\255", 6), 2047))
+end
+
+TestSkip = {}
+function TestSkip:test_allowed_terminals_are_skipped()
+  local intfas = get_intfas(
+  [[
+    s -> "x" "y";
+    ws -> .space=/ +/;
+    @allow ws s ... ws;
+  ]])
+
+  -- One IntFA lexes "x" and "y" and skips whitespace around them.  The other
+  -- is for after the last terminal, where "space" is still consumed as a
+  -- terminal so that the input can end with whitespace.
+  assert_equals(2, intfas:count())
+  local intfa = intfas:element_at(1)
+  assert_equals(true, intfa.termset:contains("x"))
+  assert_equals(true, intfa.termset:contains("y"))
+  assert_equals(true, intfa.skip_terms:contains("space"))
+  assert_equals(true, intfas:element_at(2).skip_terms:isempty())
+end
+
+function TestSkip:test_not_skipped_before_a_continuation()
+  -- Numbers as in sketches/json.gzl, where "[1 .5]" must be rejected.
+  local grammar = get_grammar(
+  [[
+    array -> "[" value *(,) "]";
+    value -> number | array;
+    number -> .integer=/[0-9]+/ .decimal=/\.[0-9]+/? .exponent=/e[0-9]+/?;
+    whitespace -> .space=/ +/;
+    @allow whitespace array ... number;
+  ]])
+
+  -- After the "1" the number could go on, so whitespace there is lexed as a
+  -- terminal, which ends the number, instead of being skipped.  Then the
+  -- array sees ".5" and the input is rejected.
+  local checked = 0
+  for state in each(grammar.rtns:get("number"):states()) do
+    if state.final and state:num_transitions() > 0 then
+      local intfa = state.intfa or state.gla.start.intfa
+      assert_equals(true, intfa.termset:contains("exponent"))
+      assert_equals(true, intfa.termset:contains("space"))
+      assert_equals(false, intfa.skip_terms:contains("space"))
+      checked = checked + 1
+    end
+  end
+  assert_equals(2, checked)
+end
+
+function TestSkip:test_shared_rule_outside_region()
+  -- "s" is called both from inside the @allow region and from outside it,
+  -- where "< x>" must still be rejected.
+  local grammar = get_grammar(
+  [[
+    t -> a | b;
+    a -> "(" s ")";
+    b -> "<" s ">";
+    s -> "x";
+    ws -> .space=/ +/;
+    @allow ws a ... s;
+  ]])
+
+  -- So the start of "s" doesn't skip whitespace...
+  local s_start = grammar.rtns:get("s").start
+  assert_equals(false, s_start.intfa.skip_terms:contains("space"))
+
+  -- ...and where "a" calls "s", the whitespace is consumed by an @allow
+  -- transition instead, as before the lexer skipped anything.
+  local allowed = 0
+  for state in each(grammar.rtns:get("a"):states()) do
+    for edge_val, dest_state, properties in state:transitions() do
+      if fa.is_nonterm(edge_val) and edge_val.name == "s" then
+        for edge_val in state:transitions() do
+          if fa.is_nonterm(edge_val) and edge_val.name == "ws" then
+            allowed = allowed + 1
+          end
+        end
+      end
+    end
+  end
+  assert_equals(1, allowed)
+end
@@ -0,0 +1,312 @@
+#!/bin/sh
+#
+# Checks the runtime by parsing the inputs in tests/grammars with
+# tests/gzltrace, which prints the callbacks the parser makes, and comparing
+# what it prints with the expected traces there, or one way of running the
+# parser with another.  "make test" builds gzltrace and runs this with
+# LUA_PATH set for the compiler.
+
+DIR=`mktemp -d /tmp/gazelle-test.XXXXXX` || exit 1
+trap 'rm -rf $DIR' EXIT
+CHECKS=0
+FAILED=0
+GZLTRACE=./tests/gzltrace
+
+# compile GRAMMAR: compiles tests/grammars/GRAMMAR.gzl to $DIR/GRAMMAR.gzc.
+compile() {
+  lua compiler/gzlc -o $DIR/$1.gzc tests/grammars/$1.gzl || exit 1
+}
+
+# check EXPECTED ARGS...: runs gzltrace (or $GZLTRACE) with ARGS, and fails
+# if it does not print exactly what is in the file EXPECTED.
+check() {
+  EXPECTED=$1
+  shift
+  CHECKS=`expr $CHECKS + 1`
+  $GZLTRACE "$@" > $DIR/trace
+  if ! cmp -s $EXPECTED $DIR/trace ; then
+    echo "FAILED: gzltrace $*"
+    diff $EXPECTED $DIR/trace | head -20
+    FAILED=`expr $FAILED + 1`
+  fi
+}
+
+# The lexer backs up to the longest terminal it passed, which may be in an
+# earlier buffer, so try the input split at every byte.
+compile munch
+LEN=`wc -c < tests/grammars/munch.in`
+for N in `seq 1 $LEN` ; do
+  check tests/grammars/munch.trace --chunk-size $N $DIR/munch.gzc \
+        tests/grammars/munch.in
+  check tests/grammars/munch.trace --jit --chunk-size $N $DIR/munch.gzc \
+        tests/grammars/munch.in
+done
+
+# check_jit EXPECTED GZC IN: the JIT must do exactly what the interpreter
+# does, whatever size of buffers it gets.
+check_jit() {
+  for N in 1 2 3 5 8 13 64 ; do
+    check $1 --chunk-size $N $2 $3
+    check $1 --jit --chunk-size $N $2 $3
+  done
+  check $1 --jit $2 $3
+}
+
+# lookahead.gzl runs the GLAs that the JIT compiles too, and one of its
+# inputs has an error in it.
+compile lookahead
+for IN in lookahead lookahead-error ; do
+  check_jit tests/grammars/$IN.trace $DIR/lookahead.gzc tests/grammars/$IN.in
+done
+
+# skip.gzl's rules start after whitespace and comments that the lexer skips,
+# and each must start at its first terminal all the same.
+compile skip
+check_jit tests/grammars/skip.trace $DIR/skip.gzc tests/grammars/skip.in
+
+# JSON has no expected trace here, since its grammar is in sketches/, so
+# compare with the interpreter parsing it in one buffer.
+lua compiler/gzlc -o $DIR/json.gzc sketches/json.gzl || exit 1
+./tests/gzltrace $DIR/json.gzc tests/grammars/json.in > $DIR/json.trace
+check_jit $DIR/json.trace $DIR/json.gzc tests/grammars/json.in
+
+# BasicParser<Handler> binds only the hooks that Handler defines, and
+# gazelle::Parser subclasses get every event.  parseFile() reads in chunks,
+# so it also gets a file that spans many of them.
+( echo '{' ; seq 1000 | sed 's/.*/  "k&": [1, 2.5, "text"],/' ;
+  echo '  "last": null}' ) > $DIR/long.json
+for IN in tests/grammars/json.in $DIR/long.json ; do
+  CHECKS=`expr $CHECKS + 1`
+  if ! ./tests/test_basic_parser $DIR/json.gzc $IN ; then
+    FAILED=`expr $FAILED + 1`
+  fi
+done
+
+# gzlc --emit-c writes the grammar as C with its lexers and GLAs coded
+# directly; gzltrace built with that C must print what the interpreter does.
+# emit_c GRAMMAR GZL: compiles GZL to $DIR/GRAMMAR.gzc and .c, and builds
+# $DIR/gzltrace-GRAMMAR with the C.
+RTOBJ=`ls runtime/*.c | sed 's/\.c$/.o/'`
+emit_c() {
+  lua compiler/gzlc --emit-c $DIR/$1.c -o $DIR/$1.gzc $2 || exit 1
+  ${CC:-cc} -std=c99 -Iruntime/include -DGZLTRACE_GRAMMAR=gzl_load_$1_grammar \
+      -o $DIR/gzltrace-$1 tests/gzltrace.c $DIR/$1.c $RTOBJ || exit 1
+}
+emit_c munch tests/grammars/munch.gzl
+emit_c lookahead tests/grammars/lookahead.gzl
+emit_c json sketches/json.gzl
+for N in 1 2 3 64 ; do
+  for FORK in "" --fork ; do
+    GZLTRACE=$DIR/gzltrace-munch
+    check tests/grammars/munch.trace $FORK --chunk-size $N $DIR/munch.gzc \
+          tests/grammars/munch.in
+    GZLTRACE=$DIR/gzltrace-lookahead
+    for IN in lookahead lookahead-error ; do
+      check tests/grammars/$IN.trace $FORK --chunk-size $N \
+            $DIR/lookahead.gzc tests/grammars/$IN.in
+    done
+    GZLTRACE=$DIR/gzltrace-json
+    check $DIR/json.trace $FORK --chunk-size $N $DIR/json.gzc \
+          tests/grammars/json.in
+  done
+done
+GZLTRACE=./tests/gzltrace
+
+# gzl_dup_parse_state() shares the parse stack between the original and the
+# copy, so fork the parse at every chunk boundary: gzltrace --fork adds a line
+# to its trace for every copy that does not print what an unforked parse does.
+for N in 1 2 3 5 8 ; do
+  check tests/grammars/munch.trace --fork --chunk-size $N $DIR/munch.gzc \
+        tests/grammars/munch.in
+  for IN in lookahead lookahead-error ; do
+    check tests/grammars/$IN.trace --fork --chunk-size $N $DIR/lookahead.gzc \
+          tests/grammars/$IN.in
+  done
+  check tests/grammars/skip.trace --fork --chunk-size $N $DIR/skip.gzc \
+        tests/grammars/skip.in
+  check $DIR/json.trace --fork --chunk-size $N $DIR/json.gzc \
+        tests/grammars/json.in
+done
+check $DIR/json.trace --fork --jit --chunk-size 1 $DIR/json.gzc \
+      tests/grammars/json.in
+
+# A copy made in a callback carries on from the middle of a terminal, and
+# must print the rest of what the parse it was copied from does.  Forking
+# in fewer callbacks lets the stack grow between forks.
+for E in 1 2 3 5 ; do
+  for N in 1 3 64 ; do
+    check tests/grammars/munch.trace --fork-in-callbacks $E --chunk-size $N \
+          $DIR/munch.gzc tests/grammars/munch.in
+    for IN in lookahead lookahead-error ; do
+      check tests/grammars/$IN.trace --fork-in-callbacks $E --chunk-size $N \
+            $DIR/lookahead.gzc tests/grammars/$IN.in
+    done
+    check $DIR/json.trace --fork-in-callbacks $E --chunk-size $N \
+          $DIR/json.gzc tests/grammars/json.in
+  done
+done
+check $DIR/json.trace --fork-in-callbacks 1 --jit $DIR/json.gzc \
+      tests/grammars/json.in
+
+# In lazy_lines mode gzltrace resolves every offset it prints, which must
+# come out the same, and copies share the newline index.
+for N in 1 3 64 ; do
+  for FORK in "" --fork "--fork-in-callbacks 3" ; do
+    for IN in lookahead lookahead-error ; do
+      check tests/grammars/$IN.trace --lazy-lines $FORK --chunk-size $N \
+            $DIR/lookahead.gzc tests/grammars/$IN.in
+    done
+    check tests/grammars/skip.trace --lazy-lines $FORK --chunk-size $N \
+          $DIR/skip.gzc tests/grammars/skip.in
+    check $DIR/json.trace --lazy-lines $FORK --chunk-size $N \
+          $DIR/json.gzc tests/grammars/json.in
+  done
+done
+
+# gzltrace --tape N reads rules and terminals off an event tape of N events,
+# which must give what the callbacks do (--events prints them the same way).
+# Small tapes make gzl_parse() stop with GZL_STATUS_TAPE_FULL and keep
+# events waiting for the next tape, which --fork copies must get.
+for G in munch:munch lookahead:lookahead lookahead:lookahead-error \
+         skip:skip json:json ; do
+  GZC=$DIR/`echo $G | cut -d: -f1`.gzc
+  IN=tests/grammars/`echo $G | cut -d: -f2`.in
+  ./tests/gzltrace --events $GZC $IN > $DIR/events
+  for T in 1 2 3 64 ; do
+    for N in 1 3 64 ; do
+      check $DIR/events --tape $T --chunk-size $N $GZC $IN
+      check $DIR/events --tape $T --fork --chunk-size $N $GZC $IN
+    done
+  done
+  check $DIR/events --tape 1 --jit --chunk-size 1 $GZC $IN
+done
+
+# subscribed EVENTS RULES TERMINALS: prints the lines of the --events trace
+# EVENTS for the rules and terminals named (separated by spaces), or for
+# every rule or terminal if none are.
+subscribed() {
+  awk -v rules=" $2 " -v terminals=" $3 " '
+    ($1 == "start" || $1 == "end") && rules != "  " &&
+        index(rules, " " $2 " ") == 0 { next }
+    $1 == "terminal" && terminals != "  " &&
+        index(terminals, " " $2 " ") == 0 { next }
+    { print }' $1
+}
+
+# check_subscribed GRAMMAR INPUT RULES TERMINALS: subscribed to those rules and
+# terminals, gzltrace must print only their events, with callbacks or a tape.
+check_subscribed() {
+  SUB_GZC=$DIR/$1.gzc
+  SUB_IN=tests/grammars/$2.in
+  ./tests/gzltrace --events $SUB_GZC $SUB_IN > $DIR/events
+  subscribed $DIR/events "$3" "$4" > $DIR/subscribed
+  SUBSCRIBE=
+  for NAME in $3 $4 ; do
+    SUBSCRIBE="$SUBSCRIBE --subscribe $NAME"
+  done
+  for MODE in --events "--tape 1" "--tape 3" ; do
+    for N in 1 64 ; do
+      check $DIR/subscribed $MODE $SUBSCRIBE --chunk-size $N $SUB_GZC $SUB_IN
+      check $DIR/subscribed $MODE $SUBSCRIBE --fork --chunk-size $N \
+            $SUB_GZC $SUB_IN
+    done
+  done
+}
+check_subscribed munch munch "" "abc d"
+for IN in lookahead lookahead-error ; do
+  check_subscribed lookahead $IN "expr" ""
+  check_subscribed lookahead $IN "" "name ;"
+  check_subscribed lookahead $IN "stmt whitespace" "num"
+done
+check_subscribed json json "string" ""
+check_subscribed json json "value" ", :"
+
+# A state that is reset, or released to the pool and acquired again, after
+# parsing half the input and being duplicated must parse it all as a fresh
+# one does, pushing the start frames again, and must no longer share its
+# stack or newline index with the copy.
+for AGAIN in --reset --pool ; do
+  for N in 1 3 64 ; do
+    check tests/grammars/munch.trace $AGAIN --chunk-size $N \
+          $DIR/munch.gzc tests/grammars/munch.in
+    for IN in lookahead lookahead-error ; do
+      for OPTS in "" --lazy-lines --fork ; do
+        check tests/grammars/$IN.trace $AGAIN $OPTS --chunk-size $N \
+              $DIR/lookahead.gzc tests/grammars/$IN.in
+      done
+    done
+    check $DIR/json.trace $AGAIN --lazy-lines --chunk-size $N \
+          $DIR/json.gzc tests/grammars/json.in
+  done
+  ./tests/gzltrace --events $DIR/json.gzc tests/grammars/json.in > $DIR/events
+  check $DIR/events $AGAIN --tape 2 --chunk-size 3 $DIR/json.gzc \
+        tests/grammars/json.in
+done
+
+# Parse states allocated from a heap arena, whose blocks may be smaller than
+# what the state asks for, must parse as those from malloc() do.
+for B in 64 4096 ; do
+  for N in 1 3 64 ; do
+    for OPTS in "" --fork --lazy-lines ; do
+      check $DIR/json.trace --arena $B $OPTS --chunk-size $N $DIR/json.gzc \
+            tests/grammars/json.in
+    done
+  done
+done
+
+# A fixed arena runs out.  Grow it until the parse succeeds: until then,
+# each parse must either find no room for the state (gzltrace exits with 1)
+# or print what the parse in the heap did up to where it stopped with
+# GZL_STATUS_RESOURCE_LIMIT_EXCEEDED (4), and at least one must do that.
+# Small chunks make the state grow its carry past what it starts with.
+for N in 1 3 ; do
+  SIZE=1024
+  EXCEEDED=0
+  while true ; do
+    CHECKS=`expr $CHECKS + 1`
+    ./tests/gzltrace --fixed-arena $SIZE --chunk-size $N $DIR/json.gzc \
+        tests/grammars/json.in > $DIR/trace 2> /dev/null
+    STATUS=$?
+    LINES=`expr \`wc -l < $DIR/trace\` - 1`
+    head -n $LINES $DIR/json.trace > $DIR/expected
+    sed '$d' $DIR/trace > $DIR/got
+    if [ $STATUS = 0 ] && cmp -s $DIR/json.trace $DIR/trace ; then
+      break
+    elif [ $STATUS = 0 ] && tail -n 1 $DIR/trace | grep -q '^status 4 ' &&
+         cmp -s $DIR/expected $DIR/got ; then
+      EXCEEDED=1
+    elif [ $STATUS != 1 ] ; then
+      echo "FAILED: gzltrace --fixed-arena $SIZE --chunk-size $N"
+      tail -n 1 $DIR/trace
+      FAILED=`expr $FAILED + 1`
+      break
+    fi
+    SIZE=`expr $SIZE + 16`
+  done
+  if [ $EXCEEDED = 0 ] ; then
+    echo "FAILED: no fixed arena ran out partway with --chunk-size $N"
+    FAILED=`expr $FAILED + 1`
+  fi
+done
+
+# Make each of the loader's allocations fail in turn: it must return NULL
+# and give back everything it had allocated (gzltrace exits with 2 if it
+# does not), until there are enough allocations for it to succeed.
+N=1
+while true ; do
+  CHECKS=`expr $CHECKS + 1`
+  ./tests/gzltrace --fail-alloc $N $DIR/json.gzc tests/grammars/json.in \
+      > $DIR/trace 2> /dev/null
+  STATUS=$?
+  if [ $STATUS = 0 ] && cmp -s $DIR/json.trace $DIR/trace ; then
+    break
+  elif [ $STATUS != 1 ] ; then
+    echo "FAILED: gzltrace --fail-alloc $N (exit status $STATUS)"
+    FAILED=`expr $FAILED + 1`
+    break
+  fi
+  N=`expr $N + 1`
+done
+
+echo "Runtime checks: $FAILED of $CHECKS failed."
+[ $FAILED = 0 ]
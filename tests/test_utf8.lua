@@ -0,0 +1,145 @@
+--[[--------------------------------------------------------------------
+
+  Gazelle: a system for building fast, reusable parsers
+
+  tests/test_utf8.lua
+
+  Routines that test the translation of Unicode characters and character
+  classes in regexes into UTF-8 byte sequences.
+
+  Copyright (c) 2008 Joshua Haberman.  See LICENSE for details.
+
+--------------------------------------------------------------------]]--
+
+require "luaunit"
+require "data_structures"
+require "nfa_construct"
+require "bootstrap/rtn"
+require "grammar"
+require "ll"
+
+function assert_byte_ranges(low, high, expected)
+  local sequences = nfa_construct.utf8_byte_ranges(low, high)
+  local actual = {}
+  for sequence in each(sequences) do
+    local bytes = {}
+    for range in each(sequence) do
+      table.insert(bytes, {range.low, range.high})
+    end
+    table.insert(actual, bytes)
+  end
+  assert_equals(expected, actual)
+end
+
+TestUTF8 = {}
+  function TestUTF8:test_encode()
+    assert_equals({0x41}, nfa_construct.utf8_encode(0x41))
+    assert_equals({0xC3, 0xA9}, nfa_construct.utf8_encode(0xE9))
+    assert_equals({0xE2, 0x82, 0xAC}, nfa_construct.utf8_encode(0x20AC))
+    assert_equals({0xF0, 0x9F, 0x98, 0x80}, nfa_construct.utf8_encode(0x1F600))
+  end
+
+  function TestUTF8:test_single_length()
+    assert_byte_ranges(0x61, 0x7A, {{{0x61, 0x7A}}})
+    assert_byte_ranges(0x80, 0x7FF, {{{0xC2, 0xDF}, {0x80, 0xBF}}})
+  end
+
+  function TestUTF8:test_split_on_continuation_boundary()
+    assert_byte_ranges(0x391, 0x3C9, {{{0xCE, 0xCE}, {0x91, 0xBF}},
+                                      {{0xCF, 0xCF}, {0x80, 0x89}}})
+  end
+
+  function TestUTF8:test_split_on_length()
+    assert_byte_ranges(0x7F, 0x80, {{{0x7F, 0x7F}},
+                                    {{0xC2, 0xC2}, {0x80, 0x80}}})
+  end
+
+  function TestUTF8:test_skip_surrogates()
+    assert_byte_ranges(0xD7FF, 0xE000, {{{0xED, 0xED}, {0x9F, 0x9F}, {0xBF, 0xBF}},
+                                        {{0xEE, 0xEE}, {0x80, 0x80}, {0x80, 0x80}}})
+  end
+-- class TestUTF8
+
+function parse_char(regex_text)
+  return regex_parser.parse_char(regex_parser.TokenStream:new(regex_text))
+end
+
+-- Returns the IntFA that lexes the single terminal "t" given by the regex.
+function intfa_for_regex(regex_text)
+  local grammar = Grammar:new()
+  grammar:parse_source_string("s -> .t=/" .. regex_text .. "/;")
+  grammar:process()
+  grammar:minimize_rtns()
+  grammar:compute_lookahead()
+  grammar:generate_intfas()
+  assert_equals(1, grammar.master_intfas:count())
+  return grammar.master_intfas:element_at(1)
+end
+
+-- Runs the IntFA over the bytes of str, returning whether it ends in a
+-- final state.
+function intfa_accepts(intfa, str)
+  local state = intfa.start
+  for i=1,#str do
+    local targets = state:transitions_for(str:byte(i), "ANY")
+    if #targets == 0 then return false end
+    state = targets[1][1]
+  end
+  return state.final ~= nil
+end
+
+TestUTF8Regex = {}
+  function TestUTF8Regex:test_parse_char()
+    assert_equals({0x41, false}, {parse_char("A")})
+    assert_equals({0x1F600, true}, {parse_char("\\x{1F600}")})
+    assert_equals({0xE9, false}, {parse_char("\195\169")})
+    assert_equals({0x20AC, false}, {parse_char("\226\130\172")})
+    -- A lead byte without its continuation bytes is taken as Latin-1.
+    assert_equals({0xE9, false}, {parse_char("\233A")})
+  end
+
+  function TestUTF8Regex:test_unterminated_code_point()
+    assert_error(function () parse_char("\\x{41") end)
+    assert_error(function () intfa_for_regex("\\x{41") end)
+  end
+
+  function TestUTF8Regex:test_code_point_escape()
+    local intfa = intfa_for_regex("\\x{1F600}")
+    assert_equals(true, intfa_accepts(intfa, "\240\159\152\128"))
+    assert_equals(false, intfa_accepts(intfa, "\240\159\152"))
+    assert_equals(false, intfa_accepts(intfa, "\240\159\152\129"))
+  end
+
+  function TestUTF8Regex:test_literal_character()
+    -- "caf\195\169" is "café" in UTF-8.
+    local intfa = intfa_for_regex("caf\195\169")
+    assert_equals(true, intfa_accepts(intfa, "caf\195\169"))
+    assert_equals(false, intfa_accepts(intfa, "caf\195"))
+    assert_equals(false, intfa_accepts(intfa, "caf\233"))
+  end
+
+  function TestUTF8Regex:test_class_range_across_lengths()
+    -- U+07F0 through U+0810 takes both two- and three-byte encodings.
+    local intfa = intfa_for_regex("[\\x{7F0}-\\x{810}]")
+    assert_equals(true, intfa_accepts(intfa, "\223\176"))       -- U+07F0
+    assert_equals(true, intfa_accepts(intfa, "\223\191"))       -- U+07FF
+    assert_equals(true, intfa_accepts(intfa, "\224\160\128"))  -- U+0800
+    assert_equals(true, intfa_accepts(intfa, "\224\160\144"))  -- U+0810
+    assert_equals(false, intfa_accepts(intfa, "\223\175"))      -- U+07EF
+    assert_equals(false, intfa_accepts(intfa, "\224\160\145")) -- U+0811
+    assert_equals(false, intfa_accepts(intfa, "\224\160"))
+  end
+
+  function TestUTF8Regex:test_negated_class()
+    -- Every character but "é", including multi-byte ones, but not bytes
+    -- that aren't UTF-8.
+    local intfa = intfa_for_regex("[^\195\169]")
+    assert_equals(true, intfa_accepts(intfa, "e"))
+    assert_equals(true, intfa_accepts(intfa, "\195\168"))          -- U+00E8
+    assert_equals(true, intfa_accepts(intfa, "\226\130\172"))     -- U+20AC
+    assert_equals(false, intfa_accepts(intfa, "\195\169"))         -- U+00E9
+    assert_equals(false, intfa_accepts(intfa, "\255"))
+  end
+-- class TestUTF8Regex
+
+-- vim:et:sts=2:sw=2
@@ -0,0 +1,152 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  gzlbench.c
+
+  A command-line utility for timing the parser.  It reads the whole
+  input into memory, parses it over and over with no callbacks, and
+  reports the best throughput it saw, so that what it measures is
+  the runtime and not I/O or the client.
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <gazelle/parse.h>
+
+void usage()
+{
+    fprintf(stderr, "gzlbench -- A command-line tool for timing the parser.\n");
+    fprintf(stderr, "Gazelle %s  %s.\n", GAZELLE_VERSION, GAZELLE_WEBPAGE);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: gzlbench [--jit] GRAMMAR.gzc INFILE [REPETITIONS]\n");
+    fprintf(stderr, "Parses INFILE REPETITIONS times (default 10) and prints the\n");
+    fprintf(stderr, "best throughput in MB/s.  With --jit, the grammar is compiled to\n");
+    fprintf(stderr, "native code first where that is supported.\n");
+    fprintf(stderr, "\n");
+}
+
+char *read_file(const char *filename, size_t *len)
+{
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+        return NULL;
+
+    size_t size = 64 * 1024;
+    char *buf = malloc(size);
+    *len = 0;
+    while(buf)
+    {
+        *len += fread(buf + *len, 1, size - *len, file);
+        if(*len < size)
+            break;
+        size *= 2;
+        char *new_buf = realloc(buf, size);
+        if(!new_buf)
+            free(buf);
+        buf = new_buf;
+    }
+    fclose(file);
+    return buf;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && strcmp(argv[1], "--help") == 0)
+    {
+        usage();
+        exit(0);
+    }
+
+    bool jit = false;
+    if(argc > 1 && strcmp(argv[1], "--jit") == 0)
+    {
+        jit = true;
+        argc--;
+        argv++;
+    }
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "Not enough arguments.\n");
+        usage();
+        return 1;
+    }
+
+    int reps = argc > 3 ? atoi(argv[3]) : 10;
+    if(reps < 1)
+    {
+        fprintf(stderr, "Bad number of repetitions '%s'.\n", argv[3]);
+        return 1;
+    }
+
+    struct bc_read_stream *s = bc_rs_open_file(argv[1]);
+    if(!s)
+    {
+        printf("Couldn't open bitcode file '%s'!\n\n", argv[1]);
+        usage();
+        return 1;
+    }
+    struct gzl_grammar *g = gzl_load_grammar(s);
+    bc_rs_close_stream(s);
+    if(!g)
+    {
+        printf("Couldn't load grammar '%s'!\n\n", argv[1]);
+        usage();
+        return 1;
+    }
+
+    size_t len;
+    char *buf = read_file(argv[2], &len);
+    if(!buf)
+    {
+        printf("Couldn't open file '%s' for reading: %s\n\n", argv[2], strerror(errno));
+        usage();
+        return 1;
+    }
+
+    struct gzl_bound_grammar bg = {.grammar = g};
+    if(jit && !gzl_bind_grammar_jit(&bg))
+        fprintf(stderr, "No JIT on this platform; interpreting.\n");
+    struct gzl_parse_state *state = gzl_alloc_parse_state();
+    gzl_init_parse_state(state, &bg);
+    double best = -1;
+    for(int i = 0; i < reps; i++)
+    {
+        gzl_reset_parse_state(state);
+        clock_t start = clock();
+        enum gzl_status status = gzl_parse(state, buf, len);
+        bool finished = false;
+        if(status == GZL_STATUS_OK || status == GZL_STATUS_HARD_EOF)
+            finished = gzl_finish_parse(state);
+        double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if(!finished)
+        {
+            fprintf(stderr, "Parse of '%s' failed at byte %zu.\n", argv[2],
+                    state->offset.byte);
+            return 1;
+        }
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+
+    if(best > 0)
+        printf("%zu bytes, best of %d: %.1f MB/s\n", len, reps,
+               len / best / (1024 * 1024));
+    else
+        printf("%zu bytes, best of %d: too fast to time\n", len, reps);
+
+    gzl_free_parse_state(state);
+    gzl_unbind_grammar_jit(&bg);
+    gzl_free_grammar(g);
+    free(buf);
+    return 0;
+}
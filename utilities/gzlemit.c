@@ -0,0 +1,380 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  gzlemit.c
+
+  A command-line utility that turns a compiled grammar into C source
+  (this is what gzlc --emit-c runs).  The output embeds the grammar's
+  bytecode and codes each IntFA's lexer directly as C control flow,
+  one label per state, in the style of re2c, and each GLA's decisions
+  as a switch on its state and the terminal.  The RTNs -- and so every
+  callback, stack frame and copy of the parse state -- are still the
+  interpreter in parse.c, running on the embedded grammar, so a parser
+  built from the output behaves exactly like one that loads the .gzc
+  file.
+
+  Copyright (c) 2007-2009 Joshua Haberman.  See LICENSE for details.
+
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <gazelle/parse.h>
+
+/* States with more byte ranges than this switch on the byte's class
+ * instead of testing each range in turn. */
+#define MAX_RANGE_TESTS 4
+
+void usage()
+{
+    fprintf(stderr, "gzlemit -- Emits a compiled grammar as C source.\n");
+    fprintf(stderr, "Gazelle %s  %s.\n", GAZELLE_VERSION, GAZELLE_WEBPAGE);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: gzlemit GRAMMAR.gzc OUTFILE.c [NAME]\n");
+    fprintf(stderr, "The output defines gzl_load_NAME_grammar(); NAME defaults to\n");
+    fprintf(stderr, "the grammar's file name without its extension.\n");
+    fprintf(stderr, "\n");
+}
+
+char *read_file(const char *filename, size_t *len)
+{
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+        return NULL;
+
+    size_t size = 64 * 1024;
+    char *buf = malloc(size);
+    *len = 0;
+    while(buf)
+    {
+        *len += fread(buf + *len, 1, size - *len, file);
+        if(*len < size)
+            break;
+        size *= 2;
+        char *new_buf = realloc(buf, size);
+        if(!new_buf)
+            free(buf);
+        buf = new_buf;
+    }
+    fclose(file);
+    return buf;
+}
+
+/* Returns the grammar's file name without directory or extension, with
+ * anything that can't be in a C identifier made into an underscore. */
+char *default_name(const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    char *name = malloc(strlen(base) + 1);
+    strcpy(name, base);
+    char *dot = strrchr(name, '.');
+    if(dot && dot != name)
+        *dot = '\0';
+    for(char *p = name; *p; p++)
+        if(!isalnum((unsigned char)*p))
+            *p = '_';
+    return name;
+}
+
+/* True if taking the transition to dest_state would leave the lexer in the
+ * middle of a terminal, which is when lex_bytes() keeps going. */
+bool continues_terminal(struct gzl_intfa_state *dest_state)
+{
+    return dest_state &&
+           !(dest_state->final && dest_state->num_transitions == 0);
+}
+
+void emit_byte_test(FILE *out, int low, int high)
+{
+    if(low == high)
+        fprintf(out, "c == 0x%02x", low);
+    else if(low == 0)
+        fprintf(out, "c <= 0x%02x", high);
+    else if(high == 255)
+        fprintf(out, "c >= 0x%02x", low);
+    else
+        fprintf(out, "c >= 0x%02x && c <= 0x%02x", low, high);
+}
+
+/* Skips a run of bytes in a state that loops on itself, with the same
+ * vectorized scan the interpreter uses. */
+void emit_run(FILE *out, int state_num)
+{
+    fprintf(out, "    p += gzl_scan_intfa_run(&intfa->states[%d], "
+                 "(const char*)p, end - p);\n", state_num);
+}
+
+void emit_state(FILE *out, struct gzl_intfa *intfa, int state_num)
+{
+    struct gzl_intfa_state *state = &intfa->states[state_num];
+    fprintf(out, "s%d:\n", state_num);
+    if(state->run_type != GZL_INTFA_RUN_NONE)
+        emit_run(out, state_num);
+    fprintf(out, "    if(p == end) { s = %d; goto out; }\n", state_num);
+
+    int num_ranges = 0;
+    for(int i = 0; i < state->num_transitions; i++)
+        if(continues_terminal(state->transitions[i].dest_state))
+            num_ranges++;
+
+    if(num_ranges <= MAX_RANGE_TESTS)
+    {
+        if(num_ranges > 0)
+            fprintf(out, "    c = *p;\n");
+        for(int i = 0; i < state->num_transitions; i++)
+        {
+            struct gzl_intfa_transition *t = &state->transitions[i];
+            if(!continues_terminal(t->dest_state))
+                continue;
+            fprintf(out, "    if(");
+            emit_byte_test(out, t->ch_low, t->ch_high);
+            fprintf(out, ") { p++; goto s%d; }\n",
+                    (int)(t->dest_state - intfa->states));
+        }
+    }
+    else
+    {
+        /* Group the byte classes by the state they go to. */
+        fprintf(out, "    switch(byte_class[*p]) {\n");
+        bool *done = calloc(intfa->num_byte_classes, sizeof(*done));
+        for(int i = 0; i < intfa->num_byte_classes; i++)
+        {
+            struct gzl_intfa_state *dest_state = state->next_state[i];
+            if(done[i] || !continues_terminal(dest_state))
+                continue;
+            for(int j = i; j < intfa->num_byte_classes; j++)
+            {
+                if(state->next_state[j] != dest_state)
+                    continue;
+                fprintf(out, "      case %d:\n", j);
+                done[j] = true;
+            }
+            fprintf(out, "        p++; goto s%d;\n",
+                    (int)(dest_state - intfa->states));
+        }
+        free(done);
+        fprintf(out, "    }\n");
+    }
+    fprintf(out, "    s = %d; goto out;\n\n", state_num);
+}
+
+void emit_intfa(FILE *out, struct gzl_intfa *intfa, int intfa_num)
+{
+    bool needs_byte_class = false;
+    for(int i = 0; i < intfa->num_states; i++)
+    {
+        struct gzl_intfa_state *state = &intfa->states[i];
+        int num_ranges = 0;
+        for(int j = 0; j < state->num_transitions; j++)
+            if(continues_terminal(state->transitions[j].dest_state))
+                num_ranges++;
+        if(num_ranges > MAX_RANGE_TESTS)
+            needs_byte_class = true;
+    }
+
+    fprintf(out, "static\n");
+    fprintf(out, "size_t lex_intfa_%d(struct gzl_intfa *intfa, "
+                 "struct gzl_intfa_state **state,\n", intfa_num);
+    fprintf(out, "                   const char *buf, size_t i, "
+                 "size_t buf_len)\n");
+    fprintf(out, "{\n");
+    if(needs_byte_class)
+    {
+        fprintf(out, "    static const unsigned char byte_class[256] = {");
+        for(int i = 0; i < 256; i++)
+            fprintf(out, "%s%s%d", i > 0 ? "," : "",
+                    i % 16 == 0 ? "\n        " : " ", intfa->byte_class[i]);
+        fprintf(out, "\n    };\n");
+    }
+    fprintf(out, "    const unsigned char *p = "
+                 "(const unsigned char*)buf + i;\n");
+    fprintf(out, "    const unsigned char *end = "
+                 "(const unsigned char*)buf + buf_len;\n");
+    fprintf(out, "    unsigned char c;\n");
+    fprintf(out, "    int s;\n\n");
+
+    fprintf(out, "    switch(*state - intfa->states) {\n");
+    for(int i = 0; i < intfa->num_states; i++)
+        fprintf(out, "      case %d: goto s%d;\n", i, i);
+    fprintf(out, "    }\n\n");
+
+    for(int i = 0; i < intfa->num_states; i++)
+        emit_state(out, intfa, i);
+
+    fprintf(out, "out:\n");
+    fprintf(out, "    (void)c;\n");
+    fprintf(out, "    *state = &intfa->states[s];\n");
+    fprintf(out, "    return p - (const unsigned char*)buf;\n");
+    fprintf(out, "}\n\n");
+}
+
+/* Codes the GLA's decisions as a switch on the nonfinal state and, inside
+ * it, on the terminal.  A state that has two transitions on a terminal
+ * takes the first, as find_gla_transition() does. */
+void emit_gla(FILE *out, struct gzl_gla *gla, int gla_num)
+{
+    fprintf(out, "static\n");
+    int indent = fprintf(out, "struct gzl_gla_transition *decide_gla_%d(",
+                         gla_num);
+    fprintf(out, "struct gzl_gla *gla,\n");
+    fprintf(out, "%*sstruct gzl_gla_state *state, int term_id)\n", indent,
+            "");
+    fprintf(out, "{\n");
+    fprintf(out, "    switch(state - gla->states) {\n");
+    for(int i = 0; i < gla->num_states; i++)
+    {
+        struct gzl_gla_state *state = &gla->states[i];
+        if(state->is_final || state->d.nonfinal.num_transitions == 0)
+            continue;
+        struct gzl_nonfinal_info *nonfinal = &state->d.nonfinal;
+        fprintf(out, "      case %d:\n", i);
+        fprintf(out, "        switch(term_id) {\n");
+        for(int j = 0; j < nonfinal->num_transitions; j++)
+        {
+            struct gzl_gla_transition *t = &nonfinal->transitions[j];
+            bool seen = false;
+            for(int k = 0; k < j; k++)
+                if(nonfinal->transitions[k].term_id == t->term_id)
+                    seen = true;
+            if(seen)
+                continue;
+            fprintf(out, "          case %d: return &gla->transitions[%d];\n",
+                    t->term_id, (int)(t - gla->transitions));
+        }
+        fprintf(out, "        }\n");
+        fprintf(out, "        break;\n");
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return NULL;\n");
+    fprintf(out, "}\n\n");
+}
+
+void emit_grammar(FILE *out, struct gzl_grammar *g, const char *name,
+                  const char *filename, const char *bytecode, size_t len)
+{
+    fprintf(out, "/*\n");
+    fprintf(out, " * Generated by gzlc --emit-c from %s.  Do not edit.\n",
+            filename);
+    fprintf(out, " *\n");
+    fprintf(out, " * gzl_load_%s_grammar() returns the grammar, with every "
+                 "IntFA lexing\n", name);
+    fprintf(out, " * and every GLA deciding through the direct-coded "
+                 "functions below, or\n");
+    fprintf(out, " * NULL if it cannot be loaded.  Bind and free it like "
+                 "any other grammar.\n");
+    fprintf(out, " */\n\n");
+    fprintf(out, "#include <gazelle/parse.h>\n\n");
+
+    fprintf(out, "static const unsigned char bytecode[%zu] = {", len);
+    for(size_t i = 0; i < len; i++)
+        fprintf(out, "%s%s0x%02x", i > 0 ? "," : "",
+                i % 12 == 0 ? "\n    " : " ", (unsigned char)bytecode[i]);
+    fprintf(out, "\n};\n\n");
+
+    for(int i = 0; i < g->num_intfas; i++)
+        emit_intfa(out, &g->intfas[i], i);
+
+    /* C has no empty arrays, so a grammar with no IntFAs has no table. */
+    if(g->num_intfas > 0)
+    {
+        fprintf(out, "static gzl_lex_func *const lexers[%d] = {\n",
+                g->num_intfas);
+        for(int i = 0; i < g->num_intfas; i++)
+            fprintf(out, "    lex_intfa_%d%s\n", i,
+                    i < g->num_intfas - 1 ? "," : "");
+        fprintf(out, "};\n\n");
+    }
+
+    for(int i = 0; i < g->num_glas; i++)
+        emit_gla(out, &g->glas[i], i);
+    if(g->num_glas > 0)
+    {
+        fprintf(out, "static gzl_gla_func *const deciders[%d] = {\n",
+                g->num_glas);
+        for(int i = 0; i < g->num_glas; i++)
+            fprintf(out, "    decide_gla_%d%s\n", i,
+                    i < g->num_glas - 1 ? "," : "");
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "struct gzl_grammar *gzl_load_%s_grammar()\n", name);
+    fprintf(out, "{\n");
+    fprintf(out, "    struct bc_read_stream *s =\n");
+    fprintf(out, "        bc_rs_open_mem_len((const char*)bytecode, "
+                 "sizeof(bytecode));\n");
+    fprintf(out, "    struct gzl_grammar *g = gzl_load_grammar(s);\n");
+    fprintf(out, "    bc_rs_close_stream(s);\n");
+    fprintf(out, "    if(!g)\n");
+    fprintf(out, "        return NULL;\n");
+    if(g->num_intfas > 0)
+    {
+        fprintf(out, "    for(int i = 0; i < %d; i++)\n", g->num_intfas);
+        fprintf(out, "        g->intfas[i].lex = lexers[i];\n");
+    }
+    if(g->num_glas > 0)
+    {
+        fprintf(out, "    for(int i = 0; i < %d; i++)\n", g->num_glas);
+        fprintf(out, "        g->glas[i].decide = deciders[i];\n");
+    }
+    fprintf(out, "    return g;\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && strcmp(argv[1], "--help") == 0)
+    {
+        usage();
+        exit(0);
+    }
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "Not enough arguments.\n");
+        usage();
+        return 1;
+    }
+
+    size_t len;
+    char *bytecode = read_file(argv[1], &len);
+    if(!bytecode)
+    {
+        printf("Couldn't open file '%s' for reading: %s\n\n", argv[1], strerror(errno));
+        usage();
+        return 1;
+    }
+    struct bc_read_stream *s = bc_rs_open_mem_len(bytecode, len);
+    struct gzl_grammar *g = gzl_load_grammar(s);
+    bc_rs_close_stream(s);
+    if(!g)
+    {
+        fprintf(stderr, "gzlemit: '%s' is not a valid compiled grammar.\n",
+                argv[1]);
+        free(bytecode);
+        return 1;
+    }
+
+    char *name = default_name(argc > 3 ? argv[3] : argv[1]);
+    FILE *out = fopen(argv[2], "w");
+    if(!out)
+    {
+        printf("Couldn't open file '%s' for writing: %s\n\n", argv[2], strerror(errno));
+        usage();
+        return 1;
+    }
+    const char *filename = strrchr(argv[1], '/');
+    emit_grammar(out, g, name, filename ? filename + 1 : argv[1],
+                 bytecode, len);
+    fclose(out);
+
+    free(name);
+    gzl_free_grammar(g);
+    free(bytecode);
+    return 0;
+}
@@ -30,6 +30,7 @@ void usage()
     fprintf(stderr, "\n");
     fprintf(stderr, "  --dump-json    Dump a parse tree in JSON as text is parsed.\n");
     fprintf(stderr, "  --dump-total   When parsing finishes, print the number of bytes parsed.\n");
+    fprintf(stderr, "  --jit          Compile the grammar to native code where supported.\n");
     fprintf(stderr, "  --help         You're looking at it.\n");
     fprintf(stderr, "\n");
 }
@@ -117,7 +118,7 @@ void terminal_callback(struct gzl_parse_state *parse_state,
 {
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(parse_state->parse_stack);
+    struct gzl_parse_stack_frame *frame = GZL_STACK_TOP(parse_state);
     assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
     struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
 
@@ -146,21 +147,22 @@ void start_rule_callback(struct gzl_parse_state *parse_state)
 {
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(parse_state->parse_stack);
+    struct gzl_parse_stack_frame *frame = GZL_STACK_TOP(parse_state);
     assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
     struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
 
     print_newline(user_state, false);
     print_indent(user_state);
     char *rule = get_json_escaped_string(rtn_frame->rtn->name, 0); 
+    struct gzl_offset *start_offset = GZL_FRAME_START_OFFSET(parse_state, frame);
     printf("{\"rule\":%s, \"start\": %zu, \"line\": %zu, \"column\": %zu, ",
-           rule, frame->start_offset.byte,
-           frame->start_offset.line, frame->start_offset.column);
+           rule, start_offset->byte, start_offset->line, start_offset->column);
     free(rule);
 
-    if(parse_state->parse_stack_len > 1)
+    int depth = gzl_stack_depth(parse_state);
+    if(depth > 1)
     {
-        frame--;
+        frame = gzl_stack_frame_at(parse_state, depth - 2);
         struct gzl_rtn_frame *prev_rtn_frame = &frame->f.rtn_frame;
         char *slotname = get_json_escaped_string(prev_rtn_frame->rtn_transition->slotname, 0);
         printf("\"slotname\":%s, \"slotnum\":%d, ",
@@ -200,13 +202,14 @@ void end_rule_callback(struct gzl_parse_state *parse_state)
 {
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(parse_state->parse_stack);
+    struct gzl_parse_stack_frame *frame = GZL_STACK_TOP(parse_state);
     assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
 
     RESIZE_DYNARRAY(user_state->first_child, user_state->first_child_len-1);
     print_newline(user_state, true);
     print_indent(user_state);
-    printf("], \"len\": %zu}", parse_state->offset.byte - frame->start_offset.byte);
+    printf("], \"len\": %zu}",
+           parse_state->offset.byte - GZL_FRAME_START_OFFSET(parse_state, frame)->byte);
 }
 
 int main(int argc, char *argv[])
@@ -227,12 +230,15 @@ int main(int argc, char *argv[])
     int arg_offset = 1;
     bool dump_json = false;
     bool dump_total = false;
+    bool jit = false;
     while(arg_offset < argc && argv[arg_offset][0] == '-')
     {
         if(strcmp(argv[arg_offset], "--dump-json") == 0)
             dump_json = true;
         else if(strcmp(argv[arg_offset], "--dump-total") == 0)
             dump_total = true;
+        else if(strcmp(argv[arg_offset], "--jit") == 0)
+            jit = true;
         else
         {
             fprintf(stderr, "Unrecognized option '%s'.\n", argv[arg_offset]);
@@ -258,6 +264,12 @@ int main(int argc, char *argv[])
     }
     struct gzl_grammar *g = gzl_load_grammar(s);
     bc_rs_close_stream(s);
+    if(!g)
+    {
+        printf("Couldn't load grammar '%s'!\n\n", argv[1]);
+        usage();
+        return 1;
+    }
 
     /* Open the input file. */
     FILE *file;
@@ -292,6 +304,8 @@ int main(int argc, char *argv[])
         bg.will_end_rule_cb = end_rule_callback;
         fputs("{\"parse_tree\":", stdout);
     }
+    if(jit)
+        gzl_bind_grammar_jit(&bg);
     gzl_init_parse_state(state, &bg);
     enum gzl_status status = gzl_parse_file(state, file, &user_state, 50 * 1024);
 
@@ -320,6 +334,10 @@ int main(int argc, char *argv[])
             /* TODO: when we support length caps. */
             break;
 
+        case GZL_STATUS_TAPE_FULL:
+            /* We take our events through callbacks, not an event tape. */
+            break;
+
         case GZL_STATUS_RESOURCE_LIMIT_EXCEEDED:
             /* TODO: more informative message about what limit was exceeded. */
             fprintf(stderr, "gzlparse: resource limit exceeded.\n");
@@ -335,6 +353,7 @@ int main(int argc, char *argv[])
     }
 
     gzl_free_parse_state(state);
+    gzl_unbind_grammar_jit(&bg);
     gzl_free_grammar(g);
     FREE_DYNARRAY(user_state.first_child);
     fclose(file);